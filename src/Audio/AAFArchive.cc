@@ -7,12 +7,15 @@
 #include <filesystem>
 #include <format>
 #include <map>
+#include <memory>
 #include <phosg/Encoding.hh>
 #include <phosg/Filesystem.hh>
 #include <unordered_map>
 #include <vector>
 
+#include "../MappedFile.hh"
 #include "Instrument.hh"
+#include "SampleStore.hh"
 #include "WAVFile.hh"
 
 using namespace std;
@@ -84,7 +87,7 @@ struct WSYSHeader {
   phosg::be_uint32_t wbct_offset;
 } __attribute__((packed));
 
-pair<uint32_t, vector<Sound>> wsys_decode(const void* vdata, const char* base_directory) {
+pair<uint32_t, vector<Sound>> wsys_decode(const void* vdata, const char* base_directory, shared_ptr<SampleStore> sample_store) {
   const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
 
   const WSYSHeader* wsys = reinterpret_cast<const WSYSHeader*>(data);
@@ -139,20 +142,20 @@ pair<uint32_t, vector<Sound>> wsys_decode(const void* vdata, const char* base_di
       continue;
     }
 
-    string aw_file_contents;
+    shared_ptr<const MappedFile> aw_file;
 
     // try both Banks and Waves subdirectories
     static const vector<string> directory_names({"Banks", "Waves"});
     for (const auto& directory_name : directory_names) {
       string aw_filename = format("{}/{}/{}", base_directory, directory_name, entry->filename);
       try {
-        aw_file_contents = phosg::load_file(aw_filename.c_str());
+        aw_file = sample_store->open_wave_archive(aw_filename);
         break;
       } catch (const phosg::cannot_open_file&) {
         continue;
       }
     }
-    if (aw_file_contents.empty()) {
+    if (!aw_file || !aw_file->size()) {
       throw runtime_error(format("{} does not exist in any checked subdirectory", entry->filename));
     }
 
@@ -181,9 +184,11 @@ pair<uint32_t, vector<Sound>> wsys_decode(const void* vdata, const char* base_di
       ret_snd.wave_table_index = y;
       ret_snd.sound_id = sound_id;
 
+      // the samples aren't decoded until they're needed; see SampleStore
+      ret_snd.sample_store = sample_store;
+      SampleStore::Format sample_format;
       if (wav_entry->type < 2) {
-        ret_snd.afc_data = string(aw_file_contents.data() + wav_entry->offset, wav_entry->size);
-        ret_snd.afc_large_frames = (wav_entry->type == 1);
+        sample_format = (wav_entry->type == 1) ? SampleStore::Format::AFC_LARGE_FRAMES : SampleStore::Format::AFC_SMALL_FRAMES;
         ret_snd.num_channels = 1;
       } else if (wav_entry->type < 4) {
         // uncompressed big-endian mono/stereo apparently
@@ -200,19 +205,21 @@ pair<uint32_t, vector<Sound>> wsys_decode(const void* vdata, const char* base_di
           ret_snd.sample_rate /= 2;
         }
 
-        size_t num_samples = wav_entry->size / 2; // 16-bit samples
-        ret_snd.decoded_samples.reserve(num_samples);
-        const phosg::be_int16_t* samples = reinterpret_cast<const phosg::be_int16_t*>(
-            aw_file_contents.data() + wav_entry->offset);
-        for (size_t z = 0; z < num_samples; z++) {
-          int16_t sample = samples[z];
-          float decoded = (sample == -0x8000) ? -1.0 : (static_cast<float>(sample) / 32767.0f);
-          ret_snd.decoded_samples.emplace_back(decoded);
-        }
+        sample_format = SampleStore::Format::PCM16_BE;
         ret_snd.num_channels = is_stereo ? 2 : 1;
       } else {
         throw runtime_error(format("unknown wav entry type: 0x{:X}", wav_entry->type));
       }
+
+      // if the sound's data isn't all in the file, skip it; instruments that
+      // use it will show up as unresolved, but the rest can still be played
+      try {
+        ret_snd.sample_store_index = sample_store->add(aw_file, wav_entry->offset, wav_entry->size, sample_format);
+      } catch (const out_of_range&) {
+        phosg::fwrite_fmt(stderr, "[SoundEnvironment] warning: sound {} in {} ({:X} bytes at {:X}) extends beyond the end of the file\n",
+            y, entry->filename, wav_entry->size.load(), wav_entry->offset.load());
+        ret.pop_back();
+      }
     }
   }
 
@@ -384,7 +391,7 @@ void SoundEnvironment::merge_from(SoundEnvironment&& other) {
   }
 }
 
-SoundEnvironment aaf_decode(const void* vdata, size_t size, const char* base_directory) {
+SoundEnvironment aaf_decode(const void* vdata, size_t size, const char* base_directory, shared_ptr<SampleStore> sample_store) {
   const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
   size_t offset = 0;
 
@@ -422,7 +429,7 @@ SoundEnvironment aaf_decode(const void* vdata, size_t size, const char* base_dir
             ibnk.chunk_id = chunk_id;
             ret.instrument_banks.emplace(ibnk.id, std::move(ibnk));
           } else {
-            auto wsys_pair = wsys_decode(data + chunk_offset, base_directory);
+            auto wsys_pair = wsys_decode(data + chunk_offset, base_directory, sample_store);
             uint32_t wsys_id = wsys_pair.first ? wsys_pair.first : ret.sample_banks.size();
             if (!ret.sample_banks.emplace(wsys_id, std::move(wsys_pair.second)).second) {
               phosg::fwrite_fmt(stderr, "[SoundEnvironment] warning: duplicate wsys id {:X}\n", wsys_id);
@@ -453,7 +460,7 @@ SoundEnvironment aaf_decode(const void* vdata, size_t size, const char* base_dir
   return ret;
 }
 
-SoundEnvironment baa_decode(const void* vdata, size_t size, const char* base_directory) {
+SoundEnvironment baa_decode(const void* vdata, size_t size, const char* base_directory, shared_ptr<SampleStore> sample_store) {
   const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
   const phosg::be_uint32_t* data_fields = reinterpret_cast<const phosg::be_uint32_t*>(vdata);
   size_t field_offset = 1;
@@ -488,7 +495,7 @@ SoundEnvironment baa_decode(const void* vdata, size_t size, const char* base_dir
         field_offset++; // unclear what this field is
 
         // TODO: should we trust wsys_id here or use the same logic as for aaf?
-        auto wsys_pair = wsys_decode(data + offset, base_directory);
+        auto wsys_pair = wsys_decode(data + offset, base_directory, sample_store);
         wsys_id = wsys_pair.first ? wsys_pair.first : wsys_id;
         if (!ret.sample_banks.emplace(wsys_id, std::move(wsys_pair.second)).second) {
           phosg::fwrite_fmt(stderr, "[SoundEnvironment] warning: duplicate wsys id {:X}\n", wsys_id);
@@ -524,7 +531,7 @@ SoundEnvironment baa_decode(const void* vdata, size_t size, const char* base_dir
           throw invalid_argument("embedded baa is too small for header");
         }
         // there are 4 4-byte fields before the baa apparently
-        ret.merge_from(baa_decode(data + offset + 0x10, end_offset - offset - 0x10, base_directory));
+        ret.merge_from(baa_decode(data + offset + 0x10, end_offset - offset - 0x10, base_directory, sample_store));
         break;
       }
 
@@ -555,7 +562,7 @@ struct BXTableEntry {
   phosg::be_uint32_t size;
 };
 
-SoundEnvironment bx_decode(const void* vdata, size_t, const char* base_directory) {
+SoundEnvironment bx_decode(const void* vdata, size_t, const char* base_directory, shared_ptr<SampleStore> sample_store) {
   // TODO: Be less lazy and implement bounds checks here.
 
   const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
@@ -567,7 +574,7 @@ SoundEnvironment bx_decode(const void* vdata, size_t, const char* base_directory
     if (entry->size == 0) {
       ret.sample_banks.emplace(ret.sample_banks.size(), vector<Sound>());
     } else {
-      auto wsys_pair = wsys_decode(data + entry->offset, base_directory);
+      auto wsys_pair = wsys_decode(data + entry->offset, base_directory, sample_store);
       uint32_t wsys_id = wsys_pair.first ? wsys_pair.first : ret.sample_banks.size();
       if (!ret.sample_banks.emplace(wsys_id, std::move(wsys_pair.second)).second) {
         phosg::fwrite_fmt(stderr, "[SoundEnvironment] warning: duplicate wsys id {:X}\n", wsys_id);
@@ -592,7 +599,11 @@ SoundEnvironment bx_decode(const void* vdata, size_t, const char* base_directory
   return ret;
 }
 
-SoundEnvironment load_sound_environment(const char* base_directory) {
+SoundEnvironment load_sound_environment(const char* base_directory, shared_ptr<SampleStore> sample_store) {
+  if (!sample_store) {
+    sample_store = make_shared<SampleStore>();
+  }
+
   // Pikmin: pikibank.bx has almost everything; the sequence index is inside
   // default.dol (sigh) so it has to be manually extracted. search for 'BARC' in
   // default.dol in a hex editor and copy the resulting data (through the end of
@@ -601,7 +612,7 @@ SoundEnvironment load_sound_environment(const char* base_directory) {
     string filename = format("{}/Banks/pikibank.bx", base_directory);
     if (filesystem::is_regular_file(filename)) {
       string data = phosg::load_file(filename);
-      auto env = bx_decode(data.data(), data.size(), base_directory);
+      auto env = bx_decode(data.data(), data.size(), base_directory, sample_store);
 
       data = phosg::load_file(format("{}/Seqs/sequence.barc", base_directory));
       env.sequence_programs = barc_decode(data.data(), data.size(), base_directory);
@@ -619,7 +630,7 @@ SoundEnvironment load_sound_environment(const char* base_directory) {
       } catch (const phosg::cannot_open_file&) {
         continue;
       }
-      return aaf_decode(data.data(), data.size(), base_directory);
+      return aaf_decode(data.data(), data.size(), base_directory, sample_store);
     }
   }
 
@@ -632,7 +643,7 @@ SoundEnvironment load_sound_environment(const char* base_directory) {
       } catch (const phosg::cannot_open_file&) {
         continue;
       }
-      return baa_decode(data.data(), data.size(), base_directory);
+      return baa_decode(data.data(), data.size(), base_directory, sample_store);
     }
   }
 
@@ -660,7 +671,7 @@ SoundEnvironment create_midi_sound_environment(const unordered_map<int16_t, Inst
 
     auto f = phosg::fopen_unique(it.second.filename);
     auto wav = load_wav(f.get());
-    s.decoded_samples = wav.samples;
+    s.decoded_samples = make_shared<const vector<float>>(std::move(wav.samples));
     s.num_channels = wav.num_channels;
     s.sample_rate = wav.sample_rate;
     if (it.second.base_note >= 0) {
@@ -727,7 +738,7 @@ SoundEnvironment create_json_sound_environment(const phosg::JSON& instruments_js
       sample_bank.emplace_back();
       Sound& s = sample_bank.back();
 
-      s.decoded_samples = wav.samples;
+      s.decoded_samples = make_shared<const vector<float>>(std::move(wav.samples));
       s.num_channels = wav.num_channels;
       s.sample_rate = wav.sample_rate;
       if (base_note > 0) {
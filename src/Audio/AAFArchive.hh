@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <memory>
 #include <phosg/Encoding.hh>
 #include <phosg/Filesystem.hh>
 #include <phosg/JSON.hh>
@@ -12,6 +13,7 @@
 #include <vector>
 
 #include "Instrument.hh"
+#include "SampleStore.hh"
 
 namespace ResourceDASM {
 namespace Audio {
@@ -37,7 +39,10 @@ struct InstrumentMetadata {
   int16_t base_note;
 };
 
-SoundEnvironment load_sound_environment(const char* aw_directory);
+// Sounds from the environment's wave archives are decoded on demand by
+// sample_store. If sample_store is null, a new store with the default size
+// limit is used.
+SoundEnvironment load_sound_environment(const char* aw_directory, std::shared_ptr<SampleStore> sample_store = nullptr);
 SoundEnvironment create_midi_sound_environment(const std::unordered_map<int16_t, InstrumentMetadata>& instrument_metadata);
 SoundEnvironment create_json_sound_environment(const phosg::JSON& instruments_json, const std::string& directory);
 
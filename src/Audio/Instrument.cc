@@ -5,23 +5,25 @@
 #include <string.h>
 
 #include <format>
+#include <memory>
 #include <phosg/Encoding.hh>
 #include <phosg/Filesystem.hh>
 #include <vector>
 
-#include "../AudioCodecs.hh"
-
 using namespace std;
 
 namespace ResourceDASM {
 namespace Audio {
 
-const vector<float>& Sound::samples() const {
-  if (this->decoded_samples.empty()) {
-    this->decoded_samples = decode_afc(this->afc_data.data(), this->afc_data.size(), this->afc_large_frames);
-    this->afc_data.clear();
+shared_ptr<const vector<float>> Sound::samples() const {
+  if (this->decoded_samples) {
+    return this->decoded_samples;
+  }
+  if (this->sample_store) {
+    return this->sample_store->samples(this->sample_store_index);
   }
-  return this->decoded_samples;
+  static const auto empty_samples = make_shared<const vector<float>>();
+  return empty_samples;
 }
 
 VelocityRegion::VelocityRegion(uint8_t vel_low, uint8_t vel_high,
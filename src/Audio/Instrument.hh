@@ -6,18 +6,24 @@
 
 #include <phosg/Encoding.hh>
 #include <phosg/Filesystem.hh>
+#include <memory>
 #include <phosg/Strings.hh>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "SampleStore.hh"
+
 namespace ResourceDASM {
 namespace Audio {
 
 struct Sound {
-  mutable std::string afc_data;
-  bool afc_large_frames;
-  mutable std::vector<float> decoded_samples;
+  // Sounds from WAV files are decoded when they're loaded, and their samples
+  // are in decoded_samples. Sounds from wave archives are decoded on demand by
+  // sample_store instead; for these, decoded_samples is null.
+  std::shared_ptr<const std::vector<float>> decoded_samples;
+  std::shared_ptr<SampleStore> sample_store;
+  size_t sample_store_index;
   size_t num_channels;
   size_t sample_rate;
 
@@ -35,7 +41,9 @@ struct Sound {
   uint32_t aw_file_index;
   uint32_t wave_table_index;
 
-  const std::vector<float>& samples() const;
+  // Never returns null; if the sound has no sample data, returns an empty
+  // vector
+  std::shared_ptr<const std::vector<float>> samples() const;
 };
 
 struct VelocityRegion {
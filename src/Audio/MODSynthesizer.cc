@@ -999,7 +999,7 @@ bool MODSynthesizer::render_current_division_audio() {
 
       // Apply the appropriate portion of the instrument's sample data to the
       // tick output data.
-      const vector<float>* resampled_data = nullptr;
+      shared_ptr<const vector<float>> resampled_data;
       ssize_t segment_index = -1;
       double src_ratio = -1.0;
       double resampled_offset = -1.0;
@@ -1027,7 +1027,7 @@ bool MODSynthesizer::render_current_division_audio() {
           // out_samples_per_in_sample = (sample_rate * 2 * period) / hardware_freq
           // This gives how many samples to generate for each input sample.
           src_ratio = static_cast<double>(2 * this->timing.sample_rate * segment.second) / this->opts->amiga_hardware_frequency;
-          resampled_data = &this->sample_cache.resample_add(track.instrument_num, i.sample_data, 1, src_ratio);
+          resampled_data = this->sample_cache.resample_add(track.instrument_num, i.sample_data, 1, src_ratio);
           resampled_offset = track.input_sample_offset * src_ratio;
 
           // The sample has a loop if the length in words is > 1. We convert words
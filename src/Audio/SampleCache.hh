@@ -6,8 +6,11 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <list>
+#include <memory>
 #include <stdexcept>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace ResourceDASM {
@@ -131,21 +134,46 @@ std::vector<SampleT> resample_audio(
   }
 }
 
+// Holds resampled copies of sounds, keyed by the sound and the resampling
+// ratio. If max_bytes isn't zero, the total size of the resampled data is
+// limited to that many bytes; when a new sound would exceed the limit, the
+// least-recently-used sounds are evicted. The returned data remains valid even
+// if it's later evicted. Not thread-safe.
 template <typename KeyT>
 class SampleCache {
 public:
-  explicit SampleCache(ResampleMethod method) : method(method) {}
+  explicit SampleCache(ResampleMethod method, size_t max_bytes = 0)
+      : method(method),
+        max_bytes(max_bytes),
+        resident_bytes(0) {}
   ~SampleCache() = default;
 
-  const std::vector<float>& at(const KeyT& k, float ratio) const {
-    return this->cache.at(k).at(ratio);
+  // Throws out_of_range if the sound isn't in the cache at this ratio
+  std::shared_ptr<const std::vector<float>> at(const KeyT& k, float ratio) {
+    auto& e = this->cache.at(k).at(ratio);
+    this->lru.splice(this->lru.begin(), this->lru, e.lru_it);
+    return e.data;
   }
 
-  const std::vector<float>& add(const KeyT& k, float ratio, std::vector<float>&& data) {
-    return this->cache[k].emplace(ratio, std::move(data)).first->second;
+  std::shared_ptr<const std::vector<float>> add(const KeyT& k, float ratio, std::vector<float>&& data) {
+    auto& e = this->cache[k][ratio];
+    if (e.data) {
+      return e.data;
+    }
+    // The new sound is never evicted here, even if it alone is larger than the
+    // limit; it will be evicted when the next sound is added instead
+    size_t bytes = data.size() * sizeof(float);
+    if (this->max_bytes) {
+      this->evict_until_size((bytes < this->max_bytes) ? (this->max_bytes - bytes) : 0);
+    }
+    e.data = std::make_shared<const std::vector<float>>(std::move(data));
+    this->lru.emplace_front(k, ratio);
+    e.lru_it = this->lru.begin();
+    this->resident_bytes += bytes;
+    return e.data;
   }
 
-  const std::vector<float>& resample_add(
+  std::shared_ptr<const std::vector<float>> resample_add(
       const KeyT& k, const std::vector<float>& input_samples, size_t num_channels, float ratio) {
     try {
       return this->at(k, ratio);
@@ -159,9 +187,41 @@ public:
     return resample_audio<float>(input_samples, num_channels, src_ratio, this->method);
   }
 
+  // Changing the limit evicts sounds immediately if needed
+  void set_max_bytes(size_t max_bytes) {
+    this->max_bytes = max_bytes;
+    if (this->max_bytes) {
+      this->evict_until_size(this->max_bytes);
+    }
+  }
+
 private:
+  using LRUList = std::list<std::pair<KeyT, float>>; // Most recently used at the front
+
+  struct Entry {
+    std::shared_ptr<const std::vector<float>> data;
+    typename LRUList::iterator lru_it;
+  };
+
   ResampleMethod method;
-  std::unordered_map<KeyT, std::unordered_map<float, std::vector<float>>> cache;
+  size_t max_bytes;
+  size_t resident_bytes;
+  std::unordered_map<KeyT, std::unordered_map<float, Entry>> cache;
+  LRUList lru;
+
+  void evict_until_size(size_t max_bytes) {
+    while (!this->lru.empty() && (this->resident_bytes > max_bytes)) {
+      const auto& [k, ratio] = this->lru.back();
+      auto key_it = this->cache.find(k);
+      auto ratio_it = key_it->second.find(ratio);
+      this->resident_bytes -= ratio_it->second.data->size() * sizeof(float);
+      key_it->second.erase(ratio_it);
+      if (key_it->second.empty()) {
+        this->cache.erase(key_it);
+      }
+      this->lru.pop_back();
+    }
+  }
 };
 
 } // namespace Audio
@@ -0,0 +1,137 @@
+#include "SampleStore.hh"
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <phosg/Encoding.hh>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../AudioCodecs.hh"
+
+using namespace std;
+
+namespace ResourceDASM {
+namespace Audio {
+
+static size_t bytes_for_samples(const vector<float>& samples) {
+  return samples.size() * sizeof(float);
+}
+
+double SampleStore::Stats::hit_rate() const {
+  size_t total = this->hits + this->misses;
+  return total ? (static_cast<double>(this->hits) / total) : 0.0;
+}
+
+SampleStore::SampleStore(size_t max_bytes)
+    : max_bytes(max_bytes) {}
+
+shared_ptr<const MappedFile> SampleStore::open_wave_archive(const string& filename) {
+  lock_guard g(this->lock);
+  auto it = this->wave_archives.find(filename);
+  if (it == this->wave_archives.end()) {
+    it = this->wave_archives.emplace(filename, make_shared<MappedFile>(filename)).first;
+  }
+  return it->second;
+}
+
+size_t SampleStore::add(shared_ptr<const MappedFile> file, uint32_t offset, uint32_t size, Format format) {
+  file->at(offset, size);
+  lock_guard g(this->lock);
+  auto& e = this->entries.emplace_back();
+  e.file = std::move(file);
+  e.offset = offset;
+  e.size = size;
+  e.format = format;
+  return this->entries.size() - 1;
+}
+
+vector<float> SampleStore::decode(const Entry& e) const {
+  const void* data = e.file->at(e.offset, e.size);
+  switch (e.format) {
+    case Format::AFC_SMALL_FRAMES:
+    case Format::AFC_LARGE_FRAMES:
+      return decode_afc(data, e.size, e.format == Format::AFC_LARGE_FRAMES);
+    case Format::PCM16_BE: {
+      size_t num_samples = e.size / 2;
+      const auto* samples = reinterpret_cast<const phosg::be_int16_t*>(data);
+      vector<float> ret;
+      ret.reserve(num_samples);
+      for (size_t z = 0; z < num_samples; z++) {
+        int16_t sample = samples[z];
+        ret.emplace_back((sample == -0x8000) ? -1.0f : (static_cast<float>(sample) / 32767.0f));
+      }
+      return ret;
+    }
+    default:
+      throw logic_error("invalid sample format");
+  }
+}
+
+shared_ptr<const vector<float>> SampleStore::samples(size_t index) {
+  Entry to_decode;
+  {
+    lock_guard g(this->lock);
+    auto& e = this->entries.at(index);
+    if (e.samples) {
+      this->current_stats.hits++;
+      this->lru.splice(this->lru.begin(), this->lru, e.lru_it);
+      return e.samples;
+    }
+    this->current_stats.misses++;
+    to_decode = e;
+  }
+
+  // Decode without holding the lock, so other threads can use sounds that are
+  // already in the cache in the meantime. (entries may be reallocated during
+  // this time, so the decoder uses a copy of the entry.) If another thread
+  // decodes the same sound at the same time, the first one to finish wins.
+  auto decoded = make_shared<const vector<float>>(this->decode(to_decode));
+
+  lock_guard g(this->lock);
+  auto& e = this->entries[index];
+  if (e.samples) {
+    return e.samples;
+  }
+  // The new sound is never evicted here, even if it alone is larger than the
+  // limit; it will be evicted when the next sound is added instead
+  size_t bytes = bytes_for_samples(*decoded);
+  if (this->max_bytes) {
+    this->evict_until_size((bytes < this->max_bytes) ? (this->max_bytes - bytes) : 0);
+  }
+  e.samples = decoded;
+  this->lru.emplace_front(index);
+  e.lru_it = this->lru.begin();
+  this->current_stats.resident_bytes += bytes;
+  this->current_stats.peak_resident_bytes = max<size_t>(
+      this->current_stats.peak_resident_bytes, this->current_stats.resident_bytes);
+  return decoded;
+}
+
+void SampleStore::evict_until_size(size_t max_bytes) {
+  // The caller must hold this->lock
+  while (!this->lru.empty() && (this->current_stats.resident_bytes > max_bytes)) {
+    auto& e = this->entries[this->lru.back()];
+    this->current_stats.resident_bytes -= bytes_for_samples(*e.samples);
+    this->current_stats.evictions++;
+    e.samples.reset();
+    this->lru.pop_back();
+  }
+}
+
+void SampleStore::set_max_bytes(size_t max_bytes) {
+  lock_guard g(this->lock);
+  this->max_bytes = max_bytes;
+  if (this->max_bytes) {
+    this->evict_until_size(this->max_bytes);
+  }
+}
+
+SampleStore::Stats SampleStore::stats() const {
+  lock_guard g(this->lock);
+  return this->current_stats;
+}
+
+} // namespace Audio
+} // namespace ResourceDASM
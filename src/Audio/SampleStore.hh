@@ -0,0 +1,92 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../MappedFile.hh"
+
+namespace ResourceDASM {
+namespace Audio {
+
+// Holds the sample data for all the sounds in a sound environment that come
+// from wave archives (.aw files). The archives are memory-mapped, and each
+// sound is decoded only when it's first used. Decoded sounds are kept in a
+// least-recently-used cache whose total size is limited (unless max_bytes is
+// zero), so memory usage doesn't grow as more sounds are used. All functions
+// may be called from multiple threads at the same time.
+class SampleStore {
+public:
+  enum class Format {
+    AFC_SMALL_FRAMES = 0,
+    AFC_LARGE_FRAMES,
+    PCM16_BE, // Big-endian signed 16-bit samples
+  };
+
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t resident_bytes = 0;
+    size_t peak_resident_bytes = 0;
+
+    double hit_rate() const;
+  };
+
+  static constexpr size_t DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+
+  explicit SampleStore(size_t max_bytes = DEFAULT_MAX_BYTES);
+  SampleStore(const SampleStore&) = delete;
+  SampleStore(SampleStore&&) = delete;
+  SampleStore& operator=(const SampleStore&) = delete;
+  SampleStore& operator=(SampleStore&&) = delete;
+  ~SampleStore() = default;
+
+  // Maps the given wave archive, or returns the existing mapping if it was
+  // already opened. Throws cannot_open_file if the file doesn't exist.
+  std::shared_ptr<const MappedFile> open_wave_archive(const std::string& filename);
+
+  // Registers a sound whose data is in the given part of a wave archive, and
+  // returns its index (to be passed to samples()). Throws out_of_range if the
+  // sound's data extends beyond the end of the file.
+  size_t add(std::shared_ptr<const MappedFile> file, uint32_t offset, uint32_t size, Format format);
+
+  // Returns the decoded samples for a sound, decoding it if it isn't already
+  // in the cache. The returned data remains valid even if the sound is later
+  // evicted from the cache.
+  std::shared_ptr<const std::vector<float>> samples(size_t index);
+
+  // Changing the limit evicts sounds immediately if needed
+  void set_max_bytes(size_t max_bytes);
+  Stats stats() const;
+
+private:
+  struct Entry {
+    std::shared_ptr<const MappedFile> file;
+    uint32_t offset;
+    uint32_t size;
+    Format format;
+    // Null if the sound isn't in the cache. lru_it is valid only if samples
+    // isn't null.
+    std::shared_ptr<const std::vector<float>> samples;
+    std::list<size_t>::iterator lru_it;
+  };
+
+  mutable std::mutex lock;
+  size_t max_bytes;
+  std::unordered_map<std::string, std::shared_ptr<const MappedFile>> wave_archives;
+  std::vector<Entry> entries;
+  std::list<size_t> lru; // Most recently used entries are at the front
+  Stats current_stats;
+
+  std::vector<float> decode(const Entry& e) const;
+  void evict_until_size(size_t max_bytes);
+};
+
+} // namespace Audio
+} // namespace ResourceDASM
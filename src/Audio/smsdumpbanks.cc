@@ -164,13 +164,13 @@ Comments=\n");
   for (const auto& wsys_it : env.sample_banks) {
     for (const auto& s : wsys_it.second) {
       auto samples = s.samples();
-      if (samples.empty()) {
+      if (samples->empty()) {
         phosg::fwrite_fmt(stderr, "warning: can\'t decode {}:{:X}:{:X}\n", s.source_filename, s.source_offset, s.source_size);
         continue;
       }
       string basename = base_filename_for_sound(s);
       string filename = std::format("{}/{}.wav", argv[2], basename);
-      save_wav(filename, samples, s.sample_rate, s.num_channels);
+      save_wav(filename, *samples, s.sample_rate, s.num_channels);
     }
   }
 
@@ -15,6 +15,7 @@
 #include "AAFArchive.hh"
 #include "Constants.hh"
 #include "SampleCache.hh"
+#include "SampleStore.hh"
 #include "WAVFile.hh"
 
 #ifdef SDL3_AVAILABLE
@@ -34,6 +35,7 @@ enum DebugFlag {
   SHOW_LONG_STATUS = 0x0000000000000040,
   SHOW_MISSING_NOTES = 0x0000000000000080,
   SHOW_UNIMPLEMENTED_OPCODES = 0x0000000000000100,
+  SHOW_SAMPLE_STORE_STATS = 0x0000000000000200,
 
   PLAY_MISSING_NOTES = 0x0000000000010000,
 
@@ -42,10 +44,10 @@ enum DebugFlag {
   ALL_COLOR_OPTIONS = 0x0000000000060000,
 
 #ifndef WINDOWS
-  DEFAULT_FLAGS = 0x00000000000600C2,
+  DEFAULT_FLAGS = 0x00000000000602C2,
 #else
   // no color by default on windows (cmd.exe doesn't handle the escapes)
-  DEFAULT_FLAGS = 0x00000000000000C2,
+  DEFAULT_FLAGS = 0x00000000000002C2,
 #endif
 };
 
@@ -792,7 +794,9 @@ public:
         note_off_decay_remaining(-1) {}
   virtual ~Voice() = default;
 
-  virtual vector<float> render(size_t count, float freq_mult, float volume_bias) = 0;
+  // Renders count frames of stereo audio and adds them to the existing samples
+  // in out (which must have space for 2 * count samples)
+  virtual void render(float* out, size_t count, float freq_mult, float volume_bias) = 0;
 
   void off() {
     // TODO: for now we use a constant release time of 1/5 second except in SMS SONG resources;
@@ -833,9 +837,8 @@ public:
       shared_ptr<Channel> channel) : Voice(sample_rate, note, vel, true, channel) {}
   virtual ~SilentVoice() = default;
 
-  virtual vector<float> render(size_t count, float, float) {
+  virtual void render(float*, size_t, float, float) {
     this->advance_note_off_factor();
-    return vector<float>(count * 2, 0.0f);
   }
 };
 
@@ -846,26 +849,49 @@ public:
         offset(0) {}
   virtual ~SineVoice() = default;
 
-  virtual vector<float> render(size_t count, float, float volume_bias) {
+  virtual void render(float* out, size_t count, float, float volume_bias) {
     // TODO: implement pitch bend and freq_mult somehow
-    vector<float> data(count * 2, 0.0f);
-
     double frequency = frequency_for_note(this->note);
     float vel_factor = static_cast<float>(this->vel) / 0x7F;
     for (size_t x = 0; x < count; x++) {
       // panning is 0.0f (left) - 1.0f (right)
       float off_factor = this->advance_note_off_factor();
-      data[2 * x + 0] = volume_bias * vel_factor * off_factor * (1.0f - this->channel->panning) * this->channel->volume * sin((2.0f * M_PI * frequency) / this->sample_rate * (x + this->offset));
-      data[2 * x + 1] = volume_bias * vel_factor * off_factor * this->channel->panning * this->channel->volume * sin((2.0f * M_PI * frequency) / this->sample_rate * (x + this->offset));
+      out[2 * x + 0] += volume_bias * vel_factor * off_factor * (1.0f - this->channel->panning) * this->channel->volume * sin((2.0f * M_PI * frequency) / this->sample_rate * (x + this->offset));
+      out[2 * x + 1] += volume_bias * vel_factor * off_factor * this->channel->panning * this->channel->volume * sin((2.0f * M_PI * frequency) / this->sample_rate * (x + this->offset));
     }
     this->offset += count;
-
-    return data;
   }
 
   size_t offset;
 };
 
+// Adds num_frames mono samples from src to the stereo frames in dest, with
+// separate gains for the left and right channels. -O2 only vectorizes loops
+// whose trip counts are known and that don't need runtime alias checks, so
+// this works on blocks of 8 frames and stages each block's output in a local
+// array before storing it; the last few frames are done one at a time. The
+// results are the same as for the one-at-a-time loop.
+static void mix_mono_to_stereo(float* dest, const float* src, size_t num_frames,
+    float l_gain, float r_gain, float volume_mult) {
+  size_t z = 0;
+  for (; z + 8 <= num_frames; z += 8) {
+    float* block_dest = &dest[2 * z];
+    const float* block_src = &src[z];
+    float block[16];
+    for (size_t b = 0; b < 8; b++) {
+      block[2 * b + 0] = block_dest[2 * b + 0] + l_gain * block_src[b] * volume_mult;
+      block[2 * b + 1] = block_dest[2 * b + 1] + r_gain * block_src[b] * volume_mult;
+    }
+    for (size_t b = 0; b < 16; b++) {
+      block_dest[b] = block[b];
+    }
+  }
+  for (; z < num_frames; z++) {
+    dest[2 * z + 0] += l_gain * src[z] * volume_mult;
+    dest[2 * z + 1] += r_gain * src[z] * volume_mult;
+  }
+}
+
 class SampleVoice : public Voice {
 public:
   SampleVoice(size_t sample_rate, shared_ptr<const SoundEnvironment> env,
@@ -894,7 +920,7 @@ public:
 
   virtual ~SampleVoice() = default;
 
-  const vector<float>& get_samples(float pitch_bend,
+  shared_ptr<const vector<float>> get_samples(float pitch_bend,
       float pitch_bend_semitone_range, float freq_mult) {
     // stretch it out by the sample rate difference
     float sample_rate_factor = static_cast<float>(sample_rate) /
@@ -922,8 +948,11 @@ public:
     try {
       return this->cache->at(this->vel_region->sound, this->src_ratio);
     } catch (const out_of_range&) {
-      const auto& ret = this->cache->resample_add(
-          this->vel_region->sound, this->vel_region->sound->samples(),
+      // the decoded samples are only needed until they're resampled, so they
+      // can be evicted from the sample store afterward
+      auto input_samples = this->vel_region->sound->samples();
+      auto ret = this->cache->resample_add(
+          this->vel_region->sound, *input_samples,
           this->vel_region->sound->num_channels, this->src_ratio);
       if (debug_flags & DebugFlag::SHOW_RESAMPLE_EVENTS) {
         string key_low_str = name_for_note(this->key_region->key_low);
@@ -951,26 +980,50 @@ public:
             this->loop_start_offset,
             this->loop_end_offset,
             this->src_ratio,
-            this->vel_region->sound->samples().size(),
-            ret.size());
+            input_samples->size(),
+            ret->size());
       }
       return ret;
     }
   }
 
-  virtual vector<float> render(size_t count, float freq_mult, float volume_bias) {
-    vector<float> data(count * 2, 0.0f);
-
-    const auto& samples = this->get_samples(this->channel->pitch_bend,
+  virtual void render(float* out, size_t count, float freq_mult, float volume_bias) {
+    // the cache may evict this sound later, so hold onto it while rendering
+    auto samples_ptr = this->get_samples(this->channel->pitch_bend,
         this->channel->pitch_bend_semitone_range, freq_mult);
+    const auto& samples = *samples_ptr;
     float vel_factor = static_cast<float>(this->vel) / 0x7F;
-    for (size_t x = 0; (x < count) && (this->offset < samples.size()); x++) {
-      float off_factor = this->advance_note_off_factor();
-      data[2 * x + 0] = volume_bias * vel_factor * off_factor * (1.0f - this->channel->panning) * this->channel->volume * samples[this->offset];
-      data[2 * x + 1] = volume_bias * vel_factor * off_factor * this->channel->panning * this->channel->volume * samples[this->offset];
+    float volume_mult = this->vel_region->volume_mult;
+
+    size_t x = 0;
+    while ((x < count) && (this->offset < samples.size())) {
+      // while the note is fading out, the volume changes on every sample, so
+      // render one sample at a time
+      if (this->decay_when_off && (this->note_off_decay_remaining >= 0)) {
+        float off_factor = this->advance_note_off_factor();
+        out[2 * x + 0] += volume_bias * vel_factor * off_factor * (1.0f - this->channel->panning) * this->channel->volume * samples[this->offset] * volume_mult;
+        out[2 * x + 1] += volume_bias * vel_factor * off_factor * this->channel->panning * this->channel->volume * samples[this->offset] * volume_mult;
+        this->offset++;
+        x++;
+        continue;
+      }
 
-      this->offset++;
-      if ((this->note_off_decay_remaining < 0) && (this->loop_end_offset > 0) && (this->offset > this->loop_end_offset)) {
+      // otherwise, the volume is constant, so render as many samples as
+      // possible before the end of the sound or the end of the loop in a
+      // single pass. the gains are computed in the same order as above, so
+      // the results are the same as if this were done one sample at a time
+      bool looping = (this->note_off_decay_remaining < 0) && (this->loop_end_offset > 0);
+      size_t end_offset = samples.size();
+      if (looping) {
+        end_offset = min<size_t>(end_offset, max<size_t>(this->loop_end_offset + 1, this->offset + 1));
+      }
+      size_t num_frames = min<size_t>(count - x, end_offset - this->offset);
+      float l_gain = volume_bias * vel_factor * (1.0f - this->channel->panning) * this->channel->volume;
+      float r_gain = volume_bias * vel_factor * this->channel->panning * this->channel->volume;
+      mix_mono_to_stereo(&out[2 * x], &samples[this->offset], num_frames, l_gain, r_gain, volume_mult);
+      this->offset += num_frames;
+      x += num_frames;
+      if (looping && (this->offset > this->loop_end_offset)) {
         this->offset = this->loop_start_offset;
       }
     }
@@ -978,15 +1031,6 @@ public:
     if (this->offset == samples.size()) {
       this->note_off_decay_remaining = 0;
     }
-
-    // apply instrument volume factor
-    if (this->vel_region->volume_mult != 1) {
-      for (float& s : data) {
-        s *= this->vel_region->volume_mult;
-      }
-    }
-
-    return data;
   }
 
   const InstrumentBank* instrument_bank;
@@ -1017,9 +1061,13 @@ protected:
     int32_t bank; // technically uint16, but uninitialized as -1
     int32_t instrument; // technically uint16, but uninitialized as -1
 
-    unordered_map<size_t, shared_ptr<Voice>> voices;
-    unordered_set<shared_ptr<Voice>> voices_off;
+    // these are rendered on every time step, so they're kept in flat vectors
+    // rather than hash tables. there are rarely more than a few voices on at
+    // once, so searching voices by id is fast enough
+    vector<pair<size_t, shared_ptr<Voice>>> voices; // (voice_id, voice)
+    vector<shared_ptr<Voice>> voices_off;
     vector<uint32_t> call_stack;
+    bool muted;
 
     unordered_map<uint8_t, int16_t> registers;
 
@@ -1029,7 +1077,8 @@ protected:
           reading_wait_opcode(true),
           freq_mult(1),
           bank(bank),
-          instrument(-1) {}
+          instrument(-1),
+          muted(false) {}
 
     void attenuate_perf() {
       for (auto& channel_it : this->channels) {
@@ -1037,15 +1086,37 @@ protected:
       }
     }
 
+    void voice_on(size_t voice_id, shared_ptr<Voice> v) {
+      // if the voice id is already in use, the existing voice is replaced
+      // (without fading out)
+      for (auto& it : this->voices) {
+        if (it.first == voice_id) {
+          it.second = std::move(v);
+          return;
+        }
+      }
+      this->voices.emplace_back(voice_id, std::move(v));
+    }
+
     void voice_off(size_t voice_id) {
       // some tracks do voice_off for nonexistent voices because of bad looping;
       // just do nothing in that case
-      auto v_it = this->voices.find(voice_id);
-      if (v_it != this->voices.end()) {
-        v_it->second->off();
-        this->voices_off.emplace(std::move(v_it->second));
-        this->voices.erase(v_it);
+      for (auto v_it = this->voices.begin(); v_it != this->voices.end(); v_it++) {
+        if (v_it->first == voice_id) {
+          v_it->second->off();
+          this->voices_off.emplace_back(std::move(v_it->second));
+          this->voices.erase(v_it);
+          return;
+        }
+      }
+    }
+
+    void all_voices_off() {
+      for (auto& it : this->voices) {
+        it.second->off();
+        this->voices_off.emplace_back(std::move(it.second));
       }
+      this->voices.clear();
     }
 
     shared_ptr<Channel> channel(size_t id) {
@@ -1058,7 +1129,7 @@ protected:
   };
 
   string output_data;
-  unordered_set<shared_ptr<Track>> tracks;
+  vector<shared_ptr<Track>> tracks;
   multimap<uint64_t, shared_ptr<Track>> next_event_to_track;
 
   size_t sample_rate;
@@ -1079,17 +1150,27 @@ protected:
 
   shared_ptr<SampleCache<const Sound*>> cache;
 
+  // these are reused on every time step, so they're only reallocated if the
+  // number of samples per step increases. voices on muted tracks are rendered
+  // into muted_step_samples, which is then discarded
+  vector<float> step_samples;
+  vector<float> muted_step_samples;
+
   virtual void execute_opcode(multimap<uint64_t, shared_ptr<Track>>::iterator track_it) = 0;
 
+  void add_track(shared_ptr<Track> t) {
+    t->muted = this->mute_tracks.count(t->id);
+    this->tracks.emplace_back(t);
+  }
+
   void voice_on(shared_ptr<Track> t, size_t voice_id, uint8_t key, uint8_t vel,
       size_t channel_id) {
     shared_ptr<Channel> c = t->channel(channel_id);
 
     if (this->env) {
       try {
-        SampleVoice* v = new SampleVoice(this->sample_rate, this->env,
-            this->cache, t->bank, t->instrument, key, vel, this->decay_when_off, this->decay_seconds, c);
-        t->voices[voice_id].reset(v);
+        t->voice_on(voice_id, make_shared<SampleVoice>(this->sample_rate, this->env,
+            this->cache, t->bank, t->instrument, key, vel, this->decay_when_off, this->decay_seconds, c));
       } catch (const out_of_range& e) {
         string key_str = name_for_note(key);
         if (debug_flags & DebugFlag::SHOW_MISSING_NOTES) {
@@ -1097,13 +1178,13 @@ protected:
               t->bank, t->instrument, key, key_str, vel);
         }
         if (debug_flags & DebugFlag::PLAY_MISSING_NOTES) {
-          t->voices[voice_id].reset(new SineVoice(this->sample_rate, key, vel, c));
+          t->voice_on(voice_id, make_shared<SineVoice>(this->sample_rate, key, vel, c));
         } else {
-          t->voices[voice_id].reset(new SilentVoice(this->sample_rate, key, vel, c));
+          t->voice_on(voice_id, make_shared<SilentVoice>(this->sample_rate, key, vel, c));
         }
       }
     } else {
-      t->voices[voice_id].reset(new SineVoice(this->sample_rate, key, vel, c));
+      t->voice_on(voice_id, make_shared<SineVoice>(this->sample_rate, key, vel, c));
     }
   }
 
@@ -1137,6 +1218,12 @@ public:
 
   virtual ~Renderer() = default;
 
+  // limits the total size of the resampled sounds kept for voices to use (0 =
+  // no limit)
+  void set_resample_cache_size(size_t max_bytes) {
+    this->cache->set_max_bytes(max_bytes);
+  }
+
   bool can_render() const {
     // if there are pending opcodes, we can continue rendering
     if (!this->next_event_to_track.empty()) {
@@ -1154,7 +1241,8 @@ public:
     return false;
   }
 
-  vector<float> render_time_step(double remaining_secs = 0.0) {
+  // the returned data is valid until the next call to render_time_step
+  const vector<float>& render_time_step(double remaining_secs = 0.0) {
     // run all opcodes that should execute on the current time step
     while (!this->next_event_to_track.empty() &&
         (current_time == this->next_event_to_track.begin()->first)) {
@@ -1171,13 +1259,7 @@ public:
     // if all tracks have terminated, turn all of their voices off
     if (this->next_event_to_track.empty()) {
       for (auto& t : this->tracks) {
-        unordered_set<uint8_t> voices_on;
-        for (const auto& voice_it : t->voices) {
-          voices_on.emplace(voice_it.first);
-        }
-        for (uint8_t voice_id : voices_on) {
-          t->voice_off(voice_id);
-        }
+        t->all_voices_off();
       }
     }
 
@@ -1195,38 +1277,29 @@ public:
     double usecs_per_pulse = static_cast<double>(usecs_per_qnote) / this->pulse_rate;
     size_t samples_per_pulse = (usecs_per_pulse * this->sample_rate) / 1000000;
 
-    // render this timestep
-    vector<float> step_samples(2 * samples_per_pulse, 0);
+    // render this timestep. muted_step_samples is only cleared if there's a
+    // muted track, since its contents are never used
+    this->step_samples.assign(2 * samples_per_pulse, 0.0f);
+    bool muted_step_samples_cleared = false;
     char notes_table[0x81];
     memset(notes_table, ' ', 0x80);
     notes_table[0x80] = 0;
     for (const auto& t : this->tracks) {
-      // get all voices, including those that are fading
-      unordered_set<shared_ptr<Voice>> all_voices = t->voices_off;
-      for (auto& it : t->voices) {
-        all_voices.insert(it.second);
+      if (t->muted && !muted_step_samples_cleared) {
+        this->muted_step_samples.assign(2 * samples_per_pulse, 0.0f);
+        muted_step_samples_cleared = true;
       }
+      float* out = t->muted ? this->muted_step_samples.data() : this->step_samples.data();
 
-      // render all the voices
-      for (auto v : all_voices) {
-        vector<float> voice_samples;
+      // render all the voices, including those that are fading
+      auto render_voice = [&](Voice* v) -> void {
         try {
-          voice_samples = v->render(samples_per_pulse, t->freq_mult, this->volume_bias);
+          v->render(out, samples_per_pulse, t->freq_mult, this->volume_bias);
         } catch (...) {
           phosg::fwrite_fmt(stderr, "error while rendering voices for track {} (freq_mult={:g})\n",
               t->id, t->freq_mult);
           throw;
         }
-        if (voice_samples.size() != step_samples.size()) {
-          throw logic_error(format(
-              "voice produced incorrect sample count (returned {} samples, expected {} samples)",
-              voice_samples.size(), step_samples.size()));
-        }
-        if (!this->mute_tracks.count(t->id)) {
-          for (size_t y = 0; y < voice_samples.size(); y++) {
-            step_samples[y] += voice_samples[y];
-          }
-        }
 
         // only draw the note in the text view if it's on
         if ((v->note_off_decay_remaining < 0) && (v->note >= 0)) {
@@ -1248,17 +1321,19 @@ public:
             notes_table[v->note] = '+';
           }
         }
+      };
+      for (const auto& it : t->voices) {
+        render_voice(it.second.get());
       }
-
-      // attenuate off voices and delete those that are fully off
-      for (auto it = t->voices_off.begin(); it != t->voices_off.end();) {
-        if ((*it)->off_complete()) {
-          it = t->voices_off.erase(it);
-        } else {
-          it++;
-        }
+      for (const auto& v : t->voices_off) {
+        render_voice(v.get());
       }
 
+      // delete off voices that are fully off
+      erase_if(t->voices_off, [](const shared_ptr<Voice>& v) -> bool {
+        return v->off_complete();
+      });
+
       // attenuate the perf parameters
       t->attenuate_perf();
     }
@@ -1320,15 +1395,18 @@ public:
 
     // advance to the next time step
     this->current_time++;
-    this->samples_rendered += step_samples.size() / 2;
+    this->samples_rendered += this->step_samples.size() / 2;
 
-    return step_samples;
+    return this->step_samples;
   }
 
   vector<float> render_until(uint64_t time) {
     vector<float> samples;
     while (this->can_render() && (this->current_time < time)) {
-      auto step_samples = this->render_time_step();
+      const auto& step_samples = this->render_time_step();
+      if (samples.empty()) {
+        this->reserve_scheduled_steps(samples, step_samples.size(), time);
+      }
       samples.insert(samples.end(), step_samples.begin(), step_samples.end());
     }
     return samples;
@@ -1337,8 +1415,13 @@ public:
   vector<float> render_until_seconds(float seconds) {
     vector<float> samples;
     size_t target_size = seconds * this->sample_rate;
+    if (target_size > this->samples_rendered) {
+      // the last step may go past the target, so this may not be exact, but it
+      // avoids most of the reallocations
+      samples.reserve(2 * (target_size - this->samples_rendered));
+    }
     while (this->can_render() && (this->samples_rendered < target_size)) {
-      auto step_samples = this->render_time_step();
+      const auto& step_samples = this->render_time_step();
       samples.insert(samples.end(), step_samples.begin(), step_samples.end());
     }
     return samples;
@@ -1347,11 +1430,31 @@ public:
   vector<float> render_all() {
     vector<float> samples;
     while (this->can_render()) {
-      auto step_samples = this->render_time_step();
+      const auto& step_samples = this->render_time_step();
+      if (samples.empty()) {
+        this->reserve_scheduled_steps(samples, step_samples.size(), UINT64_MAX);
+      }
       samples.insert(samples.end(), step_samples.begin(), step_samples.end());
     }
     return samples;
   }
+
+protected:
+  // the tempo usually isn't set until the first step's opcodes run, so
+  // render_until and render_all call this after the first step. rendering
+  // always continues at least until the last event that's already scheduled,
+  // so this reserves space for the steps up to that event (or end_time, if
+  // it's earlier). if the tempo changes, the estimate can be off in either
+  // direction, but it avoids most of the reallocations
+  void reserve_scheduled_steps(vector<float>& samples, size_t samples_per_step, uint64_t end_time) const {
+    if (this->next_event_to_track.empty()) {
+      return;
+    }
+    uint64_t last_time = min<uint64_t>(this->next_event_to_track.rbegin()->first + 1, end_time);
+    if (last_time > this->current_time) {
+      samples.reserve(samples_per_step * (last_time - this->current_time + 1));
+    }
+  }
 };
 
 class BMSRenderer : public Renderer {
@@ -1386,7 +1489,7 @@ public:
         seq(seq),
         seq_data(new string(seq->data)) {
     shared_ptr<Track> default_track(new Track(-1, this->seq_data, 0, this->seq->index));
-    this->tracks.emplace(default_track);
+    this->add_track(default_track);
     this->next_event_to_track.emplace(0, default_track);
     default_track->freq_mult = this->freq_bias;
   }
@@ -1570,7 +1673,7 @@ protected:
         if ((this->solo_tracks.empty() || this->solo_tracks.count(track_id)) &&
             !this->disable_tracks.count(track_id)) {
           shared_ptr<Track> new_track(new Track(track_id, this->seq_data, offset, this->seq->index));
-          this->tracks.emplace(new_track);
+          this->add_track(new_track);
           this->next_event_to_track.emplace(this->current_time, new_track);
           new_track->freq_mult = this->freq_bias;
         }
@@ -1831,7 +1934,7 @@ public:
       if ((this->solo_tracks.empty() || this->solo_tracks.count(track_id)) &&
           !this->disable_tracks.count(track_id)) {
         shared_ptr<Track> t(new Track(track_id, this->midi_contents, r.where(), 0));
-        this->tracks.emplace(t);
+        this->add_track(t);
         this->next_event_to_track.emplace(0, t);
         t->freq_mult = this->freq_bias;
       }
@@ -1986,6 +2089,10 @@ Synthesis options:\n\
   --sample-rate=N: generate output at this sample rate (default 48000).\n\
   --resample-method=METHOD: use this method for resampling waveforms. Values\n\
       are hold or linear.\n\
+  --sample-cache-size=N: keep at most N megabytes of decoded samples from the\n\
+      environment\'s wave archives in memory (default 64), and at most N\n\
+      megabytes of resampled notes. Samples are decoded or resampled again if\n\
+      they're needed after being evicted. 0 means there is no limit.\n\
 \n\
 Logging options:\n\
   --silent: don't print any status information.\n\
@@ -2042,6 +2149,7 @@ int main(int argc, char** argv) {
   bool decay_when_off = true;
   float decay_seconds = -1.0f;
   ResampleMethod resample_method = ResampleMethod::LINEAR_INTERPOLATE;
+  size_t sample_cache_size = SampleStore::DEFAULT_MAX_BYTES;
   string env_json_filename;
   for (int x = 1; x < argc; x++) {
     if (!strncmp(argv[x], "--disable-track=", 16)) {
@@ -2100,6 +2208,8 @@ int main(int argc, char** argv) {
       resample_method = ResampleMethod::EXTEND;
     } else if (!strcmp(argv[x], "--resample-method=linear")) {
       resample_method = ResampleMethod::LINEAR_INTERPOLATE;
+    } else if (!strncmp(argv[x], "--sample-cache-size=", 20)) {
+      sample_cache_size = strtoull(&argv[x][20], nullptr, 0) * 1024 * 1024;
     } else if (!strncmp(argv[x], "--default-bank=", 15)) {
       default_bank = atoi(&argv[x][15]);
     } else if (!strncmp(argv[x], "--tempo-bias=", 13)) {
@@ -2153,11 +2263,12 @@ int main(int argc, char** argv) {
 
   // load the sound environment from the AAF, the CLI, or the JSON
   shared_ptr<const SoundEnvironment> env;
+  auto sample_store = make_shared<SampleStore>(sample_cache_size);
   if (!env_json.is_null()) {
     env.reset(new SoundEnvironment(create_json_sound_environment(
         env_json.at("instruments"), env_json_dir)));
   } else if (aaf_directory) {
-    env.reset(new SoundEnvironment(load_sound_environment(aaf_directory)));
+    env.reset(new SoundEnvironment(load_sound_environment(aaf_directory, sample_store)));
   } else if (midi) {
     env.reset(new SoundEnvironment(create_midi_sound_environment(
         midi_instrument_metadata)));
@@ -2268,6 +2379,8 @@ int main(int argc, char** argv) {
         percussion_instrument,
         allow_program_change));
   }
+  // resampled notes get a separate limit of the same size as the sample store's
+  r->set_resample_cache_size(sample_cache_size);
 
   // skip the first bit if requested
   if (start_time) {
@@ -2290,7 +2403,7 @@ int main(int argc, char** argv) {
         if (!r->can_render()) {
           break;
         }
-        auto step_samples = r->render_time_step(stream.remaining_secs());
+        const auto& step_samples = r->render_time_step(stream.remaining_secs());
         stream.add(step_samples);
       }
       if (debug_flags & DebugFlag::SHOW_NOTES_ON) {
@@ -2302,5 +2415,13 @@ int main(int argc, char** argv) {
 #endif
   }
 
+  if (debug_flags & DebugFlag::SHOW_SAMPLE_STORE_STATS) {
+    auto stats = sample_store->stats();
+    if (stats.hits + stats.misses) {
+      phosg::fwrite_fmt(stderr, "sample store: {} hits, {} misses ({:.1f}% hit rate), {} evictions, {} bytes peak\n",
+          stats.hits, stats.misses, stats.hit_rate() * 100, stats.evictions, stats.peak_resident_bytes);
+    }
+  }
+
   return 0;
 }
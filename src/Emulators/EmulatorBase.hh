@@ -104,6 +104,16 @@ struct EmulatorDebuggerState {
   uint64_t trace_period = 0x100;
   bool print_state_headers = true;
   bool print_memory_accesses = true;
+
+  // Returns true if the debug hook would never stop execution or print
+  // anything, so the debugger doesn't need to be bound at all
+  bool is_idle() const {
+    return (this->mode == DebuggerMode::NONE) &&
+        this->breakpoints.empty() &&
+        this->cycle_breakpoints.empty() &&
+        (this->confinement_start_addr == this->confinement_end_addr) &&
+        (this->max_cycles == 0);
+  }
 };
 
 template <typename EmuT>
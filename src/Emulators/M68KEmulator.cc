@@ -446,7 +446,10 @@ void M68KEmulator::Regs::write_stack_s8(shared_ptr<MemoryContext> mem, int8_t v)
   mem->write_s8(this->a[7], v);
 }
 
-M68KEmulator::M68KEmulator(shared_ptr<MemoryContext> mem) : EmulatorBase(mem) {}
+M68KEmulator::M68KEmulator(shared_ptr<MemoryContext> mem)
+    : EmulatorBase(mem),
+      block_cache_enabled(true),
+      current_block(nullptr) {}
 
 M68KEmulator::Regs& M68KEmulator::registers() {
   return this->regs;
@@ -517,6 +520,25 @@ uint32_t M68KEmulator::read(const ResolvedAddress& addr, uint8_t size) const {
     }
     return this->regs.a[addr.addr];
   } else if (addr.location == ResolvedAddress::Location::MEMORY) {
+    // Immediate operands are part of the current instruction, so if it's
+    // running from a decoded block, read them from the block's copy of the
+    // code. (This also applies to any other data in the part of the block
+    // that has already been fetched, which is known to match memory.)
+    if (this->current_block) {
+      uint32_t offset = addr.addr - this->current_block->start_pc;
+      uint32_t fetched_size = this->regs.pc - this->current_block->start_pc;
+      if ((fetched_size <= this->current_block->code.size()) &&
+          (offset < fetched_size) && (bytes_for_size[size] <= fetched_size - offset)) {
+        const char* data = this->current_block->code.data() + offset;
+        if (size == SIZE_BYTE) {
+          return *reinterpret_cast<const uint8_t*>(data);
+        } else if (size == SIZE_WORD) {
+          return *reinterpret_cast<const be_uint16_t*>(data);
+        } else if (size == SIZE_LONG) {
+          return *reinterpret_cast<const be_uint32_t*>(data);
+        }
+      }
+    }
     return this->read(addr.addr, size);
   } else { // Location::SR
     return this->regs.sr;
@@ -584,6 +606,22 @@ int16_t M68KEmulator::fetch_instruction_word_signed(bool advance) {
 }
 
 uint32_t M68KEmulator::fetch_instruction_data(uint8_t size, bool advance) {
+  // If we're running a decoded block, fetch from its copy of the code if
+  // possible. The copy is known to match memory (see execute()).
+  if (this->current_block) {
+    size_t offset = this->regs.pc - this->current_block->start_pc;
+    const string& code = this->current_block->code;
+    if (size == SIZE_WORD && (offset + 2 <= code.size())) {
+      uint32_t ret = *reinterpret_cast<const be_uint16_t*>(code.data() + offset);
+      this->regs.pc += (2 * advance);
+      return ret;
+    } else if (size == SIZE_LONG && (offset + 4 <= code.size())) {
+      uint32_t ret = *reinterpret_cast<const be_uint32_t*>(code.data() + offset);
+      this->regs.pc += (4 * advance);
+      return ret;
+    }
+  }
+
   if (size == SIZE_BYTE) {
     uint32_t ret = this->mem->read<uint8_t>(this->regs.pc);
     this->regs.pc += (1 * advance);
@@ -3754,29 +3792,173 @@ string M68KEmulator::disassemble(
   return ret;
 }
 
+// Blocks are limited to this many bytes of code
+static const size_t MAX_DECODED_BLOCK_SIZE = 0x100;
+
+static bool opcode_ends_decoded_block(uint16_t opcode) {
+  switch (opcode >> 12) {
+    case 0x4:
+      return ((opcode & 0xFF80) == 0x4E80) || // jsr, jmp
+          ((opcode & 0xFFF0) == 0x4E40) || // trap
+          ((opcode & 0xFFF8) == 0x4E70) || // reset, nop, stop, rte, rtd, rts, trapv, rtr
+          (opcode == 0x4AFC); // illegal
+    case 0x5: // dbcc, trapcc
+    case 0x6: // bra, bsr, bcc
+    case 0xA: // A-traps
+    case 0xF: // F-traps
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool M68KEmulator::revalidate_decoded_block(DecodedBlock& block) {
+  // If none of the pages containing the block's code were written, the block
+  // is still valid. If any of them were written (which happens often when
+  // there's data on the same page as the code), the block is still valid if
+  // its code didn't actually change.
+  uint64_t write_count = this->mem->watched_write_count();
+  uint64_t generation = this->mem->write_generation(block.start_pc, block.code.size());
+  if ((generation != block.validated_generation) &&
+      (!this->mem->exists(block.start_pc, block.code.size()) ||
+          this->mem->memcmp(block.start_pc, block.code.data(), block.code.size()))) {
+    return false;
+  }
+  block.validated_write_count = write_count;
+  block.validated_generation = generation;
+  return true;
+}
+
+M68KEmulator::DecodedBlock* M68KEmulator::get_decoded_block(uint32_t pc) {
+  auto it = this->block_cache.find(pc);
+  if (it != this->block_cache.end()) {
+    auto& block = it->second;
+    if ((block.validated_write_count == this->mem->watched_write_count()) ||
+        this->revalidate_decoded_block(block)) {
+      return &block;
+    }
+    this->block_cache.erase(it);
+  }
+
+  size_t available_size = 0;
+  while ((available_size < MAX_DECODED_BLOCK_SIZE) && this->mem->exists(pc + available_size, 2)) {
+    available_size += 2;
+  }
+  if (available_size == 0) {
+    return nullptr;
+  }
+  string code = this->mem->read(pc, available_size);
+
+  // Use the disassembler to find where each instruction ends, since it
+  // already knows how many extension words each opcode uses. If it can't
+  // decode an instruction (e.g. because the instruction extends past the end
+  // of the available code), the block ends before that instruction.
+  DecodedBlock block;
+  block.start_pc = pc;
+  DisassemblyState s(code.data(), code.size(), pc, false, nullptr);
+  while (s.r.remaining() >= 2) {
+    size_t offset = s.r.where();
+    uint16_t opcode = s.r.pget_u16b(offset);
+    s.opcode_start_address = pc + offset;
+    try {
+      M68KEmulator::fns[(opcode >> 12) & 0x000F].dasm(s);
+    } catch (const exception&) {
+      s.r.go(offset);
+      break;
+    }
+    block.instructions.emplace_back(DecodedInstruction{
+        static_cast<uint32_t>(pc + offset), opcode, M68KEmulator::fns[(opcode >> 12) & 0x000F].exec});
+    if (opcode_ends_decoded_block(opcode)) {
+      break;
+    }
+  }
+  if (block.instructions.empty()) {
+    return nullptr;
+  }
+  code.resize(s.r.where());
+  block.code = std::move(code);
+
+  this->mem->watch_for_writes(pc, block.code.size());
+  block.validated_write_count = this->mem->watched_write_count();
+  block.validated_generation = this->mem->write_generation(pc, block.code.size());
+  return &this->block_cache.insert_or_assign(pc, std::move(block)).first->second;
+}
+
+void M68KEmulator::execute_one() {
+  this->current_block = nullptr;
+  uint16_t opcode = this->fetch_instruction_word();
+  auto fn = this->fns[(opcode >> 12) & 0x000F].exec;
+  (this->*fn)(opcode);
+  this->instructions_executed++;
+}
+
 void M68KEmulator::execute() {
   if (!this->interrupt_manager.get()) {
     this->interrupt_manager = make_shared<InterruptManager>();
   }
 
+  this->current_block = nullptr;
+  bool cycle_started = false;
   for (;;) {
     try {
-      // Call debug hook if present
-      if (this->debug_hook) {
-        this->debug_hook(*this);
+      // The block cache is bypassed entirely when a debug hook is set, so
+      // the hook is called before every instruction
+      if (this->debug_hook || !this->block_cache_enabled) {
+        // Call debug hook if present
+        if (this->debug_hook) {
+          this->debug_hook(*this);
+        }
+
+        // Call any timer interrupt functions scheduled for this cycle
+        if (!cycle_started) {
+          this->interrupt_manager->on_cycle_start();
+        }
+        cycle_started = false;
+
+        // Execute a cycle
+        this->execute_one();
+        continue;
       }
 
-      // Call any timer interrupt functions scheduled for this cycle
-      this->interrupt_manager->on_cycle_start();
+      if (!cycle_started) {
+        this->interrupt_manager->on_cycle_start();
+      }
+      cycle_started = false;
 
-      // Execute a cycle
-      uint16_t opcode = this->fetch_instruction_word();
-      auto fn = this->fns[(opcode >> 12) & 0x000F].exec;
-      (this->*fn)(opcode);
+      auto* block = this->get_decoded_block(this->regs.pc);
+      if (!block) {
+        this->execute_one();
+        continue;
+      }
 
-      this->instructions_executed++;
+      // Run instructions from the block until it ends, the PC goes somewhere
+      // other than the next instruction in the block (e.g. a taken branch),
+      // or the block's code was modified. Writes to other watched pages don't
+      // affect this block, so they only cost a check of this block's pages.
+      this->current_block = block;
+      size_t num_instructions = block->instructions.size();
+      for (size_t z = 0;;) {
+        const auto& inst = block->instructions[z];
+        this->regs.pc = inst.pc + 2;
+        (this->*inst.exec)(inst.opcode);
+        this->instructions_executed++;
+
+        if (++z >= num_instructions) {
+          break;
+        }
+        this->interrupt_manager->on_cycle_start();
+        if ((this->regs.pc != block->instructions[z].pc) ||
+            ((this->mem->watched_write_count() != block->validated_write_count) &&
+                !this->revalidate_decoded_block(*block)) ||
+            this->debug_hook) {
+          cycle_started = true;
+          break;
+        }
+      }
+      this->current_block = nullptr;
 
     } catch (const terminate_emulation&) {
+      this->current_block = nullptr;
       break;
     }
   }
@@ -8,6 +8,8 @@
 #include <phosg/Strings.hh>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "EmulatorBase.hh"
 #include "InterruptManager.hh"
@@ -154,6 +156,13 @@ public:
     this->interrupt_manager = im;
   }
 
+  // The block cache is enabled by default. Disabling it makes execution much
+  // slower, but can be useful when debugging the emulator itself. (The cache
+  // is never used while a debug hook is set, regardless of this setting.)
+  inline void set_block_cache_enabled(bool enabled) {
+    this->block_cache_enabled = enabled;
+  }
+
   virtual void execute();
 
 private:
@@ -169,6 +178,36 @@ private:
   };
   static const OpcodeImplementation fns[0x10];
 
+  // Straight-line runs of instructions are decoded once into blocks, which
+  // execute() then runs without fetching and dispatching each opcode again.
+  // The block's code is also copied so that extension words and immediate
+  // operands can be read without going through the MemoryContext. (Effective
+  // addresses are still computed by the exec_* functions each time an
+  // instruction runs.) Blocks are revalidated against memory when a page
+  // containing their code may have been modified (see
+  // MemoryContext::watch_for_writes), so self-modifying code still works.
+  struct DecodedInstruction {
+    uint32_t pc;
+    uint16_t opcode;
+    void (M68KEmulator::*exec)(uint16_t);
+  };
+  struct DecodedBlock {
+    uint32_t start_pc;
+    std::string code;
+    std::vector<DecodedInstruction> instructions;
+    // The values of mem->watched_write_count() and mem->write_generation()
+    // for the block's code when the block was last known to match memory
+    uint64_t validated_write_count;
+    uint64_t validated_generation;
+  };
+  bool block_cache_enabled;
+  std::unordered_map<uint32_t, DecodedBlock> block_cache;
+  const DecodedBlock* current_block;
+
+  DecodedBlock* get_decoded_block(uint32_t pc);
+  bool revalidate_decoded_block(DecodedBlock& block);
+  void execute_one();
+
   struct ResolvedAddress {
     enum class Location {
       MEMORY = 0,
@@ -6,11 +6,15 @@
 #include <stdint.h>
 #include <unistd.h>
 #ifndef PHOSG_WINDOWS
+#include <fcntl.h>
 #include <sys/mman.h>
 #else
 #include <windows.h>
 #endif
 
+#include <atomic>
+#include <mutex>
+#include <optional>
 #include <phosg/Filesystem.hh>
 #include <phosg/Strings.hh>
 
@@ -56,12 +60,80 @@ void map_free(void* data, size_t size) {
 #endif
 }
 
+#ifndef PHOSG_WINDOWS
+
+struct MemoryContext::ArenaImage {
+  int fd;
+  size_t size;
+
+  ArenaImage(const void* data, size_t size);
+  ArenaImage(const ArenaImage&) = delete;
+  ArenaImage(ArenaImage&&) = delete;
+  ArenaImage& operator=(const ArenaImage&) = delete;
+  ArenaImage& operator=(ArenaImage&&) = delete;
+  ~ArenaImage();
+
+  // Maps the image privately (copy-on-write). If fixed_addr isn't null, the
+  // mapping replaces whatever is mapped there.
+  void* map(void* fixed_addr = nullptr) const;
+};
+
+MemoryContext::ArenaImage::ArenaImage(const void* data, size_t size)
+    : fd(-1),
+      size(size) {
+#ifdef PHOSG_LINUX
+  this->fd = memfd_create("rdasm-arena", MFD_CLOEXEC);
+#else
+  // The shared memory object is unlinked immediately, so it's freed when the
+  // last mapping of it is unmapped and the fd is closed
+  static atomic<uint64_t> next_image_id(0);
+  string name = std::format("/rdasm.{}.{}", getpid(), next_image_id++);
+  this->fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (this->fd >= 0) {
+    shm_unlink(name.c_str());
+  }
+#endif
+  if (this->fd < 0) {
+    throw runtime_error("cannot create shared memory object for arena image");
+  }
+  if (ftruncate(this->fd, size)) {
+    close(this->fd);
+    throw runtime_error(std::format("cannot resize arena image to 0x{:X} bytes", size));
+  }
+
+  void* shared_data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+  if (shared_data == MAP_FAILED) {
+    close(this->fd);
+    throw runtime_error(std::format("cannot mmap arena image of 0x{:X} bytes", size));
+  }
+  ::memcpy(shared_data, data, size);
+  munmap(shared_data, size);
+}
+
+MemoryContext::ArenaImage::~ArenaImage() {
+  close(this->fd);
+}
+
+void* MemoryContext::ArenaImage::map(void* fixed_addr) const {
+  void* ret = mmap(fixed_addr, this->size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | (fixed_addr ? MAP_FIXED : 0), this->fd, 0);
+  if (ret == MAP_FAILED) {
+    throw runtime_error(std::format("cannot mmap arena image of 0x{:X} bytes", this->size));
+  }
+  return ret;
+}
+
+#endif
+
 MemoryContext::MemoryContext()
     : page_size(get_system_page_size()),
       size(0),
       allocated_bytes(0),
       free_bytes(0),
-      strict(false) {
+      strict(false),
+      last_accessed_arena(nullptr),
+      last_accessed_block(0),
+      watched_writes(0) {
 
   if (this->page_size == 0) {
     throw invalid_argument("system page size is zero");
@@ -96,12 +168,19 @@ MemoryContext::MemoryContext(MemoryContext&& other)
       arenas_by_addr(std::move(other.arenas_by_addr)),
       arenas_by_host_addr(std::move(other.arenas_by_host_addr)),
       arena_for_page_number(std::move(other.arena_for_page_number)),
+      last_accessed_arena(other.last_accessed_arena.load()),
+      last_accessed_block(other.last_accessed_block.load()),
       symbol_addrs(std::move(other.symbol_addrs)),
-      addr_symbols(other.addr_symbols) {
+      addr_symbols(other.addr_symbols),
+      watched_pages(std::move(other.watched_pages)),
+      watched_page_generations(std::move(other.watched_page_generations)),
+      watched_writes(other.watched_writes) {
   other.size = 0;
   other.allocated_bytes = 0;
   other.free_bytes = 0;
   other.strict = false;
+  other.last_accessed_arena = nullptr;
+  other.clear_last_accessed_block();
 }
 
 MemoryContext& MemoryContext::operator=(MemoryContext&& other) {
@@ -115,16 +194,24 @@ MemoryContext& MemoryContext::operator=(MemoryContext&& other) {
   this->arenas_by_addr = std::move(other.arenas_by_addr);
   this->arenas_by_host_addr = std::move(other.arenas_by_host_addr);
   this->arena_for_page_number = std::move(other.arena_for_page_number);
+  this->last_accessed_arena = other.last_accessed_arena.load();
+  this->last_accessed_block = other.last_accessed_block.load();
   this->symbol_addrs = std::move(other.symbol_addrs);
   this->addr_symbols = std::move(other.addr_symbols);
+  this->watched_pages = std::move(other.watched_pages);
+  this->watched_page_generations = std::move(other.watched_page_generations);
+  this->watched_writes = other.watched_writes;
   other.size = 0;
   other.allocated_bytes = 0;
   other.free_bytes = 0;
   other.strict = false;
+  other.last_accessed_arena = nullptr;
+  other.clear_last_accessed_block();
   return *this;
 }
 
 MemoryContext MemoryContext::duplicate() const {
+  lock_guard<mutex> g(this->duplicate_lock);
   std::unordered_map<std::shared_ptr<Arena>, std::shared_ptr<Arena>> ret_arena_for_this_arena;
 
   MemoryContext ret;
@@ -136,12 +223,12 @@ MemoryContext MemoryContext::duplicate() const {
   ret.free_bytes = this->free_bytes;
   ret.strict = this->strict;
   for (const auto& [_, this_arena] : this->arenas_by_addr) {
-    auto ret_arena = make_shared<Arena>(this_arena->duplicate());
+    auto ret_arena = make_shared<Arena>(this_arena->duplicate(this->page_bits));
     ret.arenas_by_addr.emplace(ret_arena->addr, ret_arena);
     ret.arenas_by_host_addr.emplace(ret_arena->host_addr, ret_arena);
     size_t end_page_num = this->page_number_for_addr(ret_arena->addr + ret_arena->size - 1);
     for (uint32_t z = this->page_number_for_addr(ret_arena->addr); z <= end_page_num; z++) {
-      ret.arena_for_page_number[z] = ret_arena;
+      ret.arena_for_page_number[z] = ret_arena.get();
     }
   }
   ret.symbol_addrs = this->symbol_addrs;
@@ -224,7 +311,7 @@ void MemoryContext::allocate_at(uint32_t addr, size_t requested_size) {
   // before any dynamic blocks are allocated.)
   uint32_t start_page_number = this->page_number_for_addr(addr);
   uint32_t end_page_num = this->page_number_for_addr(addr + requested_size - 1);
-  shared_ptr<Arena> arena = this->arena_for_page_number.at(start_page_number);
+  Arena* arena = this->arena_for_page_number.at(start_page_number);
   for (uint64_t page_num = start_page_number + 1; page_num <= end_page_num; page_num++) {
     if (this->arena_for_page_number.at(page_num) != arena) {
       throw runtime_error("fixed-address allocation request spans multiple arenas");
@@ -235,9 +322,9 @@ void MemoryContext::allocate_at(uint32_t addr, size_t requested_size) {
   // does already exist, we need to ensure that the requested allocation fits
   // entirely within an existing free block.
   uint32_t free_block_addr = 0;
-  if (!arena.get()) {
+  if (!arena) {
     uint32_t arena_addr = this->page_base_for_addr(addr);
-    arena = this->create_arena(arena_addr, requested_size + (addr - arena_addr));
+    arena = this->create_arena(arena_addr, requested_size + (addr - arena_addr)).get();
     free_block_addr = arena->addr;
   } else {
     auto it = arena->free_blocks_by_addr.upper_bound(addr);
@@ -290,6 +377,22 @@ MemoryContext::Arena::Arena(uint32_t addr, size_t size)
   this->free_blocks_by_size.emplace(size, addr);
 }
 
+MemoryContext::Arena::Arena(uint32_t addr, size_t size, shared_ptr<const ArenaImage> image)
+    : addr(addr),
+      host_addr(nullptr),
+      size(size),
+      allocated_bytes(0),
+      free_bytes(size),
+      image(image) {
+#ifndef PHOSG_WINDOWS
+  this->host_addr = this->image->map();
+#else
+  throw logic_error("arena images are not supported on Windows");
+#endif
+  this->free_blocks_by_addr.emplace(addr, size);
+  this->free_blocks_by_size.emplace(size, addr);
+}
+
 MemoryContext::Arena::Arena(Arena&& other)
     : addr(other.addr),
       host_addr(other.host_addr),
@@ -298,7 +401,10 @@ MemoryContext::Arena::Arena(Arena&& other)
       free_bytes(other.free_bytes),
       allocated_blocks(std::move(other.allocated_blocks)),
       free_blocks_by_addr(std::move(other.free_blocks_by_addr)),
-      free_blocks_by_size(std::move(other.free_blocks_by_size)) {
+      free_blocks_by_size(std::move(other.free_blocks_by_size)),
+      image(std::move(other.image)),
+      page_is_dirty(std::move(other.page_is_dirty)),
+      dirty_pages(std::move(other.dirty_pages)) {
   other.host_addr = nullptr;
   other.size = 0;
   other.allocated_bytes = 0;
@@ -314,6 +420,9 @@ MemoryContext::Arena& MemoryContext::Arena::operator=(Arena&& other) {
   this->allocated_blocks = std::move(other.allocated_blocks);
   this->free_blocks_by_addr = std::move(other.free_blocks_by_addr);
   this->free_blocks_by_size = std::move(other.free_blocks_by_size);
+  this->image = std::move(other.image);
+  this->page_is_dirty = std::move(other.page_is_dirty);
+  this->dirty_pages = std::move(other.dirty_pages);
   other.host_addr = nullptr;
   other.size = 0;
   other.allocated_bytes = 0;
@@ -327,14 +436,50 @@ MemoryContext::Arena::~Arena() {
   }
 }
 
-MemoryContext::Arena MemoryContext::Arena::duplicate() const {
-  Arena ret(this->addr, this->size);
-  ret.allocated_bytes = this->allocated_bytes;
-  ret.free_bytes = this->free_bytes;
-  ret.free_blocks_by_addr = this->free_blocks_by_addr;
-  ret.free_blocks_by_size = this->free_blocks_by_size;
-  ::memcpy(ret.host_addr, this->host_addr, this->size);
-  return ret;
+MemoryContext::Arena MemoryContext::Arena::duplicate(uint8_t page_bits) const {
+  optional<Arena> ret;
+#ifndef PHOSG_WINDOWS
+  // The first time an arena is duplicated, its contents are copied into an
+  // image, and the arena's memory is replaced with a private mapping of the
+  // image (which has the same contents, so nothing changes at host_addr). The
+  // new arena is another private mapping of the same image, so it only has to
+  // copy the pages that this arena has written since the image was made. Once
+  // more than half of the pages have been written, a new image is made from
+  // the arena's current contents, so the cost of duplicate() is proportional
+  // to the number of pages written (amortized over the duplicates made from
+  // each image). If the image can't be made or mapped, fall back to copying
+  // the arena's contents.
+  try {
+    size_t num_pages = this->size >> page_bits;
+    if (!this->image || (this->dirty_pages.size() > num_pages / 2)) {
+      auto new_image = make_shared<ArenaImage>(this->host_addr, this->size);
+      new_image->map(this->host_addr);
+      this->image = std::move(new_image);
+      this->page_is_dirty.assign(num_pages, 0);
+      this->dirty_pages.clear();
+    }
+    ret.emplace(this->addr, this->size, this->image);
+    size_t page_size = static_cast<size_t>(1) << page_bits;
+    for (uint32_t page : this->dirty_pages) {
+      ::memcpy(reinterpret_cast<uint8_t*>(ret->host_addr) + (page * page_size),
+          reinterpret_cast<const uint8_t*>(this->host_addr) + (page * page_size), page_size);
+    }
+    ret->page_is_dirty = this->page_is_dirty;
+    ret->dirty_pages = this->dirty_pages;
+  } catch (const runtime_error&) {
+    ret.reset();
+  }
+#endif
+  if (!ret.has_value()) {
+    ret.emplace(this->addr, this->size);
+    ::memcpy(ret->host_addr, this->host_addr, this->size);
+  }
+  ret->allocated_bytes = this->allocated_bytes;
+  ret->free_bytes = this->free_bytes;
+  ret->allocated_blocks = this->allocated_blocks;
+  ret->free_blocks_by_addr = this->free_blocks_by_addr;
+  ret->free_blocks_by_size = this->free_blocks_by_size;
+  return std::move(*ret);
 }
 
 string MemoryContext::Arena::str() const {
@@ -426,7 +571,7 @@ uint32_t MemoryContext::find_unallocated_arena_space(
   }
 
   for (size_t z = start_page_num; z < end_page_num; z++) {
-    if (this->arena_for_page_number[z].get()) {
+    if (this->arena_for_page_number[z]) {
       start_page_num = z + 1;
     } else if (z - start_page_num >= page_count - 1) {
       break;
@@ -446,7 +591,7 @@ shared_ptr<MemoryContext::Arena> MemoryContext::create_arena(
   // Make sure the relevant space in the arenas list is all blank
   size_t end_page_num = this->page_number_for_addr(addr + size - 1);
   for (size_t z = this->page_number_for_addr(addr); z <= end_page_num; z++) {
-    if (this->arena_for_page_number[z].get()) {
+    if (this->arena_for_page_number[z]) {
       throw runtime_error("fixed-address arena overlaps existing arena");
     }
   }
@@ -456,13 +601,16 @@ shared_ptr<MemoryContext::Arena> MemoryContext::create_arena(
   this->arenas_by_addr.emplace(arena->addr, arena);
   this->arenas_by_host_addr.emplace(arena->host_addr, arena);
   for (uint32_t z = this->page_number_for_addr(arena->addr); z <= end_page_num; z++) {
-    this->arena_for_page_number[z] = arena;
+    this->arena_for_page_number[z] = arena.get();
   }
 
   // Update stats
   this->free_bytes += arena->free_bytes;
   this->allocated_bytes += arena->allocated_bytes;
   this->size += arena->size;
+  if (!this->watched_pages.empty()) {
+    this->note_possible_write(arena->addr, arena->size);
+  }
 
   return arena;
 }
@@ -479,11 +627,13 @@ void MemoryContext::delete_arena(shared_ptr<Arena> arena) {
   // Clear the arena from the page pointers list
   size_t end_page_num = this->page_number_for_addr(arena->addr + arena->size - 1);
   for (size_t z = this->page_number_for_addr(arena->addr); z <= end_page_num; z++) {
-    if (this->arena_for_page_number[z] != arena) {
+    if (this->arena_for_page_number[z] != arena.get()) {
       throw logic_error("arena did not have all valid page pointers at deletion time");
     }
-    this->arena_for_page_number[z].reset();
+    this->arena_for_page_number[z] = nullptr;
   }
+  this->last_accessed_arena = nullptr;
+  this->clear_last_accessed_block();
 
   // Update stats. Note that allocated_bytes may not be zero since free() has a
   // shortcut where it doesn't update structs/stats if the arena is about to be
@@ -491,12 +641,17 @@ void MemoryContext::delete_arena(shared_ptr<Arena> arena) {
   this->size -= arena->size;
   this->allocated_bytes -= arena->allocated_bytes;
   this->free_bytes -= arena->free_bytes;
+  if (!this->watched_pages.empty()) {
+    this->note_possible_write(arena->addr, arena->size);
+  }
 }
 
 void MemoryContext::free(uint32_t addr) {
+  this->clear_last_accessed_block();
+
   // Find the arena that this region is within
-  auto arena = this->arena_for_page_number.at(this->page_number_for_addr(addr));
-  if (!arena.get()) {
+  Arena* arena = this->arena_for_page_number.at(this->page_number_for_addr(addr));
+  if (!arena) {
     throw invalid_argument("freed region is not part of any arena");
   }
 
@@ -514,7 +669,7 @@ void MemoryContext::free(uint32_t addr) {
   if (arena->allocated_blocks.empty()) {
     // Note: delete_arena will correctly update the stats for us; no need to do
     // it manually here.
-    this->delete_arena(arena);
+    this->delete_arena(this->arenas_by_addr.at(arena->addr));
 
   } else {
     // Find the free block after the allocated block. Note that this may be
@@ -580,9 +735,11 @@ bool MemoryContext::resize(uint32_t addr, size_t new_size) {
   // Round new_size up to a multiple of 4, as in allocate()
   new_size = (new_size + 3) & (~3);
 
+  this->clear_last_accessed_block();
+
   // Find the arena that this region is within
-  auto arena = this->arena_for_page_number.at(this->page_number_for_addr(addr));
-  if (!arena.get()) {
+  Arena* arena = this->arena_for_page_number.at(this->page_number_for_addr(addr));
+  if (!arena) {
     throw invalid_argument("resized region is not part of any arena");
   }
 
@@ -687,8 +844,8 @@ const unordered_map<string, uint32_t> MemoryContext::all_symbols() const {
 }
 
 size_t MemoryContext::get_block_size(uint32_t addr) const {
-  auto arena = this->arena_for_page_number.at(this->page_number_for_addr(addr));
-  if (!arena.get()) {
+  const Arena* arena = this->arena_for_page_number.at(this->page_number_for_addr(addr));
+  if (!arena) {
     return 0;
   }
   try {
@@ -707,6 +864,39 @@ bool MemoryContext::exists(uint32_t addr, size_t size, bool skip_strict) const {
   }
 }
 
+const MemoryContext::Arena* MemoryContext::arena_for_access(uint32_t addr, size_t size) const {
+  const Arena* arena = this->arena_for_page_number[this->page_number_for_addr(addr)];
+  if (!arena) {
+    throw out_of_range("address not within any arena");
+  }
+  // This breaks if addr == 0 and size == 0. This was originally
+  // unintentional, but it turns out to be useful to detect accidental usage
+  // of memcpy() and the like on empty handles, so we keep this failure mode.
+  if (addr == 0 && size == 0) {
+    throw out_of_range("MemoryContext::at(0, 0)");
+  }
+  if (static_cast<uint64_t>(addr - arena->addr) + size > arena->size) {
+    throw out_of_range("data not entirely contained within one arena");
+  }
+  this->last_accessed_arena.store(arena, std::memory_order_relaxed);
+  return arena;
+}
+
+void MemoryContext::check_access_within_allocated_block(
+    const Arena* arena, uint32_t addr, size_t size) const {
+  auto it = arena->allocated_blocks.upper_bound(addr);
+  if (it != arena->allocated_blocks.begin()) {
+    it--;
+    uint64_t block_end = static_cast<uint64_t>(it->first) + it->second;
+    if ((addr >= it->first) && (static_cast<uint64_t>(addr) + size <= block_end)) {
+      this->last_accessed_block.store(
+          (static_cast<uint64_t>(it->first) << 32) | it->second, std::memory_order_relaxed);
+      return;
+    }
+  }
+  throw out_of_range("data is not within an allocated block");
+}
+
 vector<pair<uint32_t, uint32_t>> MemoryContext::allocated_blocks() const {
   vector<pair<uint32_t, uint32_t>> ret;
   for (const auto& arena_it : this->arenas_by_addr) {
@@ -721,6 +911,49 @@ size_t MemoryContext::get_page_size() const {
   return this->page_size;
 }
 
+void MemoryContext::watch_for_writes(uint32_t addr, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  if (this->watched_pages.empty()) {
+    this->watched_pages.resize(this->total_pages, 0);
+  }
+  size_t end_page_num = this->page_number_for_addr(addr + size - 1);
+  for (size_t z = this->page_number_for_addr(addr); z <= end_page_num; z++) {
+    if (!this->watched_pages[z]) {
+      this->watched_pages[z] = 1;
+      this->watched_page_generations.emplace(z, 0);
+    }
+  }
+}
+
+uint64_t MemoryContext::write_generation(uint32_t addr, size_t size) const {
+  // Each page's generation only increases, so the sum changes whenever any of
+  // the pages' generations changes
+  uint64_t ret = 0;
+  if (size == 0) {
+    return ret;
+  }
+  size_t end_page_num = this->page_number_for_addr(addr + size - 1);
+  for (size_t z = this->page_number_for_addr(addr); z <= end_page_num; z++) {
+    auto it = this->watched_page_generations.find(z);
+    if (it != this->watched_page_generations.end()) {
+      ret += it->second;
+    }
+  }
+  return ret;
+}
+
+void MemoryContext::note_possible_write(uint32_t addr, size_t size) {
+  size_t end_page_num = this->page_number_for_addr(addr + size - 1);
+  for (size_t z = this->page_number_for_addr(addr); z <= end_page_num; z++) {
+    if (this->watched_pages[z]) {
+      this->watched_page_generations[z]++;
+      this->watched_writes++;
+    }
+  }
+}
+
 void MemoryContext::print_state(FILE* stream) const {
   fwrite_fmt(stream, "MemoryContext page_bits={} page_size=0x{:X} total_pages=0x{:X} size=0x{:X} allocated_bytes=0x{:X} free_bytes=0x{:X}\n  Arenas:\n",
       this->page_bits,
@@ -736,8 +969,8 @@ void MemoryContext::print_state(FILE* stream) const {
   }
   fwrite_fmt(stream, "  Page map:\n");
   for (size_t z = 0; z < this->total_pages; z++) {
-    const auto& arena = this->arena_for_page_number[z];
-    if (arena.get()) {
+    const Arena* arena = this->arena_for_page_number[z];
+    if (arena) {
       fwrite_fmt(stream, "    [{:X}] => {:08X}\n", z, arena->addr);
     }
   }
@@ -824,8 +1057,8 @@ void MemoryContext::verify() const {
   }
 
   size_t expected_size = 0;
-  for (const auto& arena : this->arena_for_page_number) {
-    if (arena.get()) {
+  for (const Arena* arena : this->arena_for_page_number) {
+    if (arena) {
       expected_size += this->page_size;
     }
   }
@@ -843,24 +1076,24 @@ void MemoryContext::verify() const {
     throw logic_error("allocated_bytes + free_bytes != size");
   }
 
-  unordered_set<shared_ptr<Arena>> arenas_by_addr_coll;
-  unordered_set<shared_ptr<Arena>> arenas_by_host_addr_coll;
-  unordered_set<shared_ptr<Arena>> arenas_for_page_number_coll;
+  unordered_set<const Arena*> arenas_by_addr_coll;
+  unordered_set<const Arena*> arenas_by_host_addr_coll;
+  unordered_set<const Arena*> arenas_for_page_number_coll;
   for (const auto& it : this->arenas_by_addr) {
-    arenas_by_addr_coll.emplace(it.second);
+    arenas_by_addr_coll.emplace(it.second.get());
     if (it.first != it.second->addr) {
       throw logic_error("arena index key in arenas_by_addr is wrong");
     }
   }
   for (const auto& it : this->arenas_by_host_addr) {
-    arenas_by_host_addr_coll.emplace(it.second);
+    arenas_by_host_addr_coll.emplace(it.second.get());
     if (it.first != it.second->host_addr) {
       throw logic_error("arena index key in arenas_by_host_addr is wrong");
     }
   }
   for (size_t z = 0; z < this->arena_for_page_number.size(); z++) {
-    auto arena = this->arena_for_page_number[z];
-    if (!arena.get()) {
+    const Arena* arena = this->arena_for_page_number[z];
+    if (!arena) {
       continue;
     }
     uint32_t page_base = this->addr_for_page_number(z);
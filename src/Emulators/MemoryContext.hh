@@ -4,8 +4,10 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <phosg/Encoding.hh>
 #include <phosg/Strings.hh>
 #include <stdexcept>
@@ -29,36 +31,37 @@ public:
 
   // This isn't a copy constructor because copying a MemoryContext is very
   // expensive, so we don't want to allow the caller to do it accidentally.
+  // The copy is copy-on-write: the first duplicate() of an arena copies its
+  // contents once, and after that, duplicate() only copies the pages that have
+  // been written (through non-const at()) since then. (If the system can't
+  // make copy-on-write mappings, the arenas' contents are copied instead.)
+  // Writes are tracked when at() is called, so a pointer returned by non-const
+  // at() must not be written through after the next call to duplicate(); call
+  // at() again instead. It's safe to call duplicate() from multiple threads at
+  // once, as long as no thread modifies this context at the same time.
   MemoryContext duplicate() const;
 
   template <typename T>
   T* at(uint32_t addr, size_t size = sizeof(T), bool skip_strict = false) {
-    // This breaks if addr == 0 and size == 0. This was originally
-    // unintentional, but it turns out to be useful to detect accidental usage
-    // of memcpy() and the like on empty handles, so we keep this failure mode.
-    size_t start_page_num = this->page_number_for_addr(addr);
-    size_t end_page_num = this->page_number_for_addr(addr + size - 1);
-    auto arena = this->arena_for_page_number[start_page_num];
-    if (!arena.get()) {
-      throw std::out_of_range("address not within any arena");
+    const Arena* arena = this->arena_for_checked_access(addr, size, skip_strict);
+    // This access might be a write, so the next duplicate() has to copy these
+    // pages instead of using the arena's image
+    if (arena->image) {
+      arena->mark_dirty(addr - arena->addr, size, this->page_bits);
     }
-    for (size_t z = start_page_num + 1; z <= end_page_num; z++) {
-      if (this->arena_for_page_number[z] != arena) {
-        if (addr == 0 && size == 0) {
-          throw std::out_of_range("MemoryContext::at(0, 0)");
-        }
-        throw std::out_of_range("data not entirely contained within one arena");
-      }
-    }
-    if (this->strict && !skip_strict && !arena->is_within_allocated_block(addr, size)) {
-      throw std::out_of_range("data is not within an allocated block");
+    // Any non-const access might be a write, so if the range overlaps any
+    // watched pages, count it as a write to those pages
+    if (!this->watched_pages.empty()) {
+      this->note_possible_write(addr, size);
     }
     return reinterpret_cast<T*>(
         reinterpret_cast<uint8_t*>(arena->host_addr) + (addr - arena->addr));
   }
   template <typename T>
   const T* at(uint32_t addr, size_t size = sizeof(T), bool skip_strict = false) const {
-    return const_cast<MemoryContext*>(this)->at<T>(addr, size, skip_strict);
+    const Arena* arena = this->arena_for_checked_access(addr, size, skip_strict);
+    return reinterpret_cast<const T*>(
+        reinterpret_cast<const uint8_t*>(arena->host_addr) + (addr - arena->addr));
   }
 
   inline uint32_t at(const void* host_addr) const {
@@ -287,8 +290,26 @@ public:
 
   size_t get_page_size() const;
 
+  // Emulators that cache decoded instructions use these functions to find out
+  // when the code they decoded may have changed. After watch_for_writes is
+  // called for a range, each page that overlaps that range has a write
+  // generation, which is incremented by any non-const access to memory in that
+  // page, and by creating or deleting the arena that contains it. Non-const
+  // accesses aren't necessarily writes, so a generation may change even if
+  // nothing was written; callers have to be able to handle this.
+  // write_generation returns a value that changes whenever the generation of
+  // any watched page in the given range changes. watched_write_count is the
+  // total number of increments across all watched pages, so it's a cheap way
+  // to check whether any watched page may have been written.
+  void watch_for_writes(uint32_t addr, size_t size);
+  uint64_t write_generation(uint32_t addr, size_t size) const;
+  inline uint64_t watched_write_count() const {
+    return this->watched_writes;
+  }
+
   inline void set_strict(bool strict) {
     this->strict = strict;
+    this->clear_last_accessed_block();
   }
 
   void print_state(FILE* stream) const;
@@ -310,6 +331,8 @@ private:
 
   bool strict;
 
+  struct ArenaImage;
+
   struct Arena {
     uint32_t addr;
     void* host_addr;
@@ -319,15 +342,36 @@ private:
     std::map<uint32_t, uint32_t> allocated_blocks;
     std::map<uint32_t, uint32_t> free_blocks_by_addr;
     std::multimap<uint32_t, uint32_t> free_blocks_by_size;
+    // After the arena is first duplicated, its memory and its duplicates'
+    // memory are private copy-on-write mappings of image, which is never
+    // modified. dirty_pages lists the pages (numbered from the start of the
+    // arena) that may differ from the image, in the order they were first
+    // written; page_is_dirty has one entry for each page in the arena. These
+    // are empty if image is null. (They're mutable because duplicate() is
+    // const; duplicate() holds the context's duplicate_lock while using them.)
+    mutable std::shared_ptr<const ArenaImage> image;
+    mutable std::vector<uint8_t> page_is_dirty;
+    mutable std::vector<uint32_t> dirty_pages;
 
     Arena(uint32_t addr, size_t size);
+    Arena(uint32_t addr, size_t size, std::shared_ptr<const ArenaImage> image);
     Arena(const Arena&) = delete;
     Arena(Arena&&);
     Arena& operator=(const Arena&) = delete;
     Arena& operator=(Arena&&);
     ~Arena();
 
-    Arena duplicate() const;
+    Arena duplicate(uint8_t page_bits) const;
+
+    inline void mark_dirty(size_t offset, size_t size, uint8_t page_bits) const {
+      size_t end_page = (offset + (size ? size : 1) - 1) >> page_bits;
+      for (size_t page = offset >> page_bits; page <= end_page; page++) {
+        if (!this->page_is_dirty[page]) {
+          this->page_is_dirty[page] = 1;
+          this->dirty_pages.emplace_back(page);
+        }
+      }
+    }
 
     std::string str() const;
     void verify() const;
@@ -345,11 +389,65 @@ private:
   // make allocations sub-linear time. I'm not going to implement this just yet.
   std::map<uint32_t, std::shared_ptr<Arena>> arenas_by_addr;
   std::map<const void*, std::shared_ptr<Arena>> arenas_by_host_addr;
-  std::vector<std::shared_ptr<Arena>> arena_for_page_number;
+  // The arenas are owned by arenas_by_addr; this index uses raw pointers so
+  // that looking up an arena doesn't have to update any reference counts
+  std::vector<Arena*> arena_for_page_number;
+
+  // Held by duplicate() while it reads or replaces arenas' images
+  mutable std::mutex duplicate_lock;
+
+  // Cache for at(). last_accessed_arena is cleared when any arena is deleted,
+  // and the last accessed block range is cleared when any block is freed or
+  // resized. The const accessors update these, so they're atomic to allow
+  // multiple threads to read from the same context concurrently (as long as
+  // no thread modifies it). Relaxed ordering is enough because each value is
+  // only a hint: a stale arena or block is always one that still exists, so
+  // the worst case is an extra lookup. The block is stored as its address in
+  // the high 32 bits and its size in the low 32 bits, so that a reader can't
+  // see the address of one block with the size of another.
+  mutable std::atomic<const Arena*> last_accessed_arena;
+  mutable std::atomic<uint64_t> last_accessed_block;
+
+  inline void clear_last_accessed_block() const {
+    this->last_accessed_block.store(0, std::memory_order_relaxed);
+  }
+
+  inline const Arena* arena_for_checked_access(uint32_t addr, size_t size, bool skip_strict) const {
+    // Most accesses are in the same arena as the previous access, so we check
+    // that arena before looking in the page table
+    const Arena* arena = this->last_accessed_arena.load(std::memory_order_relaxed);
+    if (!arena || (size == 0) || (addr < arena->addr) ||
+        (static_cast<uint64_t>(addr - arena->addr) + size > arena->size)) {
+      arena = this->arena_for_access(addr, size);
+    }
+    // Similarly, most strict-mode accesses are within the same allocated block
+    // as the previous access
+    if (this->strict && !skip_strict) {
+      uint64_t block = this->last_accessed_block.load(std::memory_order_relaxed);
+      uint32_t block_addr = block >> 32;
+      if ((addr < block_addr) ||
+          (static_cast<uint64_t>(addr) + size > block_addr + (block & 0xFFFFFFFF))) {
+        this->check_access_within_allocated_block(arena, addr, size);
+      }
+    }
+    return arena;
+  }
+
+  const Arena* arena_for_access(uint32_t addr, size_t size) const;
+  void check_access_within_allocated_block(const Arena* arena, uint32_t addr, size_t size) const;
 
   std::unordered_map<std::string, uint32_t> symbol_addrs;
   std::unordered_map<uint32_t, std::string> addr_symbols;
 
+  // watched_pages is indexed by page number, and is empty if
+  // watch_for_writes was never called. watched_page_generations has an entry
+  // for each page that is set in watched_pages; entries are never removed.
+  std::vector<uint8_t> watched_pages;
+  std::unordered_map<uint32_t, uint64_t> watched_page_generations;
+  uint64_t watched_writes;
+
+  void note_possible_write(uint32_t addr, size_t size);
+
   inline uint32_t page_base_for_addr(uint32_t addr) const {
     return (addr & ~(this->page_size - 1));
   }
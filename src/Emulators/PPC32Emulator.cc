@@ -1206,52 +1206,47 @@ uint32_t PPC32Emulator::Assembler::asm_b_mnemonic(const StreamItem& si) {
       op_set_b_link(link);
 }
 
-void PPC32Emulator::exec_4C(uint32_t op) {
+PPC32Emulator::exec_fn PPC32Emulator::resolve_exec_4C(uint32_t op) {
   switch (op_get_subopcode(op)) {
     case 0x000:
-      this->exec_4C_000_mcrf(op);
-      break;
+      return &PPC32Emulator::exec_4C_000_mcrf;
     case 0x010:
-      this->exec_4C_010_bclr(op);
-      break;
+      return &PPC32Emulator::exec_4C_010_bclr;
     case 0x021:
-      this->exec_4C_021_crnor(op);
-      break;
+      return &PPC32Emulator::exec_4C_021_crnor;
     case 0x032:
-      this->exec_4C_032_rfi(op);
-      break;
+      return &PPC32Emulator::exec_4C_032_rfi;
     case 0x081:
-      this->exec_4C_081_crandc(op);
-      break;
+      return &PPC32Emulator::exec_4C_081_crandc;
     case 0x096:
-      this->exec_4C_096_isync(op);
-      break;
+      return &PPC32Emulator::exec_4C_096_isync;
     case 0x0C1:
-      this->exec_4C_0C1_crxor(op);
-      break;
+      return &PPC32Emulator::exec_4C_0C1_crxor;
     case 0x0E1:
-      this->exec_4C_0E1_crnand(op);
-      break;
+      return &PPC32Emulator::exec_4C_0E1_crnand;
     case 0x101:
-      this->exec_4C_101_crand(op);
-      break;
+      return &PPC32Emulator::exec_4C_101_crand;
     case 0x121:
-      this->exec_4C_121_creqv(op);
-      break;
+      return &PPC32Emulator::exec_4C_121_creqv;
     case 0x1A1:
-      this->exec_4C_1A1_crorc(op);
-      break;
+      return &PPC32Emulator::exec_4C_1A1_crorc;
     case 0x1C1:
-      this->exec_4C_1C1_cror(op);
-      break;
+      return &PPC32Emulator::exec_4C_1C1_cror;
     case 0x210:
-      this->exec_4C_210_bcctr(op);
-      break;
+      return &PPC32Emulator::exec_4C_210_bcctr;
     default:
-      throw runtime_error("invalid 4C subopcode");
+      return nullptr;
   }
 }
 
+void PPC32Emulator::exec_4C(uint32_t op) {
+  auto fn = PPC32Emulator::resolve_exec_4C(op);
+  if (!fn) {
+    throw runtime_error("invalid 4C subopcode");
+  }
+  (this->*fn)(op);
+}
+
 string PPC32Emulator::dasm_4C(DisassemblyState& s, uint32_t op) {
   switch (op_get_subopcode(op)) {
     case 0x000:
@@ -1896,304 +1891,218 @@ uint32_t PPC32Emulator::Assembler::asm_andis_rec(const StreamItem& si) {
       op_set_uimm(a[2].value);
 }
 
-void PPC32Emulator::exec_7C(uint32_t op) {
+PPC32Emulator::exec_fn PPC32Emulator::resolve_exec_7C(uint32_t op) {
   switch (op_get_subopcode(op)) {
     case 0x000:
-      this->exec_7C_000_cmp(op);
-      break;
+      return &PPC32Emulator::exec_7C_000_cmp;
     case 0x004:
-      this->exec_7C_004_tw(op);
-      break;
+      return &PPC32Emulator::exec_7C_004_tw;
     case 0x008:
-      this->exec_7C_008_208_subfc(op);
-      break;
+      return &PPC32Emulator::exec_7C_008_208_subfc;
     case 0x00A:
-      this->exec_7C_00A_20A_addc(op);
-      break;
+      return &PPC32Emulator::exec_7C_00A_20A_addc;
     case 0x00B:
-      this->exec_7C_00B_mulhwu(op);
-      break;
+      return &PPC32Emulator::exec_7C_00B_mulhwu;
     case 0x013:
-      this->exec_7C_013_mfcr(op);
-      break;
+      return &PPC32Emulator::exec_7C_013_mfcr;
     case 0x014:
-      this->exec_7C_014_lwarx(op);
-      break;
+      return &PPC32Emulator::exec_7C_014_lwarx;
     case 0x017:
-      this->exec_7C_017_lwzx(op);
-      break;
+      return &PPC32Emulator::exec_7C_017_lwzx;
     case 0x018:
-      this->exec_7C_018_slw(op);
-      break;
+      return &PPC32Emulator::exec_7C_018_slw;
     case 0x01A:
-      this->exec_7C_01A_cntlzw(op);
-      break;
+      return &PPC32Emulator::exec_7C_01A_cntlzw;
     case 0x01C:
-      this->exec_7C_01C_and(op);
-      break;
+      return &PPC32Emulator::exec_7C_01C_and;
     case 0x020:
-      this->exec_7C_020_cmpl(op);
-      break;
+      return &PPC32Emulator::exec_7C_020_cmpl;
     case 0x028:
-      this->exec_7C_028_228_subf(op);
-      break;
+      return &PPC32Emulator::exec_7C_028_228_subf;
     case 0x036:
-      this->exec_7C_036_dcbst(op);
-      break;
+      return &PPC32Emulator::exec_7C_036_dcbst;
     case 0x037:
-      this->exec_7C_037_lwzux(op);
-      break;
+      return &PPC32Emulator::exec_7C_037_lwzux;
     case 0x03C:
-      this->exec_7C_03C_andc(op);
-      break;
+      return &PPC32Emulator::exec_7C_03C_andc;
     case 0x04B:
-      this->exec_7C_04B_mulhw(op);
-      break;
+      return &PPC32Emulator::exec_7C_04B_mulhw;
     case 0x053:
-      this->exec_7C_053_mfmsr(op);
-      break;
+      return &PPC32Emulator::exec_7C_053_mfmsr;
     case 0x056:
-      this->exec_7C_056_dcbf(op);
-      break;
+      return &PPC32Emulator::exec_7C_056_dcbf;
     case 0x057:
-      this->exec_7C_057_lbzx(op);
-      break;
+      return &PPC32Emulator::exec_7C_057_lbzx;
     case 0x068:
     case 0x268:
-      this->exec_7C_068_268_neg(op);
-      break;
+      return &PPC32Emulator::exec_7C_068_268_neg;
     case 0x077:
-      this->exec_7C_077_lbzux(op);
-      break;
+      return &PPC32Emulator::exec_7C_077_lbzux;
     case 0x07C:
-      this->exec_7C_07C_nor(op);
-      break;
+      return &PPC32Emulator::exec_7C_07C_nor;
     case 0x088:
     case 0x288:
-      this->exec_7C_088_288_subfe(op);
-      break;
+      return &PPC32Emulator::exec_7C_088_288_subfe;
     case 0x08A:
     case 0x28A:
-      this->exec_7C_08A_28A_adde(op);
-      break;
+      return &PPC32Emulator::exec_7C_08A_28A_adde;
     case 0x090:
-      this->exec_7C_090_mtcrf(op);
-      break;
+      return &PPC32Emulator::exec_7C_090_mtcrf;
     case 0x092:
-      this->exec_7C_092_mtmsr(op);
-      break;
+      return &PPC32Emulator::exec_7C_092_mtmsr;
     case 0x096:
-      this->exec_7C_096_stwcx_rec(op);
-      break;
+      return &PPC32Emulator::exec_7C_096_stwcx_rec;
     case 0x097:
-      this->exec_7C_097_stwx(op);
-      break;
+      return &PPC32Emulator::exec_7C_097_stwx;
     case 0x0B7:
-      this->exec_7C_0B7_stwux(op);
-      break;
+      return &PPC32Emulator::exec_7C_0B7_stwux;
     case 0x0C8:
     case 0x2C8:
-      this->exec_7C_0C8_2C8_subfze(op);
-      break;
+      return &PPC32Emulator::exec_7C_0C8_2C8_subfze;
     case 0x0CA:
     case 0x2CA:
-      this->exec_7C_0CA_2CA_addze(op);
-      break;
+      return &PPC32Emulator::exec_7C_0CA_2CA_addze;
     case 0x0D2:
-      this->exec_7C_0D2_mtsr(op);
-      break;
+      return &PPC32Emulator::exec_7C_0D2_mtsr;
     case 0x0D7:
-      this->exec_7C_0D7_stbx(op);
-      break;
+      return &PPC32Emulator::exec_7C_0D7_stbx;
     case 0x0E8:
     case 0x2E8:
-      this->exec_7C_0E8_2E8_subfme(op);
-      break;
+      return &PPC32Emulator::exec_7C_0E8_2E8_subfme;
     case 0x0EA:
     case 0x2EA:
-      this->exec_7C_0EA_2EA_addme(op);
-      break;
+      return &PPC32Emulator::exec_7C_0EA_2EA_addme;
     case 0x0EB:
     case 0x2EB:
-      this->exec_7C_0EB_2EB_mullw(op);
-      break;
+      return &PPC32Emulator::exec_7C_0EB_2EB_mullw;
     case 0x0F2:
-      this->exec_7C_0F2_mtsrin(op);
-      break;
+      return &PPC32Emulator::exec_7C_0F2_mtsrin;
     case 0x0F6:
-      this->exec_7C_0F6_dcbtst(op);
-      break;
+      return &PPC32Emulator::exec_7C_0F6_dcbtst;
     case 0x0F7:
-      this->exec_7C_0F7_stbux(op);
-      break;
+      return &PPC32Emulator::exec_7C_0F7_stbux;
     case 0x10A:
     case 0x30A:
-      this->exec_7C_10A_30A_add(op);
-      break;
+      return &PPC32Emulator::exec_7C_10A_30A_add;
     case 0x116:
-      this->exec_7C_116_dcbt(op);
-      break;
+      return &PPC32Emulator::exec_7C_116_dcbt;
     case 0x117:
-      this->exec_7C_117_lhzx(op);
-      break;
+      return &PPC32Emulator::exec_7C_117_lhzx;
     case 0x11C:
-      this->exec_7C_11C_eqv(op);
-      break;
+      return &PPC32Emulator::exec_7C_11C_eqv;
     case 0x132:
-      this->exec_7C_132_tlbie(op);
-      break;
+      return &PPC32Emulator::exec_7C_132_tlbie;
     case 0x136:
-      this->exec_7C_136_eciwx(op);
-      break;
+      return &PPC32Emulator::exec_7C_136_eciwx;
     case 0x137:
-      this->exec_7C_137_lhzux(op);
-      break;
+      return &PPC32Emulator::exec_7C_137_lhzux;
     case 0x13C:
-      this->exec_7C_13C_xor(op);
-      break;
+      return &PPC32Emulator::exec_7C_13C_xor;
     case 0x153:
-      this->exec_7C_153_mfspr(op);
-      break;
+      return &PPC32Emulator::exec_7C_153_mfspr;
     case 0x157:
-      this->exec_7C_157_lhax(op);
-      break;
+      return &PPC32Emulator::exec_7C_157_lhax;
     case 0x172:
-      this->exec_7C_172_tlbia(op);
-      break;
+      return &PPC32Emulator::exec_7C_172_tlbia;
     case 0x173:
-      this->exec_7C_173_mftb(op);
-      break;
+      return &PPC32Emulator::exec_7C_173_mftb;
     case 0x177:
-      this->exec_7C_177_lhaux(op);
-      break;
+      return &PPC32Emulator::exec_7C_177_lhaux;
     case 0x197:
-      this->exec_7C_197_sthx(op);
-      break;
+      return &PPC32Emulator::exec_7C_197_sthx;
     case 0x19C:
-      this->exec_7C_19C_orc(op);
-      break;
+      return &PPC32Emulator::exec_7C_19C_orc;
     case 0x1B6:
-      this->exec_7C_1B6_ecowx(op);
-      break;
+      return &PPC32Emulator::exec_7C_1B6_ecowx;
     case 0x1B7:
-      this->exec_7C_1B7_sthux(op);
-      break;
+      return &PPC32Emulator::exec_7C_1B7_sthux;
     case 0x1BC:
-      this->exec_7C_1BC_or(op);
-      break;
+      return &PPC32Emulator::exec_7C_1BC_or;
     case 0x1CB:
     case 0x3CB:
-      this->exec_7C_1CB_3CB_divwu(op);
-      break;
+      return &PPC32Emulator::exec_7C_1CB_3CB_divwu;
     case 0x1D3:
-      this->exec_7C_1D3_mtspr(op);
-      break;
+      return &PPC32Emulator::exec_7C_1D3_mtspr;
     case 0x1D6:
-      this->exec_7C_1D6_dcbi(op);
-      break;
+      return &PPC32Emulator::exec_7C_1D6_dcbi;
     case 0x1DC:
-      this->exec_7C_1DC_nand(op);
-      break;
+      return &PPC32Emulator::exec_7C_1DC_nand;
     case 0x1EB:
     case 0x3EB:
-      this->exec_7C_1EB_3EB_divw(op);
-      break;
+      return &PPC32Emulator::exec_7C_1EB_3EB_divw;
     case 0x200:
-      this->exec_7C_200_mcrxr(op);
-      break;
+      return &PPC32Emulator::exec_7C_200_mcrxr;
     case 0x215:
-      this->exec_7C_215_lswx(op);
-      break;
+      return &PPC32Emulator::exec_7C_215_lswx;
     case 0x216:
-      this->exec_7C_216_lwbrx(op);
-      break;
+      return &PPC32Emulator::exec_7C_216_lwbrx;
     case 0x217:
-      this->exec_7C_217_lfsx(op);
-      break;
+      return &PPC32Emulator::exec_7C_217_lfsx;
     case 0x218:
-      this->exec_7C_218_srw(op);
-      break;
+      return &PPC32Emulator::exec_7C_218_srw;
     case 0x236:
-      this->exec_7C_236_tlbsync(op);
-      break;
+      return &PPC32Emulator::exec_7C_236_tlbsync;
     case 0x237:
-      this->exec_7C_237_lfsux(op);
-      break;
+      return &PPC32Emulator::exec_7C_237_lfsux;
     case 0x253:
-      this->exec_7C_253_mfsr(op);
-      break;
+      return &PPC32Emulator::exec_7C_253_mfsr;
     case 0x255:
-      this->exec_7C_255_lswi(op);
-      break;
+      return &PPC32Emulator::exec_7C_255_lswi;
     case 0x256:
-      this->exec_7C_256_sync(op);
-      break;
+      return &PPC32Emulator::exec_7C_256_sync;
     case 0x257:
-      this->exec_7C_257_lfdx(op);
-      break;
+      return &PPC32Emulator::exec_7C_257_lfdx;
     case 0x277:
-      this->exec_7C_277_lfdux(op);
-      break;
+      return &PPC32Emulator::exec_7C_277_lfdux;
     case 0x293:
-      this->exec_7C_293_mfsrin(op);
-      break;
+      return &PPC32Emulator::exec_7C_293_mfsrin;
     case 0x295:
-      this->exec_7C_295_stswx(op);
-      break;
+      return &PPC32Emulator::exec_7C_295_stswx;
     case 0x296:
-      this->exec_7C_296_stwbrx(op);
-      break;
+      return &PPC32Emulator::exec_7C_296_stwbrx;
     case 0x297:
-      this->exec_7C_297_stfsx(op);
-      break;
+      return &PPC32Emulator::exec_7C_297_stfsx;
     case 0x2B7:
-      this->exec_7C_2B7_stfsux(op);
-      break;
+      return &PPC32Emulator::exec_7C_2B7_stfsux;
     case 0x2E5:
-      this->exec_7C_2E5_stswi(op);
-      break;
+      return &PPC32Emulator::exec_7C_2E5_stswi;
     case 0x2E7:
-      this->exec_7C_2E7_stfdx(op);
-      break;
+      return &PPC32Emulator::exec_7C_2E7_stfdx;
     case 0x2F6:
-      this->exec_7C_2F6_dcba(op);
-      break;
+      return &PPC32Emulator::exec_7C_2F6_dcba;
     case 0x2F7:
-      this->exec_7C_2F7_stfdux(op);
-      break;
+      return &PPC32Emulator::exec_7C_2F7_stfdux;
     case 0x316:
-      this->exec_7C_316_lhbrx(op);
-      break;
+      return &PPC32Emulator::exec_7C_316_lhbrx;
     case 0x318:
-      this->exec_7C_318_sraw(op);
-      break;
+      return &PPC32Emulator::exec_7C_318_sraw;
     case 0x338:
-      this->exec_7C_338_srawi(op);
-      break;
+      return &PPC32Emulator::exec_7C_338_srawi;
     case 0x356:
-      this->exec_7C_356_eieio(op);
-      break;
+      return &PPC32Emulator::exec_7C_356_eieio;
     case 0x396:
-      this->exec_7C_396_sthbrx(op);
-      break;
+      return &PPC32Emulator::exec_7C_396_sthbrx;
     case 0x39A:
-      this->exec_7C_39A_extsh(op);
-      break;
+      return &PPC32Emulator::exec_7C_39A_extsh;
     case 0x3BA:
-      this->exec_7C_3BA_extsb(op);
-      break;
+      return &PPC32Emulator::exec_7C_3BA_extsb;
     case 0x3D6:
-      this->exec_7C_3D6_icbi(op);
-      break;
+      return &PPC32Emulator::exec_7C_3D6_icbi;
     case 0x3D7:
-      this->exec_7C_3D7_stfiwx(op);
-      break;
+      return &PPC32Emulator::exec_7C_3D7_stfiwx;
     case 0x3F6:
-      this->exec_7C_3F6_dcbz(op);
-      break;
+      return &PPC32Emulator::exec_7C_3F6_dcbz;
     default:
-      throw runtime_error("invalid 7C subopcode");
+      return nullptr;
+  }
+}
+
+void PPC32Emulator::exec_7C(uint32_t op) {
+  auto fn = PPC32Emulator::resolve_exec_7C(op);
+  if (!fn) {
+    throw runtime_error("invalid 7C subopcode");
   }
+  (this->*fn)(op);
 }
 
 string PPC32Emulator::dasm_7C(DisassemblyState& s, uint32_t op) {
@@ -4614,43 +4523,41 @@ uint32_t PPC32Emulator::Assembler::asm_stfdu(const StreamItem& si) {
   return this->asm_load_store_imm(si, 0xDC000000, true, true);
 }
 
-void PPC32Emulator::exec_EC(uint32_t op) {
+PPC32Emulator::exec_fn PPC32Emulator::resolve_exec_EC(uint32_t op) {
   switch (op_get_short_subopcode(op)) {
     case 0x12:
-      this->exec_EC_12_fdivs(op);
-      break;
+      return &PPC32Emulator::exec_EC_12_fdivs;
     case 0x14:
-      this->exec_EC_14_fsubs(op);
-      break;
+      return &PPC32Emulator::exec_EC_14_fsubs;
     case 0x15:
-      this->exec_EC_15_fadds(op);
-      break;
+      return &PPC32Emulator::exec_EC_15_fadds;
     case 0x16:
-      this->exec_EC_16_fsqrts(op);
-      break;
+      return &PPC32Emulator::exec_EC_16_fsqrts;
     case 0x18:
-      this->exec_EC_18_fres(op);
-      break;
+      return &PPC32Emulator::exec_EC_18_fres;
     case 0x19:
-      this->exec_EC_19_fmuls(op);
-      break;
+      return &PPC32Emulator::exec_EC_19_fmuls;
     case 0x1C:
-      this->exec_EC_1C_fmsubs(op);
-      break;
+      return &PPC32Emulator::exec_EC_1C_fmsubs;
     case 0x1D:
-      this->exec_EC_1D_fmadds(op);
-      break;
+      return &PPC32Emulator::exec_EC_1D_fmadds;
     case 0x1E:
-      this->exec_EC_1E_fnmsubs(op);
-      break;
+      return &PPC32Emulator::exec_EC_1E_fnmsubs;
     case 0x1F:
-      this->exec_EC_1F_fnmadds(op);
-      break;
+      return &PPC32Emulator::exec_EC_1F_fnmadds;
     default:
-      throw runtime_error("invalid EC subopcode");
+      return nullptr;
   }
 }
 
+void PPC32Emulator::exec_EC(uint32_t op) {
+  auto fn = PPC32Emulator::resolve_exec_EC(op);
+  if (!fn) {
+    throw runtime_error("invalid EC subopcode");
+  }
+  (this->*fn)(op);
+}
+
 string PPC32Emulator::dasm_EC(DisassemblyState& s, uint32_t op) {
   switch (op_get_short_subopcode(op)) {
     case 0x12:
@@ -4880,99 +4787,81 @@ uint32_t PPC32Emulator::Assembler::asm_fnmadds(const StreamItem& si) {
       si.op_name.ends_with("."));
 }
 
-void PPC32Emulator::exec_FC(uint32_t op) {
+PPC32Emulator::exec_fn PPC32Emulator::resolve_exec_FC(uint32_t op) {
   uint8_t short_sub = op_get_short_subopcode(op);
   if (short_sub & 0x10) {
     switch (short_sub) {
       case 0x12:
-        this->exec_FC_12_fdiv(op);
-        break;
+        return &PPC32Emulator::exec_FC_12_fdiv;
       case 0x14:
-        this->exec_FC_14_fsub(op);
-        break;
+        return &PPC32Emulator::exec_FC_14_fsub;
       case 0x15:
-        this->exec_FC_15_fadd(op);
-        break;
+        return &PPC32Emulator::exec_FC_15_fadd;
       case 0x16:
-        this->exec_FC_16_fsqrt(op);
-        break;
+        return &PPC32Emulator::exec_FC_16_fsqrt;
       case 0x17:
-        this->exec_FC_17_fsel(op);
-        break;
+        return &PPC32Emulator::exec_FC_17_fsel;
       case 0x19:
-        this->exec_FC_19_fmul(op);
-        break;
+        return &PPC32Emulator::exec_FC_19_fmul;
       case 0x1A:
-        this->exec_FC_1A_frsqrte(op);
-        break;
+        return &PPC32Emulator::exec_FC_1A_frsqrte;
       case 0x1C:
-        this->exec_FC_1C_fmsub(op);
-        break;
+        return &PPC32Emulator::exec_FC_1C_fmsub;
       case 0x1D:
-        this->exec_FC_1D_fmadd(op);
-        break;
+        return &PPC32Emulator::exec_FC_1D_fmadd;
       case 0x1E:
-        this->exec_FC_1E_fnmsub(op);
-        break;
+        return &PPC32Emulator::exec_FC_1E_fnmsub;
       case 0x1F:
-        this->exec_FC_1F_fnmadd(op);
-        break;
+        return &PPC32Emulator::exec_FC_1F_fnmadd;
       default:
-        throw runtime_error("invalid FC subopcode");
+        return nullptr;
     }
   } else {
     switch (op_get_subopcode(op)) {
       case 0x000:
-        this->exec_FC_000_fcmpu(op);
-        break;
+        return &PPC32Emulator::exec_FC_000_fcmpu;
       case 0x00C:
-        this->exec_FC_00C_frsp(op);
-        break;
+        return &PPC32Emulator::exec_FC_00C_frsp;
       case 0x00E:
-        this->exec_FC_00E_fctiw(op);
-        break;
+        return &PPC32Emulator::exec_FC_00E_fctiw;
       case 0x00F:
-        this->exec_FC_00F_fctiwz(op);
-        break;
+        return &PPC32Emulator::exec_FC_00F_fctiwz;
       case 0x020:
-        this->exec_FC_020_fcmpo(op);
-        break;
+        return &PPC32Emulator::exec_FC_020_fcmpo;
       case 0x026:
-        this->exec_FC_026_mtfsb1(op);
-        break;
+        return &PPC32Emulator::exec_FC_026_mtfsb1;
       case 0x028:
-        this->exec_FC_028_fneg(op);
-        break;
+        return &PPC32Emulator::exec_FC_028_fneg;
       case 0x040:
-        this->exec_FC_040_mcrfs(op);
-        break;
+        return &PPC32Emulator::exec_FC_040_mcrfs;
       case 0x046:
-        this->exec_FC_046_mtfsb0(op);
-        break;
+        return &PPC32Emulator::exec_FC_046_mtfsb0;
       case 0x048:
-        this->exec_FC_048_fmr(op);
-        break;
+        return &PPC32Emulator::exec_FC_048_fmr;
       case 0x086:
-        this->exec_FC_086_mtfsfi(op);
-        break;
+        return &PPC32Emulator::exec_FC_086_mtfsfi;
       case 0x088:
-        this->exec_FC_088_fnabs(op);
-        break;
+        return &PPC32Emulator::exec_FC_088_fnabs;
       case 0x108:
-        this->exec_FC_108_fabs(op);
-        break;
+        return &PPC32Emulator::exec_FC_108_fabs;
       case 0x247:
-        this->exec_FC_247_mffs(op);
-        break;
+        return &PPC32Emulator::exec_FC_247_mffs;
       case 0x2C7:
-        this->exec_FC_2C7_mtfsf(op);
-        break;
+        return &PPC32Emulator::exec_FC_2C7_mtfsf;
       default:
-        throw runtime_error("invalid FC subopcode");
+        return nullptr;
     }
   }
 }
 
+void PPC32Emulator::exec_FC(uint32_t op) {
+  auto fn = PPC32Emulator::resolve_exec_FC(op);
+  if (!fn) {
+    throw runtime_error("invalid FC subopcode");
+  }
+  (this->*fn)(op);
+}
+
 string PPC32Emulator::dasm_FC(DisassemblyState& s, uint32_t op) {
   uint8_t short_sub = op_get_short_subopcode(op);
   if (short_sub & 0x10) {
@@ -6175,7 +6064,8 @@ void PPC32Emulator::Regs::set_crf_int_result(uint8_t crf_num, int32_t a) {
 }
 
 PPC32Emulator::PPC32Emulator(shared_ptr<MemoryContext> mem)
-    : EmulatorBase(mem) {}
+    : EmulatorBase(mem),
+      block_cache_enabled(true) {}
 
 void PPC32Emulator::import_state(FILE*) {
   throw runtime_error("PPC32Emulator::import_state is not implemented");
@@ -6201,26 +6091,162 @@ void PPC32Emulator::print_state(FILE* stream) const {
   }
 }
 
+PPC32Emulator::exec_fn PPC32Emulator::resolve_exec(uint32_t op) {
+  exec_fn fn = nullptr;
+  switch (op_get_op(op)) {
+    case 0x13:
+      fn = PPC32Emulator::resolve_exec_4C(op);
+      break;
+    case 0x1F:
+      fn = PPC32Emulator::resolve_exec_7C(op);
+      break;
+    case 0x3B:
+      fn = PPC32Emulator::resolve_exec_EC(op);
+      break;
+    case 0x3F:
+      fn = PPC32Emulator::resolve_exec_FC(op);
+      break;
+  }
+  // If the subopcode is invalid, use the top-level function, which will throw
+  // when the opcode is executed
+  return fn ? fn : PPC32Emulator::fns[op_get_op(op)].exec;
+}
+
+// Blocks are limited to this many opcodes
+static const size_t MAX_DECODED_BLOCK_OPCODES = 0x40;
+
+static bool opcode_ends_decoded_block(uint32_t op) {
+  switch (op_get_op(op)) {
+    case 0x10: // bc
+    case 0x11: // sc
+    case 0x12: // b
+    case 0x13: // bclr, bcctr, rfi, etc.
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool PPC32Emulator::revalidate_decoded_block(DecodedBlock& block) {
+  // If none of the pages containing the block's code were written, the block
+  // is still valid; otherwise, it's still valid if its code didn't change
+  uint64_t write_count = this->mem->watched_write_count();
+  uint64_t generation = this->mem->write_generation(block.start_pc, block.code.size());
+  if ((generation != block.validated_generation) &&
+      (!this->mem->exists(block.start_pc, block.code.size()) ||
+          this->mem->memcmp(block.start_pc, block.code.data(), block.code.size()))) {
+    return false;
+  }
+  block.validated_write_count = write_count;
+  block.validated_generation = generation;
+  return true;
+}
+
+PPC32Emulator::DecodedBlock* PPC32Emulator::get_decoded_block(uint32_t pc) {
+  auto it = this->block_cache.find(pc);
+  if (it != this->block_cache.end()) {
+    auto& block = it->second;
+    if ((block.validated_write_count == this->mem->watched_write_count()) ||
+        this->revalidate_decoded_block(block)) {
+      return &block;
+    }
+    this->block_cache.erase(it);
+  }
+
+  DecodedBlock block;
+  block.start_pc = pc;
+  while (block.instructions.size() < MAX_DECODED_BLOCK_OPCODES) {
+    uint32_t addr = pc + 4 * block.instructions.size();
+    if (!this->mem->exists(addr, 4)) {
+      break;
+    }
+    uint32_t op = this->mem->read_u32b(addr);
+    block.instructions.emplace_back(DecodedInstruction{op, PPC32Emulator::resolve_exec(op)});
+    if (opcode_ends_decoded_block(op)) {
+      break;
+    }
+  }
+  if (block.instructions.empty()) {
+    return nullptr;
+  }
+  block.code = this->mem->read(pc, 4 * block.instructions.size());
+
+  this->mem->watch_for_writes(pc, block.code.size());
+  block.validated_write_count = this->mem->watched_write_count();
+  block.validated_generation = this->mem->write_generation(pc, block.code.size());
+  return &this->block_cache.insert_or_assign(pc, std::move(block)).first->second;
+}
+
+void PPC32Emulator::execute_one() {
+  uint32_t full_op = this->mem->read<be_uint32_t>(this->regs.pc);
+  uint8_t op = op_get_op(full_op);
+  auto fn = this->fns[op].exec;
+  (this->*fn)(full_op);
+  this->regs.pc += 4;
+  this->regs.tbr += this->regs.tbr_ticks_per_cycle;
+  this->instructions_executed++;
+}
+
 void PPC32Emulator::execute() {
   if (!this->interrupt_manager.get()) {
     this->interrupt_manager = make_shared<InterruptManager>();
   }
 
+  bool cycle_started = false;
   for (;;) {
     try {
-      if (this->debug_hook) {
-        this->debug_hook(*this);
+      // The block cache is bypassed entirely when a debug hook is set, so
+      // the hook is called before every instruction
+      if (this->debug_hook || !this->block_cache_enabled) {
+        if (this->debug_hook) {
+          this->debug_hook(*this);
+        }
+
+        if (!cycle_started) {
+          this->interrupt_manager->on_cycle_start();
+        }
+        cycle_started = false;
+
+        this->execute_one();
+        continue;
       }
 
-      this->interrupt_manager->on_cycle_start();
+      if (!cycle_started) {
+        this->interrupt_manager->on_cycle_start();
+      }
+      cycle_started = false;
 
-      uint32_t full_op = this->mem->read<be_uint32_t>(this->regs.pc);
-      uint8_t op = op_get_op(full_op);
-      auto fn = this->fns[op].exec;
-      (this->*fn)(full_op);
-      this->regs.pc += 4;
-      this->regs.tbr += this->regs.tbr_ticks_per_cycle;
-      this->instructions_executed++;
+      auto* block = this->get_decoded_block(this->regs.pc);
+      if (!block) {
+        this->execute_one();
+        continue;
+      }
+
+      // Run instructions from the block until it ends, the PC goes somewhere
+      // other than the next instruction in the block (e.g. a taken branch),
+      // or the block's code was modified. Writes to other watched pages don't
+      // affect this block, so they only cost a check of this block's pages.
+      uint32_t block_pc = this->regs.pc;
+      size_t num_instructions = block->instructions.size();
+      for (size_t z = 0;;) {
+        const auto& inst = block->instructions[z];
+        (this->*inst.exec)(inst.op);
+        this->regs.pc += 4;
+        this->regs.tbr += this->regs.tbr_ticks_per_cycle;
+        this->instructions_executed++;
+
+        if (++z >= num_instructions) {
+          break;
+        }
+        this->interrupt_manager->on_cycle_start();
+        if ((this->regs.pc != block_pc + 4 * z) ||
+            ((this->mem->watched_write_count() != block->validated_write_count) &&
+                !this->revalidate_decoded_block(*block)) ||
+            this->debug_hook) {
+          cycle_started = true;
+          break;
+        }
+      }
 
     } catch (const terminate_emulation&) {
       break;
@@ -8,6 +8,8 @@
 #include <memory>
 #include <phosg/Strings.hh>
 #include <set>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "EmulatorBase.hh"
@@ -141,6 +143,13 @@ public:
     this->interrupt_manager = im;
   }
 
+  // The block cache is enabled by default. Disabling it makes execution much
+  // slower, but can be useful when debugging the emulator itself. (The cache
+  // is never used while a debug hook is set, regardless of this setting.)
+  inline void set_block_cache_enabled(bool enabled) {
+    this->block_cache_enabled = enabled;
+  }
+
   virtual void execute();
 
   static std::string disassemble_one(uint32_t pc, uint32_t op);
@@ -179,12 +188,43 @@ private:
     const std::vector<std::string>* import_names;
   };
 
+  typedef void (PPC32Emulator::*exec_fn)(uint32_t);
   struct OpcodeImplementation {
-    void (PPC32Emulator::*exec)(uint32_t);
+    exec_fn exec;
     std::string (*dasm)(DisassemblyState&, uint32_t);
   };
   static const OpcodeImplementation fns[0x40];
 
+  // Returns the function that implements the given opcode. For opcodes with
+  // subopcodes (4C, 7C, EC, FC), this is the function for the specific
+  // subopcode, so no further dispatch is needed when it's called.
+  static exec_fn resolve_exec(uint32_t op);
+
+  // Straight-line runs of instructions are decoded once into blocks of
+  // (opcode, function) pairs, which execute() then runs without reading each
+  // opcode from memory or dispatching on it again. Blocks are revalidated
+  // against memory when their code may have been modified (see
+  // MemoryContext::watch_for_writes).
+  struct DecodedInstruction {
+    uint32_t op;
+    exec_fn exec;
+  };
+  struct DecodedBlock {
+    uint32_t start_pc;
+    std::string code;
+    std::vector<DecodedInstruction> instructions;
+    // The values of mem->watched_write_count() and mem->write_generation()
+    // for the block's code when the block was last known to match memory
+    uint64_t validated_write_count;
+    uint64_t validated_generation;
+  };
+  bool block_cache_enabled;
+  std::unordered_map<uint32_t, DecodedBlock> block_cache;
+
+  DecodedBlock* get_decoded_block(uint32_t pc);
+  bool revalidate_decoded_block(DecodedBlock& block);
+  void execute_one();
+
   static std::string disassemble_one(DisassemblyState& s, uint32_t op);
 
   bool should_branch(uint32_t op);
@@ -216,6 +256,7 @@ private:
   static std::string dasm_44_sc(DisassemblyState& s, uint32_t op);
   void exec_48_b(uint32_t op);
   static std::string dasm_48_b(DisassemblyState& s, uint32_t op);
+  static exec_fn resolve_exec_4C(uint32_t op);
   void exec_4C(uint32_t op);
   static std::string dasm_4C(DisassemblyState& s, uint32_t op);
   void exec_4C_000_mcrf(uint32_t op);
@@ -261,6 +302,7 @@ private:
   static std::string dasm_70_andi_rec(DisassemblyState& s, uint32_t op);
   void exec_74_andis_rec(uint32_t op);
   static std::string dasm_74_andis_rec(DisassemblyState& s, uint32_t op);
+  static exec_fn resolve_exec_7C(uint32_t op);
   void exec_7C(uint32_t op);
   static std::string dasm_7C(DisassemblyState& s, uint32_t op);
   static std::string dasm_7C_a_b(uint32_t op, const char* base_name);
@@ -493,6 +535,7 @@ private:
   static std::string dasm_D0_D4_stfs_stfsu(DisassemblyState& s, uint32_t op);
   void exec_D8_DC_stfd_stfdu(uint32_t op);
   static std::string dasm_D8_DC_stfd_stfdu(DisassemblyState& s, uint32_t op);
+  static exec_fn resolve_exec_EC(uint32_t op);
   void exec_EC(uint32_t op);
   static std::string dasm_EC(DisassemblyState& s, uint32_t op);
   static std::string dasm_EC_FC_d_b_r(uint32_t op, const char* base_name);
@@ -519,6 +562,7 @@ private:
   static std::string dasm_EC_1E_fnmsubs(DisassemblyState& s, uint32_t op);
   void exec_EC_1F_fnmadds(uint32_t op);
   static std::string dasm_EC_1F_fnmadds(DisassemblyState& s, uint32_t op);
+  static exec_fn resolve_exec_FC(uint32_t op);
   void exec_FC(uint32_t op);
   static std::string dasm_FC(DisassemblyState& s, uint32_t op);
   void exec_FC_12_fdiv(uint32_t op);
@@ -0,0 +1,297 @@
+#include "GCMImage.hh"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include <functional>
+#include <phosg/Encoding.hh>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace phosg;
+
+namespace ResourceDASM {
+
+struct ApploaderHeader {
+  char date[0x10];
+  be_uint32_t entrypoint;
+  be_uint32_t size;
+  be_uint32_t trailer_size;
+  be_uint32_t unknown_a1;
+  // Apploader code follows immediately (loaded to 0x81200000)
+} __attribute__((packed));
+
+struct GCMHeader {
+  be_uint32_t game_id;
+  be_uint16_t company_id;
+  uint8_t disk_id;
+  uint8_t version;
+  uint8_t audio_streaming;
+  uint8_t stream_buffer_size;
+  uint8_t unused1[0x0E];
+  be_uint32_t wii_magic;
+  be_uint32_t gc_magic;
+  char name[0x03E0];
+  be_uint32_t debug_offset;
+  be_uint32_t debug_addr;
+  uint8_t unused2[0x18];
+  be_uint32_t dol_offset;
+  be_uint32_t fst_offset;
+  be_uint32_t fst_size;
+  be_uint32_t fst_max_size;
+} __attribute__((packed));
+
+struct TGCHeader {
+  be_uint32_t magic;
+  be_uint32_t unknown1;
+  be_uint32_t header_size;
+  be_uint32_t unknown2;
+  be_uint32_t fst_offset;
+  be_uint32_t fst_size;
+  be_uint32_t fst_max_size;
+  be_uint32_t dol_offset;
+  be_uint32_t dol_size;
+  be_uint32_t file_area;
+  be_uint32_t file_area_size;
+  be_uint32_t banner_offset;
+  be_uint32_t banner_size;
+  be_uint32_t file_offset_base;
+} __attribute__((packed));
+
+union ImageHeader {
+  GCMHeader gcm;
+  TGCHeader tgc;
+} __attribute__((packed));
+
+struct DOLHeader {
+  // Sections 0-6 are text; the rest (7-17) are data
+  be_uint32_t section_offset[18];
+  be_uint32_t section_address[18];
+  be_uint32_t section_size[18];
+  be_uint32_t bss_address;
+  be_uint32_t bss_size;
+  be_uint32_t entry_point;
+  be_uint32_t unused[7];
+} __attribute__((packed));
+
+union FSTEntry {
+  struct {
+    be_uint32_t dir_flag_string_offset;
+    be_uint32_t parent_offset;
+    be_uint32_t num_entries;
+  } __attribute__((packed)) root;
+  struct {
+    be_uint32_t dir_flag_string_offset;
+    be_uint32_t parent_offset;
+    be_uint32_t next_offset;
+  } __attribute__((packed)) dir;
+  struct {
+    be_uint32_t dir_flag_string_offset;
+    be_uint32_t file_offset;
+    be_uint32_t file_size;
+  } __attribute__((packed)) file;
+
+  bool is_dir() const {
+    return this->file.dir_flag_string_offset & 0xFF000000;
+  }
+  uint32_t string_offset() const {
+    return this->file.dir_flag_string_offset & 0x00FFFFFF;
+  }
+} __attribute__((packed));
+
+static uint32_t dol_file_size(const DOLHeader& dol) {
+  uint32_t max_offset = sizeof(DOLHeader);
+  for (size_t x = 0; x < 18; x++) {
+    max_offset = max<uint32_t>(max_offset, dol.section_offset[x] + dol.section_size[x]);
+  }
+  return max_offset;
+}
+
+GCMImage::GCMImage(shared_ptr<const MappedFile> file)
+    : file(file),
+      image_format(Format::GCM) {
+  this->parse(true);
+}
+
+GCMImage::GCMImage(shared_ptr<const MappedFile> file, Format format)
+    : file(file),
+      image_format(format) {
+  this->parse(false);
+}
+
+GCMImage::GCMImage(const string& filename)
+    : GCMImage(make_shared<MappedFile>(filename)) {}
+
+void GCMImage::parse(bool detect_format) {
+  const auto& header = *reinterpret_cast<const ImageHeader*>(this->file->at(0, sizeof(ImageHeader)));
+  if (detect_format) {
+    if (header.gcm.gc_magic == 0xC2339F3D) {
+      this->image_format = Format::GCM;
+    } else if (header.tgc.magic == 0xAE0F38A2) {
+      this->image_format = Format::TGC;
+    } else {
+      throw runtime_error("cannot determine disc image format");
+    }
+  }
+
+  uint64_t gcm_offset, fst_offset, fst_size, dol_offset;
+  int64_t base_offset;
+  if (this->image_format == Format::GCM) {
+    this->image_name.assign(header.gcm.name, strnlen(header.gcm.name, sizeof(header.gcm.name)));
+    gcm_offset = 0;
+    fst_offset = header.gcm.fst_offset;
+    fst_size = header.gcm.fst_size;
+    base_offset = 0;
+    dol_offset = header.gcm.dol_offset;
+  } else {
+    gcm_offset = header.tgc.header_size;
+    fst_offset = header.tgc.fst_offset;
+    fst_size = header.tgc.fst_size;
+    base_offset = static_cast<int64_t>(header.tgc.file_area) - static_cast<int64_t>(header.tgc.file_offset_base);
+    dol_offset = header.tgc.dol_offset;
+  }
+
+  // Each system file is only included if it's entirely within the image, so
+  // open() can't fail for them later
+  auto add_system_entry = [&](const char* name, function<Entry()> make_entry) -> void {
+    try {
+      auto e = make_entry();
+      this->file->at(e.offset, e.size);
+      this->system_entries.emplace_back(std::move(e));
+    } catch (const exception& e) {
+      this->parse_warnings.emplace_back(std::format("{}: {}", name, e.what()));
+    }
+  };
+  add_system_entry("__gcm_header__.bin", [&]() -> Entry {
+    return Entry{"__gcm_header__.bin", gcm_offset, 0x2440, false, 0, {}};
+  });
+  add_system_entry("apploader.bin", [&]() -> Entry {
+    const auto& apploader = *reinterpret_cast<const ApploaderHeader*>(
+        this->file->at(gcm_offset + 0x2440, sizeof(ApploaderHeader)));
+    uint64_t apploader_size = sizeof(ApploaderHeader) + apploader.size + apploader.trailer_size;
+    return Entry{"apploader.bin", gcm_offset + 0x2440, static_cast<uint32_t>(apploader_size), false, 0, {}};
+  });
+  add_system_entry("default.dol", [&]() -> Entry {
+    uint64_t dol_size = dol_file_size(*reinterpret_cast<const DOLHeader*>(this->file->at(dol_offset, sizeof(DOLHeader))));
+    return Entry{"default.dol", dol_offset, static_cast<uint32_t>(dol_size), false, 0, {}};
+  });
+  add_system_entry("fst.bin", [&]() -> Entry {
+    return Entry{"fst.bin", fst_offset, static_cast<uint32_t>(fst_size), false, 0, {}};
+  });
+
+  try {
+    this->parse_fst(fst_offset, fst_size, base_offset);
+  } catch (const exception& e) {
+    this->parse_warnings.emplace_back(std::format("file system table: {}", e.what()));
+  }
+
+  this->path_to_entry_index.reserve(this->fs_entries.size());
+  for (size_t z = 0; z < this->fs_entries.size(); z++) {
+    this->path_to_entry_index.emplace(this->fs_entries[z].path, z);
+  }
+}
+
+void GCMImage::parse_fst(uint64_t fst_offset, uint64_t fst_size, int64_t base_offset) {
+  if (fst_size < sizeof(FSTEntry)) {
+    throw runtime_error("file system table is too small");
+  }
+  const auto* fst = reinterpret_cast<const FSTEntry*>(this->file->at(fst_offset, fst_size));
+  // The root entry counts itself, so there is always at least one entry
+  size_t num_entries = fst[0].root.num_entries;
+  if (num_entries == 0) {
+    throw runtime_error("file system table has no root entry");
+  }
+  if (num_entries > fst_size / sizeof(FSTEntry)) {
+    throw runtime_error("file system table entries extend beyond end of table");
+  }
+  const char* string_table = reinterpret_cast<const char*>(fst + num_entries);
+  size_t string_table_size = fst_size - (num_entries * sizeof(FSTEntry));
+  auto get_name = [&](const FSTEntry& e) -> string {
+    size_t offset = e.string_offset();
+    if (offset >= string_table_size) {
+      throw runtime_error("file system entry name is beyond end of string table");
+    }
+    return string(&string_table[offset], strnlen(&string_table[offset], string_table_size - offset));
+  };
+
+  auto raw_words = [](const FSTEntry& e) -> array<uint32_t, 3> {
+    return {e.file.dir_flag_string_offset.load(), e.file.file_offset.load(), e.file.file_size.load()};
+  };
+
+  // Each directory's entry gives the index of the first entry after its
+  // contents, so the current path is the set of directories whose ends are
+  // after the current index. If an entry is invalid, it's skipped; if it's a
+  // directory, its contents are skipped too, since their paths are unknown.
+  vector<pair<size_t, string>> dir_stack; // (end index, path prefix)
+  this->fs_entries.reserve(num_entries - 1);
+  for (size_t x = 1; x < num_entries; x++) {
+    while (!dir_stack.empty() && (dir_stack.back().first <= x)) {
+      dir_stack.pop_back();
+    }
+    const auto& e = fst[x];
+    try {
+      if (e.is_dir()) {
+        size_t end_index = e.dir.next_offset;
+        if ((end_index <= x) || (end_index > num_entries)) {
+          // The contents can't be found, so there's nothing to skip
+          throw runtime_error("directory has invalid end index");
+        }
+        try {
+          string path = dir_stack.empty() ? get_name(e) : (dir_stack.back().second + get_name(e));
+          dir_stack.emplace_back(end_index, path + "/");
+          this->fs_entries.emplace_back(Entry{std::move(path), 0, 0, true, x, raw_words(e)});
+        } catch (const exception&) {
+          x = end_index - 1;
+          throw;
+        }
+      } else {
+        string path = dir_stack.empty() ? get_name(e) : (dir_stack.back().second + get_name(e));
+        int64_t offset = static_cast<int64_t>(e.file.file_offset) + base_offset;
+        if (offset < 0) {
+          throw runtime_error("file has negative offset");
+        }
+        this->fs_entries.emplace_back(Entry{
+            std::move(path), static_cast<uint64_t>(offset), e.file.file_size, false, x, raw_words(e)});
+      }
+    } catch (const exception& ex) {
+      this->parse_warnings.emplace_back(std::format("file system entry {:08X}: {}", x, ex.what()));
+    }
+  }
+}
+
+bool GCMImage::exists(const string& path) const {
+  return this->path_to_entry_index.count(path);
+}
+
+const GCMImage::Entry& GCMImage::entry(const string& path) const {
+  return this->fs_entries[this->path_to_entry_index.at(path)];
+}
+
+string_view GCMImage::open(const string& path) const {
+  return this->open(this->entry(path));
+}
+
+string_view GCMImage::open(const Entry& entry) const {
+  if (entry.is_directory) {
+    throw out_of_range("entry is a directory");
+  }
+  return string_view(reinterpret_cast<const char*>(this->file->at(entry.offset, entry.size)), entry.size);
+}
+
+StringReader GCMImage::open_reader(const string& path) const {
+  auto data = this->open(path);
+  return StringReader(data.data(), data.size());
+}
+
+string GCMImage::read(const string& path) const {
+  return string(this->open(path));
+}
+
+} // namespace ResourceDASM
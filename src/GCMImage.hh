@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <memory>
+#include <phosg/Strings.hh>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.hh"
+
+namespace ResourceDASM {
+
+// A GameCube disc image (GCM), or a disc image embedded in another disc's file
+// system (TGC). The image's header and file system table (FST) are parsed once
+// when the GCMImage is constructed; after that, any file can be looked up by
+// its path in constant time, and its contents can be read directly from the
+// mapped image without copying. All functions may be called from multiple
+// threads at the same time.
+//
+// The constructor only fails if the image's header can't be read. If a system
+// file (see system_files()), the FST, or an entry in the FST is invalid, it's
+// omitted (along with the entries in it, if it's a directory or the FST), and
+// a description of the problem is added to warnings().
+class GCMImage {
+public:
+  enum class Format {
+    GCM = 0,
+    TGC,
+  };
+
+  struct Entry {
+    // Relative to the root directory, with components separated by '/' (for
+    // example, "scene/map_city00.rel"). Names are not sanitized, so they may
+    // contain non-ASCII characters.
+    std::string path;
+    uint64_t offset; // Offset of the file's data within the image
+    uint32_t size;
+    bool is_directory; // If true, offset and size are zero
+    // For entries from the FST, the entry's index and its raw words (flags and
+    // name offset, offset or parent, size or end index); zero for system files
+    size_t fst_index;
+    std::array<uint32_t, 3> fst_words;
+  };
+
+  // Determines the image's format from its header
+  explicit GCMImage(std::shared_ptr<const MappedFile> file);
+  GCMImage(std::shared_ptr<const MappedFile> file, Format format);
+  explicit GCMImage(const std::string& filename);
+  GCMImage(const GCMImage&) = delete;
+  GCMImage(GCMImage&&) = default;
+  GCMImage& operator=(const GCMImage&) = delete;
+  GCMImage& operator=(GCMImage&&) = default;
+  ~GCMImage() = default;
+
+  inline Format format() const {
+    return this->image_format;
+  }
+  // The game's name from the disc header; empty for TGC images
+  inline const std::string& name() const {
+    return this->image_name;
+  }
+  inline std::shared_ptr<const MappedFile> mapped_file() const {
+    return this->file;
+  }
+
+  // All files and directories in the FST, in the order they appear in the
+  // FST. Each directory appears before its contents.
+  inline const std::vector<Entry>& entries() const {
+    return this->fs_entries;
+  }
+  // The parts of the image that aren't in the file system, named as gcmdump
+  // names them: __gcm_header__.bin, apploader.bin, default.dol, and fst.bin
+  inline const std::vector<Entry>& system_files() const {
+    return this->system_entries;
+  }
+  inline const std::vector<std::string>& warnings() const {
+    return this->parse_warnings;
+  }
+
+  bool exists(const std::string& path) const;
+  // Throws out_of_range if there's no file or directory at path
+  const Entry& entry(const std::string& path) const;
+
+  // Returns the contents of a file. The returned data points into the mapped
+  // image, so it's valid as long as the GCMImage exists. Throws out_of_range if
+  // there's no such file, or if path refers to a directory.
+  std::string_view open(const std::string& path) const;
+  std::string_view open(const Entry& entry) const;
+  // Like open(), but returns a reader, for parsing the file's contents
+  phosg::StringReader open_reader(const std::string& path) const;
+  // Like open(), but returns a copy of the data
+  std::string read(const std::string& path) const;
+
+private:
+  std::shared_ptr<const MappedFile> file;
+  Format image_format;
+  std::string image_name;
+  std::vector<Entry> fs_entries;
+  std::vector<Entry> system_entries;
+  std::unordered_map<std::string, size_t> path_to_entry_index;
+  std::vector<std::string> parse_warnings;
+
+  void parse(bool detect_format);
+  void parse_fst(uint64_t fst_offset, uint64_t fst_size, int64_t base_offset);
+};
+
+} // namespace ResourceDASM
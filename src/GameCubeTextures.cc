@@ -0,0 +1,385 @@
+#include "GameCubeTextures.hh"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include <phosg/Encoding.hh>
+#include <phosg/Image.hh>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace phosg;
+
+namespace ResourceDASM {
+
+enum GVRDataFlag {
+  HAS_MIPMAPS = 0x01,
+  HAS_EXTERNAL_COLOR_TABLE = 0x02,
+  HAS_INTERNAL_COLOR_TABLE = 0x08,
+  DATA_FLAG_MASK = 0x0F,
+};
+
+uint32_t decode_rgb5a3(uint16_t c) {
+  if (c & 0x8000) { // RGB555
+    //                 1rrrrrgggggbbbbb
+    // rrrrrrrrggggggggbbbbbbbbaaaaaaaa
+    return ((c << 17) & 0xF8000000) | ((c << 12) & 0x07000000) | // R
+        ((c << 14) & 0x00F80000) | ((c << 9) & 0x00070000) | // G
+        ((c << 11) & 0x0000F800) | ((c << 6) & 0x00000700) | // B
+        0x000000FF; // A
+  } else { // ARGB3444
+    //                 0aaarrrrggggbbbb
+    // rrrrrrrrggggggggbbbbbbbbaaaaaaaa
+    return ((c << 20) & 0xF0000000) | // R high
+        ((c << 16) & 0x0FF00000) | // R low and G high
+        ((c << 12) & 0x000FF000) | // G low and B high
+        ((c << 8) & 0x00000F00) | // B low
+        ((c >> 7) & 0x000000E0) | ((c >> 10) & 0x0000001C) | ((c >> 13) & 0x00000003); // A
+  }
+}
+
+uint32_t decode_rgb565(uint16_t c) {
+  //                 rrrrrggggggbbbbb
+  // rrrrrrrrggggggggbbbbbbbbaaaaaaaa
+  return ((c << 16) & 0xF8000000) | ((c << 11) & 0x07000000) | // R
+      ((c << 13) & 0x00FC0000) | ((c << 7) & 0x00030000) | // G
+      ((c << 11) & 0x0000F800) | ((c << 6) & 0x00000700) | // B
+      0x000000FF; // A
+}
+
+// The tile decoders below each decode an entire 32-byte tile into a local
+// array of pixels. Their inner loops have fixed trip counts and no branches or
+// bounds checks (the data size is checked once for the whole texture), so the
+// compiler can unroll and vectorize them.
+
+static inline uint16_t tile_u16b(const uint8_t* data, size_t index) {
+  return (data[index * 2] << 8) | data[index * 2 + 1];
+}
+
+static void decode_tile_i4(uint32_t* pixels, const uint8_t* data) {
+  for (size_t z = 0; z < 0x20; z++) {
+    uint32_t v1 = ((data[z] >> 4) & 0x0F) * 0x11;
+    uint32_t v2 = (data[z] & 0x0F) * 0x11;
+    pixels[z * 2] = (v1 * 0x01010100) | 0xFF;
+    pixels[z * 2 + 1] = (v2 * 0x01010100) | 0xFF;
+  }
+}
+
+static void decode_tile_i8(uint32_t* pixels, const uint8_t* data) {
+  for (size_t z = 0; z < 0x20; z++) {
+    pixels[z] = (data[z] * 0x01010100) | 0xFF;
+  }
+}
+
+static void decode_tile_rgb5a3(uint32_t* pixels, const uint8_t* data) {
+  // This is the same as decode_rgb5a3, but computes both possible results and
+  // selects one with a mask instead of branching
+  for (size_t z = 0; z < 0x10; z++) {
+    uint32_t c = tile_u16b(data, z);
+    uint32_t rgb555 = ((c << 17) & 0xF8000000) | ((c << 12) & 0x07000000) |
+        ((c << 14) & 0x00F80000) | ((c << 9) & 0x00070000) |
+        ((c << 11) & 0x0000F800) | ((c << 6) & 0x00000700) |
+        0x000000FF;
+    uint32_t argb3444 = ((c << 20) & 0xF0000000) | ((c << 16) & 0x0FF00000) |
+        ((c << 12) & 0x000FF000) | ((c << 8) & 0x00000F00) |
+        ((c >> 7) & 0x000000E0) | ((c >> 10) & 0x0000001C) | ((c >> 13) & 0x00000003);
+    uint32_t mask = -(c >> 15);
+    pixels[z] = (rgb555 & mask) | (argb3444 & ~mask);
+  }
+}
+
+// The palette always has 256 entries, so lookups don't need to be bounds
+// checked individually. If the real color table is smaller than that, the
+// caller checks each tile's indexes against its size separately.
+using Palette = array<uint32_t, 0x100>;
+
+static void decode_tile_c4(uint32_t* pixels, const uint8_t* data, const Palette& palette) {
+  for (size_t z = 0; z < 0x20; z++) {
+    pixels[z * 2] = palette[(data[z] >> 4) & 0x0F];
+    pixels[z * 2 + 1] = palette[data[z] & 0x0F];
+  }
+}
+
+static void decode_tile_c8(uint32_t* pixels, const uint8_t* data, const Palette& palette) {
+  for (size_t z = 0; z < 0x20; z++) {
+    pixels[z] = palette[data[z]];
+  }
+}
+
+static uint8_t max_index_c4(const uint8_t* data) {
+  uint8_t ret = 0;
+  for (size_t z = 0; z < 0x20; z++) {
+    ret = max<uint8_t>(ret, max<uint8_t>((data[z] >> 4) & 0x0F, data[z] & 0x0F));
+  }
+  return ret;
+}
+
+static uint8_t max_index_c8(const uint8_t* data) {
+  uint8_t ret = 0;
+  for (size_t z = 0; z < 0x20; z++) {
+    ret = max<uint8_t>(ret, data[z]);
+  }
+  return ret;
+}
+
+static void decode_dxt1_block(uint32_t* pixels, size_t stride, const uint8_t* data) {
+  uint16_t color1 = tile_u16b(data, 0); // RGB565
+  uint16_t color2 = tile_u16b(data, 1); // RGB565
+
+  uint32_t color_table[4];
+  color_table[0] = rgba8888(
+      ((color1 >> 8) & 0xF8) | ((color1 >> 13) & 0x07),
+      ((color1 >> 3) & 0xFC) | ((color1 >> 9) & 0x03),
+      ((color1 << 3) & 0xF8) | ((color1 >> 2) & 0x07),
+      0xFF);
+  color_table[1] = rgba8888(
+      ((color2 >> 8) & 0xF8) | ((color2 >> 13) & 0x07),
+      ((color2 >> 3) & 0xFC) | ((color2 >> 9) & 0x03),
+      ((color2 << 3) & 0xF8) | ((color2 >> 2) & 0x07),
+      0xFF);
+  if (color1 > color2) {
+    color_table[2] = rgba8888(
+        (((get_r(color_table[0]) * 2) + get_r(color_table[1])) / 3),
+        (((get_g(color_table[0]) * 2) + get_g(color_table[1])) / 3),
+        (((get_b(color_table[0]) * 2) + get_b(color_table[1])) / 3),
+        0xFF);
+    color_table[3] = rgba8888(
+        (((get_r(color_table[1]) * 2) + get_r(color_table[0])) / 3),
+        (((get_g(color_table[1]) * 2) + get_g(color_table[0])) / 3),
+        (((get_b(color_table[1]) * 2) + get_b(color_table[0])) / 3),
+        0xFF);
+  } else {
+    color_table[2] = rgba8888(
+        ((get_r(color_table[0]) + get_r(color_table[1])) / 2),
+        ((get_g(color_table[0]) + get_g(color_table[1])) / 2),
+        ((get_b(color_table[0]) + get_b(color_table[1])) / 2),
+        0xFF);
+    color_table[3] = 0x00000000;
+  }
+
+  for (size_t y = 0; y < 4; y++) {
+    uint8_t row = data[4 + y];
+    for (size_t x = 0; x < 4; x++) {
+      pixels[y * stride + x] = color_table[(row >> (6 - (x * 2))) & 3];
+    }
+  }
+}
+
+static void decode_tile_cmpr(uint32_t* pixels, const uint8_t* data) {
+  // Each tile is four 8-byte DXT1 blocks, in the order top-left, top-right,
+  // bottom-left, bottom-right. The blocks are independent of each other.
+  decode_dxt1_block(pixels, 8, data);
+  decode_dxt1_block(pixels + 4, 8, data + 8);
+  decode_dxt1_block(pixels + 32, 8, data + 16);
+  decode_dxt1_block(pixels + 36, 8, data + 24);
+}
+
+// Calls decode_tile for each tile in the texture, and copies the decoded
+// pixels into the image, clipping tiles at the right and bottom edges. If the
+// data ends before the last tile, the remaining tiles are filled with zeroes
+// (transparent black) and counted in missing_tiles.
+template <size_t TileWidth, size_t TileHeight, typename DecodeTileT>
+static DecodedGCTexture decode_tiles(const uint8_t* data, size_t size, size_t width, size_t height, DecodeTileT&& decode_tile) {
+  DecodedGCTexture ret{ImageRGBA8888N(width, height, true), 0};
+  size_t num_tiles = size / 0x20;
+  uint32_t pixels[TileWidth * TileHeight];
+  for (size_t y = 0; y < height; y += TileHeight) {
+    size_t copy_height = min<size_t>(TileHeight, height - y);
+    for (size_t x = 0; x < width; x += TileWidth) {
+      if (num_tiles == 0) {
+        memset(pixels, 0, sizeof(pixels));
+        ret.missing_tiles++;
+      } else {
+        decode_tile(pixels, data);
+        data += 0x20;
+        num_tiles--;
+      }
+      size_t copy_width = min<size_t>(TileWidth, width - x);
+      for (size_t yy = 0; yy < copy_height; yy++) {
+        const uint32_t* row = &pixels[yy * TileWidth];
+        for (size_t xx = 0; xx < copy_width; xx++) {
+          ret.image.write(x + xx, y + yy, row[xx]);
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+size_t gc_texture_data_size(GCTextureFormat format, size_t width, size_t height) {
+  size_t tile_width, tile_height;
+  switch (format) {
+    case GCTextureFormat::I4:
+    case GCTextureFormat::C4:
+    case GCTextureFormat::CMPR:
+      tile_width = 8;
+      tile_height = 8;
+      break;
+    case GCTextureFormat::I8:
+    case GCTextureFormat::C8:
+      tile_width = 8;
+      tile_height = 4;
+      break;
+    case GCTextureFormat::RGB5A3:
+      tile_width = 4;
+      tile_height = 4;
+      break;
+    default:
+      throw logic_error("invalid texture format");
+  }
+  return ((width + tile_width - 1) / tile_width) * ((height + tile_height - 1) / tile_height) * 0x20;
+}
+
+DecodedGCTexture decode_gc_texture(
+    GCTextureFormat format,
+    const void* data,
+    size_t size,
+    size_t width,
+    size_t height,
+    const vector<uint32_t>* clut) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+
+  Palette palette;
+  palette.fill(0);
+  size_t clut_size = 0;
+  if ((format == GCTextureFormat::C4) || (format == GCTextureFormat::C8)) {
+    if (!clut) {
+      throw runtime_error("a color table is required");
+    }
+    clut_size = min<size_t>(clut->size(), palette.size());
+    memcpy(palette.data(), clut->data(), clut_size * sizeof(uint32_t));
+  }
+  switch (format) {
+    case GCTextureFormat::I4:
+      return decode_tiles<8, 8>(bytes, size, width, height, decode_tile_i4);
+    case GCTextureFormat::I8:
+      return decode_tiles<8, 4>(bytes, size, width, height, decode_tile_i8);
+    case GCTextureFormat::RGB5A3:
+      return decode_tiles<4, 4>(bytes, size, width, height, decode_tile_rgb5a3);
+    case GCTextureFormat::C4:
+      return decode_tiles<8, 8>(bytes, size, width, height, [&](uint32_t* pixels, const uint8_t* tile_data) -> void {
+        if ((clut_size < 0x10) && (max_index_c4(tile_data) >= clut_size)) {
+          throw out_of_range("color index is beyond end of color table");
+        }
+        decode_tile_c4(pixels, tile_data, palette);
+      });
+    case GCTextureFormat::C8:
+      return decode_tiles<8, 4>(bytes, size, width, height, [&](uint32_t* pixels, const uint8_t* tile_data) -> void {
+        if ((clut_size < 0x100) && (max_index_c8(tile_data) >= clut_size)) {
+          throw out_of_range("color index is beyond end of color table");
+        }
+        decode_tile_c8(pixels, tile_data, palette);
+      });
+    case GCTextureFormat::CMPR:
+      return decode_tiles<8, 8>(bytes, size, width, height, decode_tile_cmpr);
+    default:
+      throw logic_error("invalid texture format");
+  }
+}
+
+vector<uint32_t> decode_gvp(const string& data) {
+  StringReader r(data.data(), data.size());
+  auto header = r.get<GVPHeader>();
+  if (header.magic != 0x4756504C) {
+    throw runtime_error("GVPL signature is missing");
+  }
+
+  vector<uint32_t> ret;
+  ret.reserve(header.num_entries);
+  while (ret.size() < header.num_entries) {
+    switch (header.entry_format) {
+      case 0: {
+        uint8_t a = r.get_u8();
+        ret.emplace_back((a << 24) | (a << 16) | (a << 8) | a);
+        break;
+      }
+      case 1:
+        ret.emplace_back(decode_rgb565(r.get_u16b()));
+        break;
+      case 2:
+        ret.emplace_back(decode_rgb5a3(r.get_u16b()));
+        break;
+      default:
+        throw runtime_error("unknown color table entry format");
+    }
+  }
+
+  return ret;
+}
+
+DecodedGVR decode_gvr(const string& data, const vector<uint32_t>* clut) {
+  if (data.size() < sizeof(GVRHeader)) {
+    throw runtime_error("data too small for header");
+  }
+
+  const auto& header = *reinterpret_cast<const GVRHeader*>(data.data());
+  if (header.magic != 0x47565254) {
+    throw runtime_error("GVRT signature is missing");
+  }
+  size_t end_offset = header.data_size + 8;
+  if ((data.size() < end_offset) || (end_offset < sizeof(GVRHeader))) {
+    throw runtime_error("data size is too small");
+  }
+
+  // TODO: deal with GBIX if needed
+
+  // TODO: deal with color table if needed. If present, the color table
+  // immediately follows the header and precedes the data
+  if ((header.data_format == GVRDataFormat::INDEXED_4) ||
+      (header.data_format == GVRDataFormat::INDEXED_8)) {
+    if (header.format_flags & GVRDataFlag::HAS_EXTERNAL_COLOR_TABLE) {
+      if (!clut) {
+        throw runtime_error("a color table is required");
+      }
+    } else if (header.format_flags & GVRDataFlag::HAS_INTERNAL_COLOR_TABLE) {
+      throw logic_error("internal color tables not implemented");
+    }
+  }
+
+  GCTextureFormat format;
+  switch (header.data_format) {
+    case GVRDataFormat::INTENSITY_4:
+      format = GCTextureFormat::I4;
+      break;
+    case GVRDataFormat::INTENSITY_8:
+      format = GCTextureFormat::I8;
+      break;
+    case GVRDataFormat::RGB5A3:
+      format = GCTextureFormat::RGB5A3;
+      break;
+    case GVRDataFormat::INDEXED_4:
+      format = GCTextureFormat::C4;
+      break;
+    case GVRDataFormat::INDEXED_8:
+      format = GCTextureFormat::C8;
+      break;
+    case GVRDataFormat::DXT1:
+      format = GCTextureFormat::CMPR;
+      break;
+    default:
+      throw logic_error(std::format("unimplemented data format: {:02X}", static_cast<uint8_t>(header.data_format)));
+  }
+
+  // As in the original gvmdump decoder, the pixel data may extend past
+  // data_size if the input has more data after it
+  auto decoded = decode_gc_texture(
+      format,
+      data.data() + sizeof(GVRHeader),
+      data.size() - sizeof(GVRHeader),
+      header.width,
+      header.height,
+      clut);
+  // TODO: deal with mipmaps properly. Each mipmap level follows the previous
+  // one, and is half the width and height, but is never smaller than one tile
+  // (32 bytes).
+  bool has_mipmaps = (header.format_flags & GVRDataFlag::HAS_MIPMAPS);
+  return DecodedGVR{std::move(decoded.image), decoded.missing_tiles, has_mipmaps};
+}
+
+} // namespace ResourceDASM
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <phosg/Encoding.hh>
+#include <phosg/Image.hh>
+#include <string>
+#include <vector>
+
+namespace ResourceDASM {
+
+using namespace phosg;
+
+// GameCube GPU texture formats. Textures are stored as a sequence of 32-byte
+// tiles, in left-to-right, top-to-bottom order; the pixels within each tile are
+// also stored in left-to-right, top-to-bottom order. The tile size depends on
+// the number of bits per pixel: 8x8 for 4-bit formats, 8x4 for 8-bit formats,
+// and 4x4 for 16-bit formats. CMPR tiles are 8x8, made of four 4x4 DXT1
+// blocks. If a texture's dimensions aren't multiples of the tile size, the
+// tiles on its right and bottom edges are stored in full, and the extra pixels
+// are discarded when decoding.
+enum class GCTextureFormat {
+  I4 = 0,
+  I8,
+  RGB5A3,
+  C4,
+  C8,
+  CMPR,
+};
+
+// Returns the number of bytes of data in a texture of the given format and
+// dimensions (always a multiple of 32)
+size_t gc_texture_data_size(GCTextureFormat format, size_t width, size_t height);
+
+struct DecodedGCTexture {
+  ImageRGBA8888N image;
+  // Number of tiles that weren't present in the data; see decode_gc_texture
+  size_t missing_tiles;
+};
+
+// Decodes a texture. If size is less than the size returned by
+// gc_texture_data_size (that is, the texture is truncated), only the tiles that
+// are entirely present are decoded, the rest of the image is transparent
+// black, and missing_tiles in the result is the number of tiles that were not
+// decoded. Callers should report this, since the image is incomplete. For C4
+// and C8, clut must not be null and the texture's color indexes must all be
+// less than clut->size(); if any index is out of range, throws out_of_range.
+// Colors in clut are in the same format as the returned image's pixels
+// (RGBA8888).
+DecodedGCTexture decode_gc_texture(
+    GCTextureFormat format,
+    const void* data,
+    size_t size,
+    size_t width,
+    size_t height,
+    const std::vector<uint32_t>* clut = nullptr);
+
+// Single-color conversions to RGBA8888, as used in textures and color tables
+uint32_t decode_rgb5a3(uint16_t c);
+uint32_t decode_rgb565(uint16_t c);
+
+// GVR textures and GVP color tables, used in Phantasy Star Online and some
+// other Sega games. Each is stored in a GVR or GVP file, or in a GVM archive;
+// decode_gvr expects the file's contents to begin with the GVRT header (that
+// is, any GBIX header must be removed first).
+
+enum class GVRDataFormat : uint8_t {
+  INTENSITY_4 = 0x00,
+  INTENSITY_8 = 0x01,
+  INTENSITY_A4 = 0x02,
+  INTENSITY_A8 = 0x03,
+  RGB565 = 0x04,
+  RGB5A3 = 0x05,
+  ARGB8888 = 0x06,
+  INDEXED_4 = 0x08,
+  INDEXED_8 = 0x09,
+  DXT1 = 0x0E,
+};
+
+struct GVRHeader {
+  be_uint32_t magic; // 'GVRT'
+  // Add 8 to this value (it doesn't include magic and size). Also, yes, it
+  // really is little-endian.
+  le_uint32_t data_size;
+  be_uint16_t unknown;
+  uint8_t format_flags; // High 4 bits are pixel format, low 4 are data flags
+  GVRDataFormat data_format;
+  be_uint16_t width;
+  be_uint16_t height;
+} __attribute__((packed));
+
+struct GVPHeader {
+  be_uint32_t magic; // 'GVPL'
+  // See comment in GVRHeader about data_size
+  le_uint32_t data_size;
+  uint8_t unknown_a1;
+  uint8_t entry_format; // 0 = A8, 1 = RGB565, 2 = RGB5A3
+  uint8_t unknown_a2[4];
+  be_uint16_t num_entries;
+} __attribute__((packed));
+
+struct DecodedGVR {
+  ImageRGBA8888N image;
+  // Same as in DecodedGCTexture
+  size_t missing_tiles;
+  // Mipmaps are not decoded; if the texture has any, only the full-size image
+  // is returned and this is true
+  bool has_mipmaps;
+};
+
+std::vector<uint32_t> decode_gvp(const std::string& data);
+DecodedGVR decode_gvr(const std::string& data, const std::vector<uint32_t>* clut = nullptr);
+
+} // namespace ResourceDASM
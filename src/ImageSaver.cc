@@ -1,6 +1,15 @@
 #include "ImageSaver.hh"
 
+#include <stdint.h>
+#include <zlib.h>
+
+#include <algorithm>
 #include <cstring>
+#include <format>
+#include <phosg/Filesystem.hh>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+#include <string>
 
 using namespace std;
 using namespace phosg;
@@ -23,4 +32,169 @@ bool ImageSaver::process_cli_arg(const char* arg) {
   return false;
 }
 
+static void delete_png_stream(z_stream_s* z) {
+  deflateEnd(z);
+  delete z;
+}
+
+ImageSaver::RowWriter::RowWriter(ImageFormat format, FILE* f, size_t width, size_t height)
+    : format(format),
+      f(f),
+      width(width),
+      height(height),
+      rows_written(0),
+      png_stream(nullptr, delete_png_stream) {
+  StringWriter w;
+  switch (this->format) {
+    case ImageFormat::WINDOWS_BITMAP: {
+      // This is a 32-bit bitmap with a BITMAPV4HEADER, so the alpha channel
+      // is preserved. The height is negative so the rows can be written from
+      // top to bottom.
+      uint64_t data_size = static_cast<uint64_t>(this->width) * this->height * 4;
+      if (data_size > 0xFFFFFFFF - 0x7A) {
+        throw runtime_error("image is too large for bitmap format");
+      }
+      w.write("BM", 2);
+      w.put_u32l(data_size + 0x7A);
+      w.put_u32l(0);
+      w.put_u32l(0x7A);
+      w.put_u32l(0x6C); // Info header size
+      w.put_u32l(this->width);
+      w.put_u32l(-static_cast<int32_t>(this->height));
+      w.put_u16l(1); // Planes
+      w.put_u16l(32); // Bits per pixel
+      w.put_u32l(3); // Compression (BI_BITFIELDS)
+      w.put_u32l(data_size);
+      w.put_u32l(0x0B13); // 72 DPI horizontally and vertically
+      w.put_u32l(0x0B13);
+      w.put_u32l(0); // Color table size
+      w.put_u32l(0); // Important color count
+      w.put_u32l(0x00FF0000); // Red mask
+      w.put_u32l(0x0000FF00); // Green mask
+      w.put_u32l(0x000000FF); // Blue mask
+      w.put_u32l(0xFF000000); // Alpha mask
+      w.put_u32l(0x73524742); // Color space ('sRGB')
+      w.write(string(0x30, '\0')); // Endpoints and gamma (unused for sRGB)
+      break;
+    }
+    case ImageFormat::COLOR_PPM:
+      w.write(std::format("P6 {} {} 255\n", this->width, this->height));
+      break;
+    case ImageFormat::PNG: {
+      this->png_stream.reset(new z_stream_s());
+      if (deflateInit(this->png_stream.get(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+        // deflateEnd must not be called if deflateInit failed
+        delete this->png_stream.release();
+        throw runtime_error("cannot initialize PNG compressor");
+      }
+      w.write("\x89PNG\r\n\x1A\n", 8);
+      fwritex(this->f, w.str());
+      StringWriter ihdr_w;
+      ihdr_w.put_u32b(this->width);
+      ihdr_w.put_u32b(this->height);
+      ihdr_w.put_u8(8); // Bits per channel
+      ihdr_w.put_u8(6); // RGBA
+      ihdr_w.put_u8(0); // Compression method
+      ihdr_w.put_u8(0); // Filter method
+      ihdr_w.put_u8(0); // Not interlaced
+      this->write_png_chunk("IHDR", ihdr_w.str().data(), ihdr_w.str().size());
+      return;
+    }
+    default:
+      throw logic_error("unsupported image format for row writer");
+  }
+  fwritex(this->f, w.str());
+}
+
+void ImageSaver::RowWriter::write_png_chunk(const char* type, const void* data, size_t size) {
+  StringWriter w;
+  w.put_u32b(size);
+  w.write(type, 4);
+  w.write(data, size);
+  uint32_t crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+  w.put_u32b(crc32(crc, reinterpret_cast<const Bytef*>(data), size));
+  fwritex(this->f, w.str());
+}
+
+void ImageSaver::RowWriter::write_png_data(const void* data, size_t size, bool finish) {
+  // Compressed data is written in an IDAT chunk each time the output buffer
+  // fills up (and once more at the end of the stream)
+  auto* z = this->png_stream.get();
+  z->next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+  z->avail_in = size;
+  string buf(0x10000, '\0');
+  int ret;
+  do {
+    z->next_out = reinterpret_cast<Bytef*>(buf.data());
+    z->avail_out = buf.size();
+    ret = deflate(z, finish ? Z_FINISH : Z_NO_FLUSH);
+    if (ret == Z_STREAM_ERROR) {
+      throw runtime_error("cannot compress PNG data");
+    }
+    size_t bytes_produced = buf.size() - z->avail_out;
+    if (bytes_produced > 0) {
+      this->write_png_chunk("IDAT", buf.data(), bytes_produced);
+    }
+  } while (z->avail_out == 0);
+  if (finish && (ret != Z_STREAM_END)) {
+    throw runtime_error("PNG compressor did not finish");
+  }
+}
+
+void ImageSaver::RowWriter::write_rows(const ImageRGBA8888N& rows) {
+  if (rows.get_width() != this->width) {
+    throw logic_error("row width does not match image width");
+  }
+  if (this->rows_written + rows.get_height() > this->height) {
+    throw logic_error("too many rows written to image");
+  }
+
+  StringWriter w;
+  switch (this->format) {
+    case ImageFormat::WINDOWS_BITMAP:
+      for (size_t y = 0; y < rows.get_height(); y++) {
+        for (size_t x = 0; x < this->width; x++) {
+          uint32_t c = rows.read(x, y);
+          w.put_u32l((c >> 8) | (c << 24)); // RGBA -> ARGB
+        }
+      }
+      break;
+    case ImageFormat::COLOR_PPM:
+      for (size_t y = 0; y < rows.get_height(); y++) {
+        for (size_t x = 0; x < this->width; x++) {
+          uint32_t c = rows.read(x, y);
+          w.put_u8(c >> 24);
+          w.put_u8(c >> 16);
+          w.put_u8(c >> 8);
+        }
+      }
+      break;
+    case ImageFormat::PNG:
+      // Each row begins with its filter type (0 = no filter)
+      for (size_t y = 0; y < rows.get_height(); y++) {
+        w.put_u8(0);
+        for (size_t x = 0; x < this->width; x++) {
+          w.put_u32b(rows.read(x, y));
+        }
+      }
+      this->write_png_data(w.str().data(), w.str().size(), false);
+      this->rows_written += rows.get_height();
+      return;
+    default:
+      throw logic_error("unsupported image format for row writer");
+  }
+  fwritex(this->f, w.str());
+  this->rows_written += rows.get_height();
+}
+
+void ImageSaver::RowWriter::close() {
+  if (this->rows_written != this->height) {
+    throw logic_error("not all rows were written to image");
+  }
+  if (this->format == ImageFormat::PNG) {
+    this->write_png_data(nullptr, 0, true);
+    this->write_png_chunk("IEND", "", 0);
+  }
+}
+
 } // namespace ResourceDASM
@@ -3,6 +3,10 @@
 #include <phosg/Image.hh>
 
 #include <cstdio>
+#include <memory>
+#include <string>
+
+struct z_stream_s;
 
 namespace ResourceDASM {
 
@@ -24,6 +28,36 @@ using namespace phosg;
 
 class ImageSaver {
 public:
+  // Writes an image to a file a band of rows at a time, so the entire image
+  // never has to be in memory at once. Bands must be written in order from top
+  // to bottom, and must all have the width given to the constructor; close()
+  // must be called after exactly the given number of rows has been written.
+  class RowWriter {
+  public:
+    RowWriter(ImageFormat format, FILE* f, size_t width, size_t height);
+    RowWriter(const RowWriter&) = delete;
+    RowWriter(RowWriter&&) = default;
+    RowWriter& operator=(const RowWriter&) = delete;
+    RowWriter& operator=(RowWriter&&) = default;
+    ~RowWriter() = default;
+
+    void write_rows(const ImageRGBA8888N& rows);
+    void close();
+
+  private:
+    ImageFormat format;
+    FILE* f;
+    size_t width;
+    size_t height;
+    size_t rows_written;
+    // The zlib stream for PNG image data, which is written in IDAT chunks as
+    // the compressor produces it
+    std::unique_ptr<z_stream_s, void (*)(z_stream_s*)> png_stream;
+
+    void write_png_chunk(const char* type, const void* data, size_t size);
+    void write_png_data(const void* data, size_t size, bool finish);
+  };
+
   ImageSaver() : image_format(ImageFormat::WINDOWS_BITMAP) {}
 
   // Returns whether arg was processed
@@ -42,6 +76,18 @@ public:
     fwritex(file, img.serialize(this->image_format));
   }
 
+  // For callers that write the image data somewhere other than a file
+  inline std::string file_extension() const {
+    return file_extension_for_image_format(this->image_format);
+  }
+  template <PixelFormat Format>
+  [[nodiscard]] std::string serialize_image(const Image<Format>& img) const {
+    return img.serialize(this->image_format);
+  }
+  inline RowWriter open_row_writer(FILE* f, size_t width, size_t height) const {
+    return RowWriter(this->image_format, f, width, height);
+  }
+
 private:
   ImageFormat image_format;
 };
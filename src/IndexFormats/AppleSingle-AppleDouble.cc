@@ -163,6 +163,31 @@ ResourceFile parse_applesingle_appledouble_resource_fork(const string& data) {
   return std::move(parsed.resource_fork);
 }
 
+vector<ResourceIndexEntry> parse_applesingle_appledouble_index(StringReader& r) {
+  const auto& header = r.pget<Header>(0);
+  if (header.signature != 0x00051600 && header.signature != 0x00051607) {
+    throw runtime_error("file is not AppleSingle or AppleDouble");
+  }
+  if (header.version != 0x00010000 && header.version != 0x00020000) {
+    throw runtime_error("unknown AppleSingle/AppleDouble version");
+  }
+
+  // As in parse_applesingle_appledouble, if there are multiple resource fork
+  // entries, the last one is used
+  vector<ResourceIndexEntry> ret;
+  for (size_t z = 0; z < header.num_entries; z++) {
+    const auto& entry = r.pget<Entry>(sizeof(Header) + z * sizeof(Entry));
+    if (entry.type() == Entry::Type::RESOURCE_FORK) {
+      auto sub_r = r.subx(entry.offset, entry.size);
+      ret = parse_resource_fork_index(sub_r);
+      for (auto& e : ret) {
+        e.offset += entry.offset;
+      }
+    }
+  }
+  return ret;
+}
+
 string DecodedAppleSingle::serialize() const {
   size_t offset = 0;
   vector<pair<Entry, const string*>> entries;
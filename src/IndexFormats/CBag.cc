@@ -5,6 +5,7 @@
 #include <phosg/Encoding.hh>
 #include <phosg/Strings.hh>
 #include <string>
+#include <vector>
 
 #include "../ResourceFile.hh"
 
@@ -23,17 +24,26 @@ struct CBagEntry {
   char name[0x3F];
 } __attribute__((packed));
 
-ResourceFile parse_cbag(const string& data) {
-  StringReader r(data);
-
+vector<ResourceIndexEntry> parse_cbag_index(StringReader& r) {
   uint32_t count = r.get_u32b();
 
-  ResourceFile ret(IndexFormat::CBAG);
+  vector<ResourceIndexEntry> ret;
   for (size_t z = 0; z < count; z++) {
     const auto& entry = r.get<CBagEntry>();
     string name(entry.name, min<size_t>(sizeof(entry.name), entry.name_length));
-    string data = r.pread(entry.data_offset, entry.data_size);
-    ResourceFile::Resource res(entry.type, entry.id, 0, std::move(name), std::move(data));
+    // Resources may be truncated by the end of the file
+    size_t data_size = available_size(r, entry.data_offset, entry.data_size);
+    ret.emplace_back(ResourceIndexEntry{entry.type, entry.id, 0, std::move(name), entry.data_offset, data_size});
+  }
+  return ret;
+}
+
+ResourceFile parse_cbag(const string& data) {
+  StringReader r(data);
+
+  ResourceFile ret(IndexFormat::CBAG);
+  for (auto& e : parse_cbag_index(r)) {
+    ResourceFile::Resource res(e.type, e.id, e.flags, std::move(e.name), r.preadx(e.offset, e.size));
     ret.add(std::move(res));
   }
   return ret;
@@ -5,6 +5,7 @@
 #include <phosg/Encoding.hh>
 #include <phosg/Strings.hh>
 #include <string>
+#include <vector>
 
 #include "../ResourceFile.hh"
 
@@ -26,15 +27,26 @@ struct ResourceEntry {
   be_int16_t id;
 } __attribute__((packed));
 
-ResourceFile parse_dc_data(const string& data) {
-  StringReader r(data);
+vector<ResourceIndexEntry> parse_dc_data_index(StringReader& r) {
   const auto& h = r.get<ResourceHeader>();
 
-  ResourceFile ret(IndexFormat::DC_DATA);
+  vector<ResourceIndexEntry> ret;
   for (size_t x = 0; x < h.resource_count; x++) {
     const auto& e = r.get<ResourceEntry>();
-    string data = r.preadx(e.offset, e.size);
-    ret.add(ResourceFile::Resource(e.type, e.id, std::move(data)));
+    if ((e.offset > r.size()) || (e.size > r.size() - e.offset)) {
+      throw out_of_range("resource data extends beyond end of file");
+    }
+    ret.emplace_back(ResourceIndexEntry{e.type, e.id, 0, "", e.offset, e.size});
+  }
+  return ret;
+}
+
+ResourceFile parse_dc_data(const string& data) {
+  StringReader r(data);
+
+  ResourceFile ret(IndexFormat::DC_DATA);
+  for (const auto& e : parse_dc_data_index(r)) {
+    ret.add(ResourceFile::Resource(e.type, e.id, r.preadx(e.offset, e.size)));
   }
 
   return ret;
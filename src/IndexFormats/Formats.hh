@@ -1,8 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <memory>
 #include <phosg/Strings.hh>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "../ResourceFile.hh"
 
@@ -10,6 +13,38 @@ namespace ResourceDASM {
 
 using namespace phosg;
 
+// Index-only parsing
+//
+// The parse_*_index functions read only the resource index, and return the
+// location of each resource's data instead of the data itself. Offsets in the
+// returned entries are relative to the beginning of the StringReader's data,
+// and every entry's data range is entirely within that data. These functions
+// never read any resource data, so they're much faster than the full parsers
+// for large files when only some resources are needed.
+struct ResourceIndexEntry {
+  uint32_t type;
+  int16_t id;
+  uint16_t flags;
+  std::string name;
+  size_t offset;
+  size_t size;
+};
+
+// Returns the number of bytes that r.pread(offset, size) would return. This is
+// used for formats whose parsers allow resources to be truncated by the end of
+// the file.
+inline size_t available_size(const StringReader& r, size_t offset, size_t size) {
+  return (offset >= r.size()) ? 0 : std::min<size_t>(size, r.size() - offset);
+}
+
+// Index.cc
+std::vector<ResourceIndexEntry> parse_index(IndexFormat format, StringReader& r);
+// Returns a ResourceFile containing all resources from the file's index. Each
+// resource's data is copied out of the MappedFile only when it's first
+// requested via get_resource. DIRECTORY is not supported here, since it isn't
+// a single-file format.
+ResourceFile parse_lazy_resource_file(IndexFormat format, std::shared_ptr<const MappedFile> file);
+
 // AppleSingle-AppleDouble.cc
 struct DecodedAppleSingle {
   std::string data_fork;
@@ -33,12 +68,15 @@ struct DecodedAppleSingle {
 DecodedAppleSingle parse_applesingle_appledouble(StringReader& r);
 DecodedAppleSingle parse_applesingle_appledouble(const std::string& data);
 ResourceFile parse_applesingle_appledouble_resource_fork(const std::string& data);
+std::vector<ResourceIndexEntry> parse_applesingle_appledouble_index(StringReader& r);
 
 // CBag.cc
 ResourceFile parse_cbag(const std::string& data);
+std::vector<ResourceIndexEntry> parse_cbag_index(StringReader& r);
 
 // DCData.cc
 ResourceFile parse_dc_data(const std::string& data);
+std::vector<ResourceIndexEntry> parse_dc_data_index(StringReader& r);
 
 // Directory.cc
 ResourceFile load_resource_file_from_directory(const std::string& dir_path);
@@ -46,17 +84,25 @@ void save_resource_file_to_directory(const ResourceFile& rf, const std::string&
 
 // HIRF.cc
 ResourceFile parse_hirf(const std::string& data);
+std::vector<ResourceIndexEntry> parse_hirf_index(StringReader& r);
 
 // MacBinary.cc
 std::pair<StringReader, ResourceFile> parse_macbinary(const std::string& data);
 ResourceFile parse_macbinary_resource_fork(const std::string& data);
+std::vector<ResourceIndexEntry> parse_macbinary_index(StringReader& r);
 
 // Mohawk.cc
 ResourceFile parse_mohawk(const std::string& data);
+std::vector<ResourceIndexEntry> parse_mohawk_index(StringReader& r);
 
 // ResourceFork.cc
 ResourceFile parse_resource_fork(const std::string& data);
 ResourceFile parse_resource_fork(StringReader& data);
+// Parses only the resource map from the mapped file. Resource data is copied
+// out of the mapping only when each resource is first requested, so listing or
+// exporting only some resources doesn't require reading the entire file.
+ResourceFile parse_resource_fork(std::shared_ptr<const MappedFile> file);
+std::vector<ResourceIndexEntry> parse_resource_fork_index(StringReader& r);
 std::string serialize_resource_fork(const ResourceFile& rf);
 
 } // namespace ResourceDASM
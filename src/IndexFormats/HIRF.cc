@@ -38,9 +38,7 @@ struct HIRFTopLevelResourceHeader {
   // uint32_t size;
 } __attribute__((packed));
 
-ResourceFile parse_hirf(const string& data) {
-  StringReader r(data.data(), data.size());
-
+vector<ResourceIndexEntry> parse_hirf_index(StringReader& r) {
   const auto& header = r.get<HIRFFileHeader>();
   if (header.magic != 0x4952455A) {
     throw runtime_error("file is not a HIRF archive");
@@ -49,14 +47,17 @@ ResourceFile parse_hirf(const string& data) {
     throw runtime_error("unsupported HIRF version");
   }
 
-  ResourceFile ret(IndexFormat::HIRF);
+  vector<ResourceIndexEntry> ret;
   while (!r.eof()) {
     const auto& res_header = r.get<HIRFTopLevelResourceHeader>();
-    string name = r.read(res_header.name_length);
+    // Resource names are not used, but still have to be skipped
+    r.read(res_header.name_length);
     uint32_t size = r.get_u32b();
 
-    ResourceFile::Resource res(res_header.type, res_header.id, r.read(size));
-    ret.add(std::move(res));
+    // Resources may be truncated by the end of the file
+    size_t data_offset = r.where();
+    ret.emplace_back(ResourceIndexEntry{
+        res_header.type, static_cast<int16_t>(res_header.id), 0, "", data_offset, available_size(r, data_offset, size)});
 
     r.go(res_header.next_res_offset);
   }
@@ -64,4 +65,16 @@ ResourceFile parse_hirf(const string& data) {
   return ret;
 }
 
+ResourceFile parse_hirf(const string& data) {
+  StringReader r(data.data(), data.size());
+
+  ResourceFile ret(IndexFormat::HIRF);
+  for (const auto& e : parse_hirf_index(r)) {
+    ResourceFile::Resource res(e.type, e.id, r.preadx(e.offset, e.size));
+    ret.add(std::move(res));
+  }
+
+  return ret;
+}
+
 } // namespace ResourceDASM
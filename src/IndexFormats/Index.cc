@@ -0,0 +1,61 @@
+#include "Formats.hh"
+
+#include <stdint.h>
+
+#include <memory>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../MappedFile.hh"
+#include "../ResourceFile.hh"
+
+using namespace std;
+using namespace phosg;
+
+namespace ResourceDASM {
+
+vector<ResourceIndexEntry> parse_index(IndexFormat format, StringReader& r) {
+  switch (format) {
+    case IndexFormat::RESOURCE_FORK:
+      return parse_resource_fork_index(r);
+    case IndexFormat::APPLESINGLE_APPLEDOUBLE:
+      return parse_applesingle_appledouble_index(r);
+    case IndexFormat::MACBINARY:
+      return parse_macbinary_index(r);
+    case IndexFormat::MOHAWK:
+      return parse_mohawk_index(r);
+    case IndexFormat::HIRF:
+      return parse_hirf_index(r);
+    case IndexFormat::DC_DATA:
+      return parse_dc_data_index(r);
+    case IndexFormat::CBAG:
+      return parse_cbag_index(r);
+    case IndexFormat::DIRECTORY:
+    case IndexFormat::NONE:
+      break;
+  }
+  throw logic_error("index format does not support index-only parsing");
+}
+
+ResourceFile parse_lazy_resource_file(IndexFormat format, shared_ptr<const MappedFile> file) {
+  StringReader r(file->data(), file->size());
+  auto entries = parse_index(format, r);
+
+  // MacBinary and AppleSingle/AppleDouble files contain an embedded resource
+  // fork, and their full parsers return it as a RESOURCE_FORK ResourceFile, so
+  // we do the same here
+  IndexFormat rf_format = format;
+  if ((format == IndexFormat::MACBINARY) || (format == IndexFormat::APPLESINGLE_APPLEDOUBLE)) {
+    rf_format = IndexFormat::RESOURCE_FORK;
+  }
+
+  ResourceFile ret(rf_format, file);
+  for (auto& e : entries) {
+    ret.add_lazy(e.type, e.id, e.flags, std::move(e.name), e.offset, e.size);
+  }
+  return ret;
+}
+
+} // namespace ResourceDASM
@@ -5,6 +5,7 @@
 #include <phosg/Encoding.hh>
 #include <phosg/Strings.hh>
 #include <string>
+#include <vector>
 
 #include "../ResourceFile.hh"
 
@@ -129,10 +130,9 @@ struct MacBinaryHeader {
   }
 } __attribute__((packed));
 
-pair<StringReader, ResourceFile> parse_macbinary(const string& data) {
-  StringReader r(data);
-
-  const auto& header = r.get<MacBinaryHeader>();
+// Returns the offsets of the data and resource forks within r
+static pair<size_t, size_t> parse_macbinary_header(StringReader& r) {
+  const auto& header = r.pget<MacBinaryHeader>(0);
 
   // First, check some fields that are common to all versions
   header.assert_valid();
@@ -149,9 +149,16 @@ pair<StringReader, ResourceFile> parse_macbinary(const string& data) {
   // Data blocks always start on an 0x80-byte boundary
   size_t data_fork_offset = ((sizeof(header) + header.extra_header_bytes) + 0x7F) & (~0x7F);
   size_t resource_fork_offset = ((data_fork_offset + header.data_fork_bytes) + 0x7F) & (~0x7F);
+  return make_pair(data_fork_offset, resource_fork_offset);
+}
 
-  StringReader data_r = r.subx(data_fork_offset, header.data_fork_bytes);
-  StringReader resource_r = r.subx(resource_fork_offset, header.resource_fork_bytes);
+pair<StringReader, ResourceFile> parse_macbinary(const string& data) {
+  StringReader r(data);
+  auto offsets = parse_macbinary_header(r);
+  const auto& header = r.pget<MacBinaryHeader>(0);
+
+  StringReader data_r = r.subx(offsets.first, header.data_fork_bytes);
+  StringReader resource_r = r.subx(offsets.second, header.resource_fork_bytes);
   return make_pair(data_r, parse_resource_fork(resource_r));
 }
 
@@ -159,4 +166,16 @@ ResourceFile parse_macbinary_resource_fork(const string& data) {
   return parse_macbinary(data).second;
 }
 
+vector<ResourceIndexEntry> parse_macbinary_index(StringReader& r) {
+  auto offsets = parse_macbinary_header(r);
+  const auto& header = r.pget<MacBinaryHeader>(0);
+
+  StringReader resource_r = r.subx(offsets.second, header.resource_fork_bytes);
+  auto ret = parse_resource_fork_index(resource_r);
+  for (auto& e : ret) {
+    e.offset += offsets.second;
+  }
+  return ret;
+}
+
 } // namespace ResourceDASM
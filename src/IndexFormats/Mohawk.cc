@@ -90,15 +90,8 @@ struct ResourceFileTable {
   }
 } __attribute__((packed));
 
-struct ResourceEntry {
-  uint32_t type;
-  uint16_t id;
-  uint32_t offset;
-  uint32_t size;
-};
-
-static vector<ResourceEntry> load_index(StringReader& r) {
-  MohawkFileHeader h = r.get<MohawkFileHeader>();
+vector<ResourceIndexEntry> parse_mohawk_index(StringReader& r) {
+  const auto& h = r.pget<MohawkFileHeader>(0);
   if (h.signature != 0x4D48574B) {
     throw runtime_error("file is not a mohawk archive");
   }
@@ -115,7 +108,7 @@ static vector<ResourceEntry> load_index(StringReader& r) {
   string file_table_data = r.pread(file_table_offset, ResourceFileTable::size_for_count(file_table_count));
   const ResourceFileTable* file_table = reinterpret_cast<ResourceFileTable*>(file_table_data.data());
 
-  vector<ResourceEntry> ret;
+  vector<ResourceIndexEntry> ret;
   for (size_t type_index = 0; type_index < type_table.count; type_index++) {
     const auto& type_table_entry = type_table.entries[type_index];
 
@@ -129,7 +122,10 @@ static vector<ResourceEntry> load_index(StringReader& r) {
         throw runtime_error("file entry reference out of range");
       }
       const auto& file_entry = file_table->entries[res_entry.file_table_index - 1];
-      ret.emplace_back(ResourceEntry{type_table_entry.type, res_entry.resource_id, file_entry.data_offset, file_entry.size()});
+      // Resources may be truncated by the end of the file
+      size_t data_size = available_size(r, file_entry.data_offset, file_entry.size());
+      ret.emplace_back(ResourceIndexEntry{
+          type_table_entry.type, static_cast<int16_t>(res_entry.resource_id), 0, "", file_entry.data_offset, data_size});
     }
   }
 
@@ -140,10 +136,8 @@ ResourceFile parse_mohawk(const string& data) {
   StringReader r(data.data(), data.size());
 
   ResourceFile ret(IndexFormat::MOHAWK);
-  vector<ResourceEntry> resource_entries = load_index(r);
-  for (const auto& e : resource_entries) {
-    string data = r.pread(e.offset, e.size);
-    ResourceFile::Resource res(e.type, e.id, std::move(data));
+  for (const auto& e : parse_mohawk_index(r)) {
+    ResourceFile::Resource res(e.type, e.id, r.preadx(e.offset, e.size));
     ret.add(std::move(res));
   }
 
@@ -57,8 +57,8 @@ struct ResourceReferenceListEntry {
   be_uint32_t reserved;
 } __attribute__((packed));
 
-ResourceFile parse_resource_fork(StringReader& r) {
-  ResourceFile ret(IndexFormat::RESOURCE_FORK);
+vector<ResourceIndexEntry> parse_resource_fork_index(StringReader& r) {
+  vector<ResourceIndexEntry> ret;
 
   // If the resource fork is empty, treat it as a valid index with no contents
   if (r.eof()) {
@@ -95,22 +95,30 @@ ResourceFile parse_resource_fork(StringReader& r) {
 
       size_t data_offset = header.resource_data_offset + (ref_entry.attributes_and_offset & 0x00FFFFFF);
       size_t data_size = r.pget_u32b(data_offset);
+      if (data_size > r.size() - (data_offset + 4)) {
+        throw out_of_range("resource data extends beyond end of file");
+      }
       uint8_t attributes = (ref_entry.attributes_and_offset >> 24) & 0xFF;
-      string data = r.preadx(data_offset + 4, data_size);
-      ResourceFile::Resource res(
-          type_list_entry.resource_type,
-          ref_entry.resource_id,
-          attributes,
-          name,
-          std::move(data));
-
-      ret.add(std::move(res));
+      ret.emplace_back(ResourceIndexEntry{
+          type_list_entry.resource_type, ref_entry.resource_id, attributes, std::move(name), data_offset + 4, data_size});
     }
   }
 
   return ret;
 }
 
+ResourceFile parse_resource_fork(StringReader& r) {
+  ResourceFile ret(IndexFormat::RESOURCE_FORK);
+  for (auto& e : parse_resource_fork_index(r)) {
+    ret.add(ResourceFile::Resource(e.type, e.id, e.flags, std::move(e.name), r.preadx(e.offset, e.size)));
+  }
+  return ret;
+}
+
+ResourceFile parse_resource_fork(shared_ptr<const MappedFile> file) {
+  return parse_lazy_resource_file(IndexFormat::RESOURCE_FORK, file);
+}
+
 ResourceFile parse_resource_fork(const string& data) {
   StringReader r(data.data(), data.size());
   return parse_resource_fork(r);
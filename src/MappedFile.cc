@@ -0,0 +1,72 @@
+#include "MappedFile.hh"
+
+#include <phosg/Platform.hh>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifndef PHOSG_WINDOWS
+#include <sys/mman.h>
+#endif
+
+#include <phosg/Filesystem.hh>
+#include <stdexcept>
+
+using namespace std;
+using namespace phosg;
+
+namespace ResourceDASM {
+
+MappedFile::MappedFile(const string& filename)
+    : base(nullptr),
+      bytes(0),
+      mapped(false) {
+#ifndef PHOSG_WINDOWS
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw cannot_open_file(filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* map_base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map_base != MAP_FAILED) {
+      this->base = map_base;
+      this->bytes = st.st_size;
+      this->mapped = true;
+    }
+  }
+  close(fd);
+  if (this->mapped) {
+    return;
+  }
+#endif
+
+  // The file could not be mapped (or this platform doesn't support mapping
+  // files), so read it into memory instead
+  this->unmapped_data = load_file(filename);
+  this->base = this->unmapped_data.data();
+  this->bytes = this->unmapped_data.size();
+}
+
+MappedFile::~MappedFile() {
+#ifndef PHOSG_WINDOWS
+  if (this->mapped) {
+    munmap(const_cast<void*>(this->base), this->bytes);
+  }
+#endif
+}
+
+const void* MappedFile::at(size_t offset, size_t size) const {
+  if ((offset > this->bytes) || (size > this->bytes - offset)) {
+    throw out_of_range("range extends beyond end of mapped file");
+  }
+  return reinterpret_cast<const uint8_t*>(this->base) + offset;
+}
+
+string MappedFile::read(size_t offset, size_t size) const {
+  return string(reinterpret_cast<const char*>(this->at(offset, size)), size);
+}
+
+} // namespace ResourceDASM
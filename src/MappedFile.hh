@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+namespace ResourceDASM {
+
+// A read-only view of a file's contents. On platforms that support it, the
+// file is memory-mapped, so only the parts of it that are actually read are
+// loaded from disk. If the file can't be mapped (for example, some systems
+// don't support mapping resource forks), its contents are read into memory
+// instead. Either way, the data remains valid until the MappedFile is
+// destroyed.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& filename);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile(MappedFile&&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile& operator=(MappedFile&&) = delete;
+  ~MappedFile();
+
+  inline const void* data() const {
+    return this->base;
+  }
+  inline size_t size() const {
+    return this->bytes;
+  }
+  inline bool is_mapped() const {
+    return this->mapped;
+  }
+
+  // Returns a pointer to the given range of the file. Throws out_of_range if
+  // any part of the range is beyond the end of the file.
+  const void* at(size_t offset, size_t size) const;
+  // Returns a copy of the given range of the file. Throws out_of_range if any
+  // part of the range is beyond the end of the file.
+  std::string read(size_t offset, size_t size) const;
+
+private:
+  const void* base;
+  size_t bytes;
+  bool mapped;
+  std::string unmapped_data;
+};
+
+} // namespace ResourceDASM
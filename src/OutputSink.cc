@@ -0,0 +1,219 @@
+#include "OutputSink.hh"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <phosg/Filesystem.hh>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace phosg;
+
+namespace ResourceDASM {
+
+static void fclose_file_handle(FILE* f) {
+  if (f) {
+    fclose(f);
+  }
+}
+
+OutputSink::File::File(FileHandle&& f, OutputSink* buffered_sink, const string& filename)
+    : f(std::move(f)),
+      buffered_sink(buffered_sink),
+      filename(filename) {}
+
+OutputSink::File::~File() {
+  if (this->f) {
+    this->f.reset();
+    // Buffered files are temporary files, which are deleted when closed
+    if (!this->buffered_sink) {
+      ::remove(this->filename.c_str());
+    }
+  }
+}
+
+size_t OutputSink::File::close() {
+  fflush(this->f.get());
+  fseek(this->f.get(), 0, SEEK_END);
+  size_t size = ftell(this->f.get());
+  if (this->buffered_sink) {
+    fseek(this->f.get(), 0, SEEK_SET);
+    this->buffered_sink->write_file_from_stream(this->filename, this->f.get(), size);
+  }
+  this->f.reset();
+  return size;
+}
+
+void OutputSink::finish() {}
+
+void OutputSink::write_file_from_stream(const string& filename, FILE* src, size_t size) {
+  this->write_file(filename, freadx(src, size));
+}
+
+void DirectoryOutputSink::ensure_directories_exist(const string& filename) {
+  vector<string> tokens = split(filename, '/');
+  if (tokens.empty()) {
+    return;
+  }
+  tokens.pop_back();
+
+  if (tokens.empty()) {
+    return;
+  }
+
+  string dir;
+  bool first_token = true;
+  for (const string& token : tokens) {
+    if (!first_token) {
+      dir.push_back('/');
+    } else {
+      first_token = false;
+    }
+    dir += token;
+    // dir can be / if filename is an absolute path; just skip it
+    if (dir != "/" && !std::filesystem::is_directory(dir)) {
+      std::filesystem::create_directories(dir);
+    }
+  }
+}
+
+void DirectoryOutputSink::write_file(const string& filename, const string& data) {
+  this->ensure_directories_exist(filename);
+  save_file(filename, data);
+}
+
+OutputSink::File DirectoryOutputSink::open_file(const string& filename) {
+  this->ensure_directories_exist(filename);
+  return File(fopen_unique(filename, "wb"), nullptr, filename);
+}
+
+TarOutputSink::TarOutputSink(const string& filename)
+    : f(fopen_unique(filename, "wb")) {}
+
+TarOutputSink::~TarOutputSink() {
+  try {
+    this->finish();
+  } catch (const exception&) {
+  }
+}
+
+void TarOutputSink::write_header(const string& name, uint64_t size, char type) {
+  // Sizes are written as 11 octal digits, so the maximum is 8GB
+  if (size >= 0x200000000) {
+    throw runtime_error("file is too large for tar archive");
+  }
+
+  string header(0x200, '\0');
+  memcpy(header.data(), name.data(), min<size_t>(name.size(), 100));
+  memcpy(header.data() + 100, "0000644", 7); // mode
+  memcpy(header.data() + 108, "0000000", 7); // uid
+  memcpy(header.data() + 116, "0000000", 7); // gid
+  string size_str = std::format("{:011o}", size);
+  memcpy(header.data() + 124, size_str.data(), 11);
+  memcpy(header.data() + 136, "00000000000", 11); // mtime
+  header[156] = type;
+  memcpy(header.data() + 257, "ustar", 6);
+  memcpy(header.data() + 263, "00", 2);
+
+  // The checksum is computed as if the checksum field were all spaces
+  memset(header.data() + 148, ' ', 8);
+  uint32_t checksum = 0;
+  for (char ch : header) {
+    checksum += static_cast<uint8_t>(ch);
+  }
+  string checksum_str = std::format("{:06o}", checksum);
+  memcpy(header.data() + 148, checksum_str.data(), 6);
+  header[154] = '\0';
+
+  this->pending_data += header;
+}
+
+string TarOutputSink::member_name(const string& filename) {
+  // Tar member names are relative, so strip any leading slashes
+  size_t name_offset = 0;
+  while (name_offset < filename.size() && filename[name_offset] == '/') {
+    name_offset++;
+  }
+  return filename.substr(name_offset);
+}
+
+void TarOutputSink::write_headers(const string& name, uint64_t size) {
+  if (!this->f) {
+    throw logic_error("cannot write to a finished tar archive");
+  }
+
+  // Names that don't fit in the header are written in a preceding GNU long
+  // name entry, which GNU tar and bsdtar both understand. The name is padded
+  // to a block boundary, including its terminating null byte.
+  if (name.size() > 100) {
+    this->write_header("././@LongLink", name.size() + 1, 'L');
+    this->pending_data += name;
+    this->pending_data.resize((this->pending_data.size() + 0x200) & (~0x1FF), '\0');
+  }
+
+  this->write_header(name, size, '0');
+}
+
+void TarOutputSink::write_file(const string& filename, const string& data) {
+  string name = this->member_name(filename);
+
+  lock_guard g(this->lock);
+  this->write_headers(name, data.size());
+  this->pending_data += data;
+  this->pending_data.resize((this->pending_data.size() + 0x1FF) & (~0x1FF), '\0');
+
+  if (this->pending_data.size() >= FLUSH_THRESHOLD) {
+    this->flush();
+  }
+}
+
+void TarOutputSink::write_file_from_stream(const string& filename, FILE* src, size_t size) {
+  string name = this->member_name(filename);
+
+  // The data is copied in chunks, so large files never have to be entirely in
+  // memory. Other threads can't write to the archive until this is done.
+  lock_guard g(this->lock);
+  this->write_headers(name, size);
+  for (size_t offset = 0; offset < size; offset += FLUSH_THRESHOLD) {
+    this->pending_data += freadx(src, min<size_t>(size - offset, FLUSH_THRESHOLD));
+    if (this->pending_data.size() >= FLUSH_THRESHOLD) {
+      this->flush();
+    }
+  }
+  this->pending_data.resize((this->pending_data.size() + 0x1FF) & (~0x1FF), '\0');
+
+  if (this->pending_data.size() >= FLUSH_THRESHOLD) {
+    this->flush();
+  }
+}
+
+OutputSink::File TarOutputSink::open_file(const string& filename) {
+  FILE* temp_f = tmpfile();
+  if (!temp_f) {
+    throw runtime_error("cannot create temporary file");
+  }
+  return File(FileHandle(temp_f, fclose_file_handle), this, filename);
+}
+
+void TarOutputSink::finish() {
+  lock_guard g(this->lock);
+  if (this->f) {
+    // The archive ends with two empty blocks
+    this->pending_data.resize(this->pending_data.size() + 0x400, '\0');
+    this->flush();
+    this->f.reset();
+  }
+}
+
+void TarOutputSink::flush() {
+  fwritex(this->f.get(), this->pending_data);
+  this->pending_data.clear();
+}
+
+} // namespace ResourceDASM
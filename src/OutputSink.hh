@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ResourceDASM {
+
+// A destination for output files. DirectoryOutputSink writes each output file
+// directly to the filesystem; TarOutputSink writes all of them sequentially
+// into a single tar archive, which is much faster than creating a large number
+// of small files on some filesystems. Output filenames may contain
+// directories; these are created as needed (or included in the names of the
+// archive's members). All functions may be called from multiple threads at the
+// same time.
+class OutputSink {
+public:
+  using FileHandle = std::unique_ptr<FILE, void (*)(FILE*)>;
+
+  // A stream to write an output file's contents to, for callers that need a
+  // FILE*. close() must be called after the contents are written; it returns
+  // the size of the file. If the File is destroyed without being closed (e.g.
+  // because writing it failed), the output file is deleted, so incomplete
+  // files aren't left behind.
+  class File {
+  public:
+    File(FileHandle&& f, OutputSink* buffered_sink, const std::string& filename);
+    File(const File&) = delete;
+    File(File&&) = default;
+    File& operator=(const File&) = delete;
+    File& operator=(File&&) = delete;
+    ~File();
+
+    inline FILE* get() {
+      return this->f.get();
+    }
+    size_t close();
+
+  private:
+    FileHandle f;
+    // If not null, f is a temporary file, and its contents are written to this
+    // sink when the file is closed
+    OutputSink* buffered_sink;
+    std::string filename;
+  };
+
+  OutputSink() = default;
+  OutputSink(const OutputSink&) = delete;
+  OutputSink(OutputSink&&) = delete;
+  OutputSink& operator=(const OutputSink&) = delete;
+  OutputSink& operator=(OutputSink&&) = delete;
+  virtual ~OutputSink() = default;
+
+  virtual void write_file(const std::string& filename, const std::string& data) = 0;
+  virtual File open_file(const std::string& filename) = 0;
+  // Writes any buffered data. No files may be written after this is called.
+  virtual void finish();
+
+protected:
+  // Writes size bytes from the current position in src as the contents of the
+  // given file. Used by File::close for sinks that buffer open files in
+  // temporary files; the default implementation reads all the data into
+  // memory and calls write_file.
+  virtual void write_file_from_stream(const std::string& filename, FILE* src, size_t size);
+};
+
+class DirectoryOutputSink : public OutputSink {
+public:
+  DirectoryOutputSink() = default;
+  virtual ~DirectoryOutputSink() = default;
+
+  virtual void write_file(const std::string& filename, const std::string& data);
+  virtual File open_file(const std::string& filename);
+
+private:
+  static void ensure_directories_exist(const std::string& filename);
+};
+
+class TarOutputSink : public OutputSink {
+public:
+  explicit TarOutputSink(const std::string& filename);
+  virtual ~TarOutputSink();
+
+  virtual void write_file(const std::string& filename, const std::string& data);
+  virtual File open_file(const std::string& filename);
+  virtual void finish();
+
+protected:
+  virtual void write_file_from_stream(const std::string& filename, FILE* src, size_t size);
+
+private:
+  // Data is collected here and written to the archive in large chunks
+  static constexpr size_t FLUSH_THRESHOLD = 0x800000;
+
+  std::mutex lock;
+  FileHandle f;
+  std::string pending_data;
+
+  static std::string member_name(const std::string& filename);
+  void write_headers(const std::string& name, uint64_t size);
+  void write_header(const std::string& name, uint64_t size, char type);
+  void flush();
+};
+
+} // namespace ResourceDASM
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <exception>
 #include <phosg/Encoding.hh>
 #include <phosg/Filesystem.hh>
@@ -255,12 +256,30 @@ void QuickDrawEngine::pict_set_default_highlight_color(StringReader&, uint16_t)
 
 // Simple shape opcodes
 
+Rect QuickDrawEngine::clip_rect_to_port_bounds(const Rect& rect) const {
+  // Returns the part of rect (in picture space) that is within the port's
+  // bounds, or an empty rect if there is no such part
+  const auto& port_bounds = this->port->get_bounds();
+  ssize_t x1 = max<ssize_t>(rect.x1, port_bounds.x1 + this->pict_bounds.x1);
+  ssize_t y1 = max<ssize_t>(rect.y1, port_bounds.y1 + this->pict_bounds.y1);
+  ssize_t x2 = min<ssize_t>(rect.x2, port_bounds.x2 + this->pict_bounds.x1);
+  ssize_t y2 = min<ssize_t>(rect.y2, port_bounds.y2 + this->pict_bounds.y1);
+  if ((x1 >= x2) || (y1 >= y2)) {
+    return Rect(0, 0, 0, 0);
+  }
+  return Rect(y1, x1, y2, x2);
+}
+
 void QuickDrawEngine::pict_fill_current_rect_with_pattern(const Pattern& pat, const ImageRGB888& pixel_pat) {
   bool use_pixel_pat = !!(pixel_pat.get_width() && pixel_pat.get_height());
-  auto clip_rgn_it = this->port->get_clip_region().iterate(this->pict_last_rect);
-  for (ssize_t y = this->pict_last_rect.y1; y < this->pict_last_rect.y2; y++) {
-    for (ssize_t x = this->pict_last_rect.x1; x < this->pict_last_rect.x2; x++) {
-      if (clip_rgn_it.check() && this->port->get_bounds().contains(x - this->pict_bounds.x1, y - this->pict_bounds.y1)) {
+  Rect fill_rect = this->clip_rect_to_port_bounds(this->pict_last_rect);
+  const auto& clip_rgn = this->port->get_clip_region();
+  vector<Region::Span> spans;
+  for (ssize_t y = fill_rect.y1; y < fill_rect.y2; y++) {
+    spans.clear();
+    Region::clip_spans(spans, clip_rgn.spans_for_row(y), fill_rect.x1, fill_rect.x2);
+    for (const auto& span : spans) {
+      for (ssize_t x = span.x1; x < span.x2; x++) {
         uint32_t color;
         if (use_pixel_pat) {
           color = pixel_pat.read(x % pixel_pat.get_width(), y % pixel_pat.get_height());
@@ -269,9 +288,7 @@ void QuickDrawEngine::pict_fill_current_rect_with_pattern(const Pattern& pat, co
         }
         this->port->write(x - this->pict_bounds.x1, y - this->pict_bounds.y1, color);
       }
-      clip_rgn_it.right();
     }
-    clip_rgn_it.next_line();
   }
 }
 
@@ -303,20 +320,22 @@ void QuickDrawEngine::pict_fill_last_oval(StringReader&, uint16_t) {
   double height = this->pict_last_rect.y2 - this->pict_last_rect.y1;
   auto fill_pat = this->port->get_fill_mono_pattern();
 
-  auto clip_rgn_it = this->port->get_clip_region().iterate(this->pict_last_rect);
-  for (ssize_t y = this->pict_last_rect.y1; y < this->pict_last_rect.y2; y++) {
-    for (ssize_t x = this->pict_last_rect.x1; x < this->pict_last_rect.x2; x++) {
-      double x_dist = (static_cast<double>(x) - x_center) / width;
-      double y_dist = (static_cast<double>(y) - y_center) / height;
-      if ((x_dist * x_dist + y_dist * y_dist <= 0.25) &&
-          clip_rgn_it.check() &&
-          this->port->get_bounds().contains(x - this->pict_bounds.x1, y - this->pict_bounds.y1)) {
-        uint32_t color = fill_pat.pixel_at(x - this->pict_bounds.x1, y - this->pict_bounds.y1) ? 0x000000FF : 0xFFFFFFFF;
-        this->port->write(x - this->pict_bounds.x1, y - this->pict_bounds.x1, color);
+  Rect fill_rect = this->clip_rect_to_port_bounds(this->pict_last_rect);
+  const auto& clip_rgn = this->port->get_clip_region();
+  vector<Region::Span> spans;
+  for (ssize_t y = fill_rect.y1; y < fill_rect.y2; y++) {
+    spans.clear();
+    Region::clip_spans(spans, clip_rgn.spans_for_row(y), fill_rect.x1, fill_rect.x2);
+    for (const auto& span : spans) {
+      for (ssize_t x = span.x1; x < span.x2; x++) {
+        double x_dist = (static_cast<double>(x) - x_center) / width;
+        double y_dist = (static_cast<double>(y) - y_center) / height;
+        if (x_dist * x_dist + y_dist * y_dist <= 0.25) {
+          uint32_t color = fill_pat.pixel_at(x - this->pict_bounds.x1, y - this->pict_bounds.y1) ? 0x000000FF : 0xFFFFFFFF;
+          this->port->write(x - this->pict_bounds.x1, y - this->pict_bounds.x1, color);
+        }
       }
-      clip_rgn_it.right();
     }
-    clip_rgn_it.next_line();
   }
 }
 
@@ -328,12 +347,19 @@ void QuickDrawEngine::pict_fill_oval(StringReader& r, uint16_t opcode) {
 // Bits opcodes
 
 string QuickDrawEngine::unpack_bits(StringReader& r, size_t row_count,
-    uint16_t row_bytes, bool sizes_are_words, bool chunks_are_words) {
+    uint16_t row_bytes, bool sizes_are_words, bool chunks_are_words,
+    size_t start_row, size_t end_row) {
   string ret;
-  size_t expected_size = row_bytes * row_count;
-  ret.reserve(expected_size);
+  ret.reserve(row_bytes * (end_row - start_row));
 
+  // Every row has to be unpacked to find where the next one begins, but rows
+  // outside the requested range are unpacked into a temporary buffer, which is
+  // then discarded
+  string skipped_row;
   for (size_t y = 0; y < row_count; y++) {
+    string& row = ((y >= start_row) && (y < end_row)) ? ret : skipped_row;
+    skipped_row.clear();
+    size_t row_start_size = row.size();
     uint16_t packed_row_bytes = sizes_are_words ? r.get_u16b() : r.get_u8();
     for (size_t row_end_offset = r.where() + packed_row_bytes; r.where() < row_end_offset;) {
       int16_t count = r.get_s8();
@@ -341,41 +367,37 @@ string QuickDrawEngine::unpack_bits(StringReader& r, size_t row_count,
         if (chunks_are_words) {
           uint16_t value = r.get_u16b();
           for (ssize_t x = 0; x < -(count - 1); x++) {
-            ret.push_back((value >> 8) & 0xFF);
-            ret.push_back(value & 0xFF);
+            row.push_back((value >> 8) & 0xFF);
+            row.push_back(value & 0xFF);
           }
         } else {
-          ret.insert(ret.size(), -(count - 1), r.get_u8());
+          row.insert(row.size(), -(count - 1), r.get_u8());
         }
       } else { // Direct segment
         if (chunks_are_words) {
-          ret += r.read((count + 1) * 2);
+          row += r.read((count + 1) * 2);
         } else {
-          ret += r.read(count + 1);
+          row += r.read(count + 1);
         }
       }
     }
-    if (ret.size() != static_cast<size_t>(row_bytes * (y + 1))) {
+    if (row.size() - row_start_size != row_bytes) {
       throw runtime_error(std::format("packed data size is incorrect on row {} at offset {:X} (expected {:X}, have {:X})",
-          y, r.where(), row_bytes * (y + 1), ret.size()));
+          y, r.where(), row_bytes, row.size() - row_start_size));
     }
   }
-  if (row_bytes * row_count != ret.size()) {
-    throw runtime_error(std::format("unpacked data size is incorrect (expected {:X}, have {:X})",
-        row_bytes * row_count, ret.size()));
-  }
   return ret;
 }
 
 string QuickDrawEngine::unpack_bits(StringReader& r, size_t row_count,
-    uint16_t row_bytes, bool chunks_are_words) {
+    uint16_t row_bytes, bool chunks_are_words, size_t start_row, size_t end_row) {
   size_t start_offset = r.where();
   string failure_strs[2];
   for (size_t x = 0; x < 2; x++) {
     try {
       // If row_bytes > 250, word sizes are most likely to be correct, so try
       // that first
-      return unpack_bits(r, row_count, row_bytes, x ^ (row_bytes > 250), chunks_are_words);
+      return unpack_bits(r, row_count, row_bytes, x ^ (row_bytes > 250), chunks_are_words, start_row, end_row);
     } catch (const exception& e) {
       failure_strs[x ^ (row_bytes > 250)] = e.what();
       r.go(start_offset);
@@ -385,6 +407,33 @@ string QuickDrawEngine::unpack_bits(StringReader& r, size_t row_count,
       failure_strs[0], failure_strs[1]));
 }
 
+string QuickDrawEngine::read_rows(StringReader& r, size_t row_count,
+    uint16_t row_bytes, size_t start_row, size_t end_row) {
+  if (r.remaining() < row_count * row_bytes) {
+    throw out_of_range("not enough data for all rows of bitmap");
+  }
+  r.skip(start_row * row_bytes);
+  string ret = r.read((end_row - start_row) * row_bytes);
+  r.skip((row_count - end_row) * row_bytes);
+  return ret;
+}
+
+pair<size_t, size_t> QuickDrawEngine::source_rows_for_copy(
+    const Rect& bounds, const Rect& source_rect, const Rect& dest_rect) const {
+  // Returns the range of rows of the source bitmap (relative to its bounds)
+  // that are within source_rect and will be drawn within the port's drawn
+  // rows. Source row y is drawn at port row y + dest_offset.
+  auto drawn_rows = this->port->get_drawn_rows();
+  ssize_t dest_offset = dest_rect.y1 - this->pict_bounds.y1 + bounds.y1 - source_rect.y1;
+  ssize_t height = bounds.height();
+  ssize_t y1 = clamp<ssize_t>(max<ssize_t>(source_rect.y1 - bounds.y1, drawn_rows.first - dest_offset), 0, height);
+  ssize_t y2 = clamp<ssize_t>(min<ssize_t>(source_rect.y2 - bounds.y1, drawn_rows.second - dest_offset), 0, height);
+  if (y1 >= y2) {
+    return make_pair(0, 0);
+  }
+  return make_pair(y1, y2);
+}
+
 void QuickDrawEngine::pict_copy_bits_indexed_color(StringReader& r, uint16_t opcode) {
   bool is_packed = opcode & 0x08;
   bool has_mask_region = opcode & 0x01;
@@ -419,11 +468,23 @@ void QuickDrawEngine::pict_copy_bits_indexed_color(StringReader& r, uint16_t opc
       mask_region = make_shared<Region>(r);
     }
 
+    // Only the rows that will actually be drawn are decoded; source_image
+    // begins at source row start_row
+    auto [start_row, end_row] = this->source_rows_for_copy(bounds, source_rect, dest_rect);
     uint16_t row_bytes = header.flags_row_bytes & 0x7FFF;
-    string data = is_packed ? unpack_bits(r, header.bounds.height(), row_bytes, header.pixel_size == 0x10) : r.read(header.bounds.height() * row_bytes);
+    string data = is_packed
+        ? unpack_bits(r, header.bounds.height(), row_bytes, header.pixel_size == 0x10, start_row, end_row)
+        : read_rows(r, header.bounds.height(), row_bytes, start_row, end_row);
+    if (start_row == end_row) {
+      return;
+    }
     const PixelMapData* pixel_map = reinterpret_cast<const PixelMapData*>(data.data());
 
-    source_image = decode_color_image(header, *pixel_map, &ctable);
+    PixelMapHeader rows_header = header;
+    rows_header.bounds.y1 = header.bounds.y1 + start_row;
+    rows_header.bounds.y2 = header.bounds.y1 + end_row;
+    source_image = decode_color_image(rows_header, *pixel_map, &ctable);
+    bounds.y1 = rows_header.bounds.y1;
 
   } else {
     const auto& args = r.get<PictCopyBitsMonochromeArgs>();
@@ -446,11 +507,18 @@ void QuickDrawEngine::pict_copy_bits_indexed_color(StringReader& r, uint16_t opc
       mask_region = make_shared<Region>(r);
     }
 
-    string data = is_packed ? unpack_bits(r, args.header.bounds.height(), args.header.flags_row_bytes, false) : r.read(args.header.bounds.height() * args.header.flags_row_bytes);
+    auto [start_row, end_row] = this->source_rows_for_copy(bounds, source_rect, dest_rect);
+    string data = is_packed
+        ? unpack_bits(r, args.header.bounds.height(), args.header.flags_row_bytes, false, start_row, end_row)
+        : read_rows(r, args.header.bounds.height(), args.header.flags_row_bytes, start_row, end_row);
+    if (start_row == end_row) {
+      return;
+    }
     auto mono_source_image = decode_monochrome_image(data.data(), data.size(),
-        args.header.bounds.width(), args.header.bounds.height(),
+        args.header.bounds.width(), end_row - start_row,
         args.header.flags_row_bytes);
     source_image = mono_source_image.convert_monochrome_to_color(0xFFFFFFFF, 0x000000FF);
+    bounds.y1 = args.header.bounds.y1 + start_row;
   }
 
   // TODO: the clipping region should apply here too
@@ -498,17 +566,31 @@ void QuickDrawEngine::pict_packed_copy_bits_direct_color(StringReader& r, uint16
     throw runtime_error("only 8-bit and 5-bit channels are supported");
   }
   size_t row_bytes = args.header.bounds.width() * bytes_per_pixel;
-  string data = unpack_bits(r, args.header.bounds.height(), row_bytes, args.header.pixel_size == 0x10);
+  // This opcode draws source row y (relative to the bounds) at dest_rect.y1 +
+  // y, regardless of source_rect.y1
+  Rect rows_source_rect(args.header.bounds.y1, args.source_rect.x1,
+      args.header.bounds.y1 + args.dest_rect.height(), args.source_rect.x2);
+  auto [start_row, end_row] = this->source_rows_for_copy(args.header.bounds, rows_source_rect, args.dest_rect);
+  string data = unpack_bits(r, args.header.bounds.height(), row_bytes, args.header.pixel_size == 0x10, start_row, end_row);
 
-  auto clip_region_it = this->port->get_clip_region().iterate(args.dest_rect);
   // TODO: The mask region is in dest-space, right?
-  auto mask_region_it = mask_region.iterate(args.dest_rect);
-
-  for (ssize_t y = 0; y < args.source_rect.height(); y++) {
-    size_t row_offset = row_bytes * y;
-
-    for (ssize_t x = 0; x < args.source_rect.width(); x++) {
-      if (this->port->get_bounds().contains(x + args.dest_rect.x1 - this->pict_bounds.x1, y + args.dest_rect.y1 - this->pict_bounds.y1) && clip_region_it.check() && mask_region_it.check()) {
+  Rect copy_rect = this->clip_rect_to_port_bounds(args.dest_rect);
+  // Only the rows that were decoded can be drawn
+  ssize_t first_decoded_dest_y = args.dest_rect.y1 + static_cast<ssize_t>(start_row);
+  copy_rect.y1 = max<ssize_t>(copy_rect.y1, first_decoded_dest_y);
+  copy_rect.y2 = min<ssize_t>(copy_rect.y2, first_decoded_dest_y + static_cast<ssize_t>(end_row - start_row));
+  const auto& clip_rgn = this->port->get_clip_region();
+  vector<Region::Span> region_spans;
+  vector<Region::Span> spans;
+  for (ssize_t dest_y = copy_rect.y1; dest_y < copy_rect.y2; dest_y++) {
+    region_spans.clear();
+    Region::intersect_spans(region_spans, clip_rgn.spans_for_row(dest_y), mask_region.spans_for_row(dest_y));
+    spans.clear();
+    Region::clip_spans(spans, region_spans, copy_rect.x1, copy_rect.x2);
+
+    size_t row_offset = row_bytes * (dest_y - first_decoded_dest_y);
+    for (const auto& span : spans) {
+      for (ssize_t x = span.x1 - args.dest_rect.x1; x < span.x2 - args.dest_rect.x1; x++) {
         uint32_t color;
         if ((args.header.component_size == 8) && (args.header.component_count == 3)) {
           color = rgba8888(
@@ -528,15 +610,9 @@ void QuickDrawEngine::pict_packed_copy_bits_direct_color(StringReader& r, uint16
         } else {
           throw logic_error("unimplemented channel width");
         }
-        this->port->write(x + args.dest_rect.x1 - this->pict_bounds.x1, y + args.dest_rect.y1 - this->pict_bounds.y1, color);
+        this->port->write(x + args.dest_rect.x1 - this->pict_bounds.x1, dest_y - this->pict_bounds.y1, color);
       }
-
-      clip_region_it.right();
-      mask_region_it.right();
     }
-
-    clip_region_it.next_line();
-    mask_region_it.next_line();
   }
 }
 
@@ -45,6 +45,13 @@ public:
       std::shared_ptr<Region> mask = nullptr,
       ssize_t mask_origin_x = 0,
       ssize_t mask_origin_y = 0) = 0;
+  // Returns the range of rows [first, end) that writes and blits can affect.
+  // Ports that only store some of the image's rows (e.g. when rendering a
+  // large picture in bands) return a smaller range, so the engine can skip
+  // decoding source data that would only be drawn outside it.
+  virtual std::pair<ssize_t, ssize_t> get_drawn_rows() const {
+    return std::make_pair(0, this->height());
+  }
 
   // External resource data accessors
   virtual std::vector<ColorTableEntry> read_clut(int16_t id) = 0;
@@ -184,6 +191,7 @@ protected:
   void pict_set_op_color(StringReader& r, uint16_t opcode);
   void pict_set_default_highlight_color(StringReader& r, uint16_t opcode);
 
+  Rect clip_rect_to_port_bounds(const Rect& rect) const;
   void pict_fill_current_rect_with_pattern(const Pattern& pat, const ImageRGB888& pixel_pat);
   void pict_erase_last_rect(StringReader& r, uint16_t opcode);
   void pict_erase_rect(StringReader& r, uint16_t opcode);
@@ -192,10 +200,17 @@ protected:
   void pict_fill_last_oval(StringReader& r, uint16_t opcode);
   void pict_fill_oval(StringReader& r, uint16_t opcode);
 
+  // These read all row_count rows from r, but only return the data for rows
+  // start_row through end_row - 1
   static std::string unpack_bits(StringReader& r, size_t row_count,
-      uint16_t row_bytes, bool sizes_are_words, bool chunks_are_words);
+      uint16_t row_bytes, bool sizes_are_words, bool chunks_are_words,
+      size_t start_row, size_t end_row);
   static std::string unpack_bits(StringReader& r, size_t row_count,
-      uint16_t row_bytes, bool chunks_are_words);
+      uint16_t row_bytes, bool chunks_are_words, size_t start_row, size_t end_row);
+  static std::string read_rows(StringReader& r, size_t row_count,
+      uint16_t row_bytes, size_t start_row, size_t end_row);
+  std::pair<size_t, size_t> source_rows_for_copy(
+      const Rect& bounds, const Rect& source_rect, const Rect& dest_rect) const;
 
   void pict_copy_bits_indexed_color(StringReader& r, uint16_t opcode);
   void pict_packed_copy_bits_direct_color(StringReader& r, uint16_t opcode);
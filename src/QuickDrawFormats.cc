@@ -8,7 +8,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <exception>
+#include <iterator>
 #include <phosg/Encoding.hh>
 #include <phosg/Filesystem.hh>
 #include <phosg/Image.hh>
@@ -145,9 +147,65 @@ Region::Region(StringReader& r) {
   if (r.where() != start_offset + size) {
     throw runtime_error("region ends before all data is parsed");
   }
+
+  this->compute_bands();
+}
+
+Region::Region(const Rect& r) : rect(r) {
+  this->compute_bands();
 }
 
-Region::Region(const Rect& r) : rect(r) {}
+void Region::compute_bands() {
+  this->bands.clear();
+  if ((this->rect.width() <= 0) || (this->rect.height() <= 0)) {
+    return;
+  }
+
+  if (this->inversions.empty()) {
+    this->bands.emplace_back(Band{this->rect.y1, this->rect.y2, {Span{this->rect.x1, this->rect.x2}}});
+    return;
+  }
+
+  vector<int16_t> row_inversions;
+  vector<int16_t> prev_row_inversions;
+  for (auto row_it = this->inversions.begin(); row_it != this->inversions.end(); row_it++) {
+    // The inversion points on each row are the same as the previous row's
+    // points xor'd with the new row's points. These apply to all rows until the
+    // next row that has any inversion points.
+    prev_row_inversions.swap(row_inversions);
+    row_inversions.clear();
+    set_symmetric_difference(
+        prev_row_inversions.begin(), prev_row_inversions.end(),
+        row_it->second.begin(), row_it->second.end(),
+        back_inserter(row_inversions));
+
+    auto next_row_it = next(row_it);
+    int16_t band_y1 = max<int16_t>(row_it->first, this->rect.y1);
+    int16_t band_y2 = (next_row_it == this->inversions.end())
+        ? this->rect.y2
+        : min<int16_t>(next_row_it->first, this->rect.y2);
+    if (band_y1 >= band_y2) {
+      continue;
+    }
+
+    // Each pair of inversion points enters and then leaves the region. If
+    // there's an odd number of points, the last span ends at the right edge of
+    // the rect.
+    Band band{band_y1, band_y2, {}};
+    for (size_t z = 0; z < row_inversions.size(); z += 2) {
+      int16_t x1 = max<int16_t>(row_inversions[z], this->rect.x1);
+      int16_t x2 = (z + 1 < row_inversions.size())
+          ? min<int16_t>(row_inversions[z + 1], this->rect.x2)
+          : this->rect.x2;
+      if (x1 < x2) {
+        band.spans.emplace_back(Span{x1, x2});
+      }
+    }
+    if (!band.spans.empty()) {
+      this->bands.emplace_back(std::move(band));
+    }
+  }
+}
 
 string Region::serialize() const {
   StringWriter w;
@@ -177,18 +235,64 @@ bool Region::is_inversion_point(int16_t x, int16_t y) const {
   }
 }
 
+const vector<Region::Span>& Region::spans_for_row(ssize_t y) const {
+  static const vector<Span> empty_spans;
+  auto band_it = upper_bound(this->bands.begin(), this->bands.end(), y, +[](ssize_t y, const Band& band) -> bool {
+    return y < band.y1;
+  });
+  if (band_it == this->bands.begin()) {
+    return empty_spans;
+  }
+  band_it--;
+  return (y < band_it->y2) ? band_it->spans : empty_spans;
+}
+
+void Region::clip_spans(vector<Span>& ret, const vector<Span>& spans, ssize_t x1, ssize_t x2) {
+  for (const auto& span : spans) {
+    if (span.x2 <= x1) {
+      continue;
+    }
+    if (span.x1 >= x2) {
+      break;
+    }
+    ret.emplace_back(Span{
+        static_cast<int16_t>(max<ssize_t>(span.x1, x1)),
+        static_cast<int16_t>(min<ssize_t>(span.x2, x2))});
+  }
+}
+
+void Region::intersect_spans(vector<Span>& ret, const vector<Span>& a, const vector<Span>& b) {
+  auto a_it = a.begin();
+  auto b_it = b.begin();
+  while ((a_it != a.end()) && (b_it != b.end())) {
+    int16_t x1 = max<int16_t>(a_it->x1, b_it->x1);
+    int16_t x2 = min<int16_t>(a_it->x2, b_it->x2);
+    if (x1 < x2) {
+      ret.emplace_back(Span{x1, x2});
+    }
+    // Advance whichever span ends first; the other may still overlap the next
+    // span in the other list
+    if (a_it->x2 < b_it->x2) {
+      a_it++;
+    } else {
+      b_it++;
+    }
+  }
+}
+
 ImageG1 Region::render() const {
   size_t width = this->rect.width();
   size_t height = this->rect.height();
-  ImageG1 ret(width, height);
+  ImageG1 ret(width, height, 0xFFFFFFFF);
 
-  auto it = this->iterate();
-  for (size_t y = 0; y < height; y++) {
-    for (size_t x = 0; x < width; x++) {
-      ret.write(x, y, it.check() ? 0x000000FF : 0xFFFFFFFF);
-      it.right();
+  for (const auto& band : this->bands) {
+    for (ssize_t y = band.y1; y < band.y2; y++) {
+      for (const auto& span : band.spans) {
+        for (ssize_t x = span.x1; x < span.x2; x++) {
+          ret.write(x - this->rect.x1, y - this->rect.y1, 0x000000FF);
+        }
+      }
     }
-    it.next_line();
   }
 
   return ret;
@@ -207,69 +311,35 @@ Region::Iterator::Iterator(const Region* region) : Iterator(region, region->rect
 Region::Iterator::Iterator(const Region* region, const Rect& target_rect)
     : region(region),
       target_rect(target_rect),
-      // Note: We don't have to initialize x since we call next_line() at the end
-      // of the constructor
-      y(min<ssize_t>(this->region->rect.y1, this->target_rect.y1) - 1),
-      region_is_rect(this->region->inversions.empty()),
-      current_loc_in_region(false),
-      inversions_row_it(this->region->inversions.begin()),
-      current_row_it(this->current_row_inversions.begin()) {
-  while (this->y < this->target_rect.y1) {
-    this->advance_y();
-  }
+      // Note: We don't have to initialize x or the span state since we call
+      // reset_x() at the end of the constructor
+      y(this->target_rect.y1),
+      current_row_spans(&this->region->spans_for_row(this->y)) {
   this->reset_x();
 }
 
 void Region::Iterator::right() {
   this->x++;
 
-  // If we've moved off the right edge of the rect, we've left the region
-  if (this->x == this->region->rect.x2) {
-    this->current_loc_in_region = false;
-
-    // If we've moved onto the left edge of the rect and the region has no
-    // inversion points, then we are now in the region
-  } else if (this->region_is_rect &&
-      (this->x == this->region->rect.x1) &&
-      (this->y >= this->region->rect.y1) &&
-      (this->y < this->region->rect.y2)) {
-    this->current_loc_in_region = true;
-
-    // If we've hit an inversion point, we have entered or left the region
-  } else if ((this->current_row_it != this->current_row_inversions.end()) && (*this->current_row_it == this->x)) {
-    this->current_loc_in_region = !this->current_loc_in_region;
-    this->current_row_it++;
-  }
-}
-
-void Region::Iterator::advance_y() {
-  this->y++;
-
-  // The inversion points on this row are the same as the previous row's points
-  // xor'd with the new row's points (if any)
-  if ((this->inversions_row_it != this->region->inversions.end()) &&
-      (this->inversions_row_it->first == this->y)) {
-    for (int16_t inv_x : this->inversions_row_it->second) {
-      auto emplace_ret = this->current_row_inversions.emplace(inv_x);
-      if (!emplace_ret.second) {
-        this->current_row_inversions.erase(emplace_ret.first);
-      }
-    }
-    this->inversions_row_it++;
+  // Skip any spans that end at or before the current position; the current
+  // location is in the region if it's within the next remaining span
+  const auto& spans = *this->current_row_spans;
+  while ((this->current_span_index < spans.size()) && (spans[this->current_span_index].x2 <= this->x)) {
+    this->current_span_index++;
   }
+  this->current_loc_in_region = (this->current_span_index < spans.size()) &&
+      (spans[this->current_span_index].x1 <= this->x);
 }
 
 void Region::Iterator::reset_x() {
-  this->x = min<ssize_t>(this->region->rect.x1, this->target_rect.x1) - 1;
-  this->current_loc_in_region = false;
-  this->current_row_it = this->current_row_inversions.begin();
-  while (this->x < this->target_rect.x1) {
-    this->right();
-  }
+  this->x = this->target_rect.x1 - 1;
+  this->current_span_index = 0;
+  this->right();
 }
 
 void Region::Iterator::next_line() {
-  this->advance_y();
+  this->y++;
+  this->current_row_spans = &this->region->spans_for_row(this->y);
   this->reset_x();
 }
 
@@ -397,6 +467,51 @@ const vector<Color8> default_icon_color_table_8bit = {
 };
 // clang-format on
 
+// Expands one row of 1-, 2-, 4-, or 8-bit indexed pixels into one byte per
+// pixel, so callers can look up colors without extracting bits per pixel
+static void expand_indexed_row(uint8_t* dest, const uint8_t* src, size_t w, uint16_t pixel_size) {
+  switch (pixel_size) {
+    case 1:
+      for (size_t x = 0; x < w; x++) {
+        dest[x] = (src[x >> 3] >> (7 - (x & 7))) & 1;
+      }
+      break;
+    case 2:
+      for (size_t x = 0; x < w; x++) {
+        dest[x] = (src[x >> 2] >> (6 - ((x & 3) << 1))) & 3;
+      }
+      break;
+    case 4:
+      for (size_t x = 0; x < w; x++) {
+        dest[x] = (src[x >> 1] >> ((x & 1) ? 0 : 4)) & 15;
+      }
+      break;
+    case 8:
+      memcpy(dest, src, w);
+      break;
+    default:
+      throw runtime_error("pixel size is not 1, 2, 4, 8, 16, or 32 bits");
+  }
+}
+
+// Builds a table of RGBA colors for all 8-bit pixel values. If clut is null,
+// the table is a grayscale ramp over max_index + 1 values. Returns the number
+// of valid entries in the table; indexes beyond this aren't in the clut.
+static size_t make_clut_lut(uint32_t* lut, const vector<Color8>* clut, size_t max_index) {
+  if (clut) {
+    size_t count = min<size_t>(clut->size(), 0x100);
+    for (size_t z = 0; z < count; z++) {
+      lut[z] = (*clut)[z].rgba8888();
+    }
+    return count;
+  } else {
+    for (size_t z = 0; z <= max_index; z++) {
+      lut[z] = rgba8888_gray((z * 0xFF) / max_index);
+    }
+    return max_index + 1;
+  }
+}
+
 ImageRGB888 decode_4bit_image(const void* vdata, size_t size, size_t w, size_t h, const vector<Color8>* clut) {
   if (w & 1) {
     throw runtime_error("width is not even");
@@ -407,21 +522,19 @@ ImageRGB888 decode_4bit_image(const void* vdata, size_t size, size_t w, size_t h
   }
   const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
 
+  uint32_t lut[0x100];
+  size_t lut_count = make_clut_lut(lut, clut, 0x0F);
+  vector<uint8_t> indexes(w);
+
   ImageRGB888 result(w, h);
   for (size_t y = 0; y < h; y++) {
-    for (size_t x = 0; x < w; x += 2) {
-      uint8_t indexes = data[y * w / 2 + x / 2];
-      if (clut) {
-        const Color8& left_c = clut->at((indexes >> 4) & 0x0F);
-        const Color8& right_c = clut->at(indexes & 0x0F);
-        result.write(x, y, left_c.rgba8888());
-        result.write(x + 1, y, right_c.rgba8888());
-      } else {
-        uint8_t left_v = (indexes & 0xF0) | ((indexes & 0xF0) >> 4);
-        uint8_t right_v = ((indexes & 0x0F) << 4) | (indexes & 0x0F);
-        result.write(x, y, rgba8888_gray(left_v));
-        result.write(x + 1, y, rgba8888_gray(right_v));
+    expand_indexed_row(indexes.data(), &data[y * w / 2], w, 4);
+    for (size_t x = 0; x < w; x++) {
+      uint8_t index = indexes[x];
+      if (index >= lut_count) {
+        throw out_of_range(std::format("color {:X} not in clut", index));
       }
+      result.write(x, y, lut[index]);
     }
   }
 
@@ -435,14 +548,18 @@ ImageRGB888 decode_8bit_image(const void* vdata, size_t size, size_t w, size_t h
   }
   const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
 
+  uint32_t lut[0x100];
+  size_t lut_count = make_clut_lut(lut, clut, 0xFF);
+
   ImageRGB888 result(w, h);
   for (size_t y = 0; y < h; y++) {
+    const uint8_t* row = &data[y * w];
     for (size_t x = 0; x < w; x++) {
-      if (clut) {
-        result.write(x, y, clut->at(data[y * w + x]).rgba8888());
-      } else {
-        result.write(x, y, rgba8888_gray(data[y * w + x]));
+      uint8_t index = row[x];
+      if (index >= lut_count) {
+        throw out_of_range(std::format("color {:X} not in clut", index));
       }
+      result.write(x, y, lut[index]);
     }
   }
 
@@ -544,10 +661,88 @@ Image<Format> decode_color_image_t(
 
   size_t width = header.bounds.width();
   size_t height = header.bounds.height();
+  size_t row_bytes = header.flags_row_bytes & 0x3FFF;
   Image<Format> img(width, height);
+
+  // Indexed-color images with up to 8 bits per pixel (which is almost all of
+  // them) are decoded a row at a time through a table with the color for each
+  // possible index, so we don't have to search the color table for each pixel
+  if ((header.pixel_type == 0) && (header.pixel_size <= 8)) {
+    // colors has the color to use for each index, and masked_colors has the
+    // color to use if the pixel is masked out (which is different only for
+    // colors from the color table)
+    uint32_t colors[0x100];
+    uint32_t masked_colors[0x100];
+    bool color_valid[0x100] = {};
+    if (ctable->flags & 0x8000) {
+      for (int32_t z = 0; (z <= ctable->num_entries) && (z < 0x100); z++) {
+        colors[z] = ctable->entries[z].c.rgba8888(0xFF);
+        masked_colors[z] = ctable->entries[z].c.rgba8888(0x00);
+        color_valid[z] = true;
+      }
+    } else {
+      // get_entry returns the first matching entry, so entries earlier in the
+      // table take precedence here too
+      for (int32_t z = ctable->num_entries; z >= 0; z--) {
+        const auto& e = ctable->entries[z];
+        if (e.color_num < 0x100) {
+          colors[e.color_num] = e.c.rgba8888(0xFF);
+          masked_colors[e.color_num] = e.c.rgba8888(0x00);
+          color_valid[e.color_num] = true;
+        }
+      }
+    }
+    // Some rare pixmaps appear to use 0xFF as black, so we handle that
+    // manually here. TODO: figure out if this is the right behavior
+    size_t max_index = (1 << header.pixel_size) - 1;
+    if (!color_valid[max_index]) {
+      colors[max_index] = 0x000000FF;
+      masked_colors[max_index] = 0x000000FF;
+      color_valid[max_index] = true;
+    }
+
+    vector<uint8_t> indexes(width);
+    vector<uint8_t> mask_values(mask_map ? width : 0);
+    for (size_t y = 0; y < height; y++) {
+      expand_indexed_row(indexes.data(), &pixel_map.data[y * row_bytes], width, header.pixel_size);
+      if (mask_map) {
+        expand_indexed_row(mask_values.data(), &mask_map->data[y * mask_row_bytes], width, 1);
+      }
+      for (size_t x = 0; x < width; x++) {
+        uint8_t index = indexes[x];
+        if (!color_valid[index]) {
+          throw runtime_error(std::format("color {:X} not found in color map", index));
+        }
+        img.write(x, y, (mask_map && !mask_values[x]) ? masked_colors[index] : colors[index]);
+      }
+    }
+    return img;
+  }
+
+  // Direct-color images are also decoded a row at a time, so we don't have to
+  // check the pixel format for each pixel
+  if ((header.pixel_type == 0x0010) && (header.pixel_size == 0x0010)) {
+    for (size_t y = 0; y < height; y++) {
+      const be_uint16_t* row = reinterpret_cast<const be_uint16_t*>(&pixel_map.data[y * row_bytes]);
+      for (size_t x = 0; x < width; x++) {
+        img.write(x, y, rgba8888_for_xrgb1555(row[x]));
+      }
+    }
+    return img;
+  }
+  if ((header.pixel_type == 0x0010) && (header.pixel_size == 0x0020)) {
+    for (size_t y = 0; y < height; y++) {
+      const be_uint32_t* row = reinterpret_cast<const be_uint32_t*>(&pixel_map.data[y * row_bytes]);
+      for (size_t x = 0; x < width; x++) {
+        img.write(x, y, rgba8888_for_argb8888(row[x]) | 0x000000FF);
+      }
+    }
+    return img;
+  }
+
   for (size_t y = 0; y < height; y++) {
     for (size_t x = 0; x < width; x++) {
-      uint32_t color_id = pixel_map.lookup_entry(header.pixel_size, header.flags_row_bytes & 0x3FFF, x, y);
+      uint32_t color_id = pixel_map.lookup_entry(header.pixel_size, row_bytes, x, y);
 
       if (header.pixel_type == 0) {
         const auto* e = ctable->get_entry(color_id);
@@ -48,6 +48,24 @@ struct Region {
   Rect rect;
   std::map<int16_t, std::set<int16_t>> inversions;
 
+  // A horizontal run of pixels in the region, from x1 (inclusive) to x2
+  // (exclusive)
+  struct Span {
+    int16_t x1;
+    int16_t x2;
+  };
+  // A range of rows, from y1 (inclusive) to y2 (exclusive), which all contain
+  // the same spans. The spans are sorted and don't overlap or touch each other.
+  struct Band {
+    int16_t y1;
+    int16_t y2;
+    std::vector<Span> spans;
+  };
+  // The region's contents, computed from rect and inversions by the
+  // constructors. Bands are sorted and don't overlap; rows not covered by any
+  // band are entirely outside the region.
+  std::vector<Band> bands;
+
   Region(StringReader& r);
   Region(const Rect& r);
 
@@ -55,6 +73,15 @@ struct Region {
 
   bool is_inversion_point(int16_t x, int16_t y) const;
 
+  // Returns the spans on the given row. If the row is entirely outside the
+  // region, returns an empty vector.
+  const std::vector<Span>& spans_for_row(ssize_t y) const;
+  // Appends the parts of spans that are within [x1, x2) to ret.
+  static void clip_spans(std::vector<Span>& ret, const std::vector<Span>& spans, ssize_t x1, ssize_t x2);
+  // Appends the intersection of a and b (both of which must be sorted and not
+  // overlap) to ret.
+  static void intersect_spans(std::vector<Span>& ret, const std::vector<Span>& a, const std::vector<Span>& b);
+
   ImageG1 render() const;
 
   class Iterator {
@@ -76,19 +103,19 @@ struct Region {
     Rect target_rect;
     int32_t x;
     int32_t y;
-    bool region_is_rect;
     bool current_loc_in_region;
 
-    std::map<int16_t, std::set<int16_t>>::const_iterator inversions_row_it;
-    std::set<int16_t> current_row_inversions;
-    std::set<int16_t>::const_iterator current_row_it;
+    const std::vector<Span>* current_row_spans;
+    size_t current_span_index;
 
-    void advance_y();
     void reset_x();
   };
 
   Iterator iterate() const;
   Iterator iterate(const Rect& rect) const;
+
+private:
+  void compute_bands();
 };
 
 extern const std::vector<Color8> default_icon_color_table_4bit;
@@ -3,6 +3,8 @@
 #include <stdint.h>
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "ResourceFile.hh"
 
@@ -22,9 +24,52 @@ enum DecompressionFlag {
   SKIP_NATIVE = 0x0100, // Don't use native decompressors
   RETRY = 0x0200, // Decompress even if res has DECOMPRESSION_FAILED flag
   STRICT_MEMORY = 0x0400, // Don't allow unallocated memory access
+  DISABLE_BLOCK_CACHE = 0x0800, // Run dcmp/ncmp resources without caching decoded code (slower)
 };
 
+// Enables the on-disk cache for emulated decompressors. When a resource would be
+// decompressed by running a dcmp or ncmp under emulation, the result is saved
+// in this directory, and later calls (including in later runs) that would run
+// the same decompressors on the same data read the result from the cache
+// instead. If dir is empty (the default), the cache is not used. This function
+// is not thread-safe; it should be called before any resources are
+// decompressed.
+void set_decompression_cache_directory(const std::string& dir);
+
+// Describes what decompress_resource did to decompress a resource. If it
+// throws, the fields describe the implementations that were tried.
+struct DecompressionStats {
+  int16_t dcmp_resource_id = 0;
+  std::string implementation_name; // Empty if no implementation succeeded
+  bool is_emulated = false; // Whether the successful implementation is emulated
+  bool used_cache = false; // Result came from the decompression cache
+  size_t num_attempts = 0;
+  uint64_t emulated_cycles = 0; // Summed over all emulated implementations tried
+  uint64_t duration_usecs = 0;
+};
+
+// If stats is not null, it is overwritten with information about how the
+// resource was decompressed (even if this function throws).
 std::shared_ptr<ResourceFile::Resource> decompress_resource(
+    std::shared_ptr<const ResourceFile::Resource> res,
+    uint64_t flags,
+    const ResourceFile* context_rf,
+    DecompressionStats* stats = nullptr);
+
+struct DecompressionImplementationResult {
+  std::string implementation_name; // "native", "system dcmp", "file ncmp", etc.
+  bool is_emulated;
+  bool succeeded;
+  std::string data; // Decompressed data if succeeded; error message otherwise
+  uint64_t duration_usecs;
+};
+
+// Decompresses the resource with every available implementation (subject to
+// the SKIP_* flags), in the same order decompress_resource would try them. This
+// doesn't stop when one implementation succeeds, and doesn't use the
+// decompression cache; it's intended for checking that the native
+// decompressors produce the same results as the emulated ones.
+std::vector<DecompressionImplementationResult> decompress_resource_with_all_implementations(
     std::shared_ptr<const ResourceFile::Resource> res,
     uint64_t flags,
     const ResourceFile* context_rf);
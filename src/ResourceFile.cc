@@ -11,6 +11,8 @@
 #include <algorithm>
 #include <deque>
 #include <exception>
+#include <future>
+#include <mutex>
 #include <phosg/Encoding.hh>
 #include <phosg/Filesystem.hh>
 #include <phosg/Image.hh>
@@ -19,6 +21,7 @@
 #include <phosg/Time.hh>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "AudioCodecs.hh"
@@ -106,7 +109,14 @@ ResourceFile::Resource::Resource(uint32_t type, int16_t id, uint16_t flags, stri
 
 ResourceFile::ResourceFile() : ResourceFile(IndexFormat::NONE) {}
 
-ResourceFile::ResourceFile(IndexFormat format) : format(format) {}
+ResourceFile::ResourceFile(IndexFormat format)
+    : format(format),
+      resource_state_locks(make_shared<ResourceStateLocks>()) {}
+
+ResourceFile::ResourceFile(IndexFormat format, shared_ptr<const MappedFile> data_source)
+    : format(format),
+      data_source(std::move(data_source)),
+      resource_state_locks(make_shared<ResourceStateLocks>()) {}
 
 bool ResourceFile::add(const Resource& res_obj) {
   auto res = make_shared<Resource>(res_obj);
@@ -119,6 +129,7 @@ bool ResourceFile::add(Resource&& res_obj) {
 }
 
 bool ResourceFile::add(shared_ptr<Resource> res) {
+  this->throw_if_frozen();
   uint64_t key = this->make_resource_key(res->type, res->id);
   auto emplace_ret = this->key_to_resource.emplace(key, res);
   if (emplace_ret.second) {
@@ -127,7 +138,24 @@ bool ResourceFile::add(shared_ptr<Resource> res) {
   return emplace_ret.second;
 }
 
+bool ResourceFile::add_lazy(
+    uint32_t type, int16_t id, uint16_t flags, string&& name, size_t data_offset, size_t data_size) {
+  this->throw_if_frozen();
+  if (!this->data_source) {
+    throw logic_error("cannot add lazily-loaded resource without a data source");
+  }
+  // Check the bounds now, so corrupt indexes fail at parse time instead of
+  // when the resource is first used
+  this->data_source->at(data_offset, data_size);
+
+  auto res = make_shared<Resource>(type, id, flags | ResourceFlag::FLAG_DATA_NOT_LOADED, std::move(name), string());
+  res->source_offset = data_offset;
+  res->source_size = data_size;
+  return this->add(res);
+}
+
 bool ResourceFile::change_id(uint32_t type, int16_t current_id, int16_t new_id) {
+  this->throw_if_frozen();
   uint64_t current_key = this->make_resource_key(type, current_id);
   uint64_t new_key = this->make_resource_key(type, new_id);
   auto it = this->key_to_resource.find(current_key);
@@ -144,6 +172,7 @@ bool ResourceFile::change_id(uint32_t type, int16_t current_id, int16_t new_id)
 }
 
 bool ResourceFile::rename(uint32_t type, int16_t id, const string& new_name) {
+  this->throw_if_frozen();
   if (new_name.size() > 0xFF) {
     throw invalid_argument("name must be 255 bytes or shorter");
   }
@@ -160,6 +189,7 @@ bool ResourceFile::rename(uint32_t type, int16_t id, const string& new_name) {
 }
 
 bool ResourceFile::remove(uint32_t type, int16_t id) {
+  this->throw_if_frozen();
   uint64_t key = this->make_resource_key(type, id);
   auto it = this->key_to_resource.find(key);
   if (it != this->key_to_resource.end()) {
@@ -170,19 +200,111 @@ bool ResourceFile::remove(uint32_t type, int16_t id) {
   return false;
 }
 
+void ResourceFile::freeze() {
+  if (this->frozen_resources) {
+    return;
+  }
+
+  // The name index holds references to the resources too; clear it first so
+  // we can tell which resources are referenced only by this ResourceFile
+  this->name_to_resource.clear();
+
+  auto resources = make_shared<vector<Resource>>();
+  resources->reserve(this->key_to_resource.size());
+  this->frozen_keys.reserve(this->key_to_resource.size());
+  for (auto& it : this->key_to_resource) {
+    // If no copy of this ResourceFile and no caller holds a reference to the
+    // resource, its contents can be moved instead of copied
+    if (it.second.use_count() == 1) {
+      resources->emplace_back(std::move(*it.second));
+    } else {
+      resources->emplace_back(*it.second);
+    }
+    this->frozen_keys.emplace_back(it.first);
+  }
+  this->key_to_resource.clear();
+
+  for (size_t z = 0; z < resources->size(); z++) {
+    if (!(*resources)[z].name.empty()) {
+      this->frozen_name_index.emplace_back(z);
+    }
+  }
+  stable_sort(this->frozen_name_index.begin(), this->frozen_name_index.end(), [&](uint32_t a, uint32_t b) -> bool {
+    return (*resources)[a].name < (*resources)[b].name;
+  });
+
+  this->frozen_resources = std::move(resources);
+}
+
+bool ResourceFile::is_frozen() const {
+  return !!this->frozen_resources;
+}
+
+void ResourceFile::throw_if_frozen() const {
+  if (this->frozen_resources) {
+    throw logic_error("cannot modify a frozen ResourceFile");
+  }
+}
+
+shared_ptr<ResourceFile::Resource> ResourceFile::frozen_resource(size_t index) const {
+  // This shares ownership of the entire array, so there's no separate control
+  // block for each resource
+  return shared_ptr<Resource>(this->frozen_resources, &(*this->frozen_resources)[index]);
+}
+
+ssize_t ResourceFile::frozen_index_for_key(uint64_t key) const {
+  auto it = lower_bound(this->frozen_keys.begin(), this->frozen_keys.end(), key);
+  return ((it != this->frozen_keys.end()) && (*it == key)) ? (it - this->frozen_keys.begin()) : -1;
+}
+
+pair<size_t, size_t> ResourceFile::frozen_index_range_for_type(uint32_t type) const {
+  uint64_t min_key = this->make_resource_key(type, MIN_RES_ID);
+  uint64_t max_key = this->make_resource_key(type, MAX_RES_ID);
+  auto begin_it = lower_bound(this->frozen_keys.begin(), this->frozen_keys.end(), min_key);
+  auto end_it = upper_bound(begin_it, this->frozen_keys.end(), max_key);
+  return make_pair(begin_it - this->frozen_keys.begin(), end_it - this->frozen_keys.begin());
+}
+
+pair<vector<uint32_t>::const_iterator, vector<uint32_t>::const_iterator>
+ResourceFile::frozen_name_index_range(const string& name) const {
+  const auto& resources = *this->frozen_resources;
+  auto begin_it = lower_bound(this->frozen_name_index.begin(), this->frozen_name_index.end(), name, [&](uint32_t index, const string& v) -> bool {
+    return resources[index].name < v;
+  });
+  auto end_it = upper_bound(begin_it, this->frozen_name_index.end(), name, [&](const string& v, uint32_t index) -> bool {
+    return v < resources[index].name;
+  });
+  return make_pair(begin_it, end_it);
+}
+
 IndexFormat ResourceFile::index_format() const {
   return this->format;
 }
 
 bool ResourceFile::empty() const {
+  if (this->frozen_resources) {
+    return this->frozen_keys.empty();
+  }
   return this->key_to_resource.empty();
 }
 
 bool ResourceFile::resource_exists(uint32_t type, int16_t id) const {
+  if (this->frozen_resources) {
+    return (this->frozen_index_for_key(this->make_resource_key(type, id)) >= 0);
+  }
   return this->key_to_resource.count(this->make_resource_key(type, id));
 }
 
 bool ResourceFile::resource_exists(uint32_t type, const char* name) const {
+  if (this->frozen_resources) {
+    auto its = this->frozen_name_index_range(name);
+    for (; its.first != its.second; its.first++) {
+      if ((*this->frozen_resources)[*its.first].type == type) {
+        return true;
+      }
+    }
+    return false;
+  }
   auto its = this->name_to_resource.equal_range(name);
   for (; its.first != its.second; its.first++) {
     if (its.first->second->type == type) {
@@ -192,38 +314,110 @@ bool ResourceFile::resource_exists(uint32_t type, const char* name) const {
   return false;
 }
 
+ResourceFile::ResourceStateLocks::Stripe& ResourceFile::ResourceStateLocks::stripe_for_resource(const Resource* res) {
+  // Resource objects are allocated individually, so the low bits of their
+  // addresses are always the same; skip them
+  return this->stripes[(reinterpret_cast<uintptr_t>(res) >> 6) % NUM_STRIPES];
+}
+
+void ResourceFile::load_data_if_needed(shared_ptr<Resource> res) const {
+  if (this->data_source) {
+    auto& stripe = this->resource_state_locks->stripe_for_resource(res.get());
+    lock_guard g(stripe.lock);
+    if (res->flags & ResourceFlag::FLAG_DATA_NOT_LOADED) {
+      res->data = this->data_source->read(res->source_offset, res->source_size);
+      res->flags &= ~ResourceFlag::FLAG_DATA_NOT_LOADED;
+    }
+  }
+}
+
 shared_ptr<const ResourceFile::Resource> ResourceFile::decompress_if_requested(
-    shared_ptr<Resource> res, uint64_t decompress_flags) const {
-  if (res->flags & ResourceFlag::FLAG_COMPRESSED) {
-    if (!res->decompressed_resource) {
-      if (!(decompress_flags & DecompressionFlag::RETRY) &&
-          (res->flags & ResourceFlag::FLAG_DECOMPRESSION_FAILED)) {
-        return res;
-      }
-      if (decompress_flags & DecompressionFlag::DISABLED) {
-        return res;
-      }
-      try {
-        res->decompressed_resource = decompress_resource(res, decompress_flags, this);
-      } catch (const exception& e) {
-        fwrite_fmt(stderr, "failed to decompress resource: {}\n", e.what());
-        res->flags |= ResourceFlag::FLAG_DECOMPRESSION_FAILED;
-        return res;
-      }
+    shared_ptr<Resource> res, uint64_t decompress_flags, DecompressionStats* decompression_stats) const {
+  this->load_data_if_needed(res);
+
+  auto& stripe = this->resource_state_locks->stripe_for_resource(res.get());
+  promise<shared_ptr<const Resource>> decompress_promise;
+  shared_future<shared_ptr<const Resource>> other_thread_result;
+  {
+    lock_guard g(stripe.lock);
+    if (!(res->flags & ResourceFlag::FLAG_COMPRESSED)) {
+      return res;
+    }
+    if (res->decompressed_resource) {
+      return res->decompressed_resource;
+    }
+    if (!(decompress_flags & DecompressionFlag::RETRY) &&
+        (res->flags & ResourceFlag::FLAG_DECOMPRESSION_FAILED)) {
+      return res;
+    }
+    if (decompress_flags & DecompressionFlag::DISABLED) {
+      return res;
+    }
+    auto in_progress_it = stripe.decompressions_in_progress.find(res.get());
+    if (in_progress_it != stripe.decompressions_in_progress.end()) {
+      other_thread_result = in_progress_it->second;
+    } else {
+      stripe.decompressions_in_progress.emplace(res.get(), decompress_promise.get_future().share());
+    }
+  }
+
+  // If another thread is already decompressing this resource, use its result
+  // instead of decompressing the resource again
+  if (other_thread_result.valid()) {
+    auto decompressed = other_thread_result.get();
+    return decompressed ? decompressed : res;
+  }
+
+  shared_ptr<const Resource> decompressed;
+  try {
+    decompressed = decompress_resource(res, decompress_flags, this, decompression_stats);
+  } catch (const exception& e) {
+    fwrite_fmt(stderr, "failed to decompress resource: {}\n", e.what());
+  } catch (...) {
+    // Don't leave other threads waiting forever
+    lock_guard g(stripe.lock);
+    stripe.decompressions_in_progress.erase(res.get());
+    decompress_promise.set_value(nullptr);
+    throw;
+  }
+
+  {
+    lock_guard g(stripe.lock);
+    if (decompressed) {
+      res->decompressed_resource = decompressed;
+    } else {
+      res->flags |= ResourceFlag::FLAG_DECOMPRESSION_FAILED;
     }
-    return res->decompressed_resource;
+    stripe.decompressions_in_progress.erase(res.get());
   }
-  return res;
+  decompress_promise.set_value(decompressed);
+  return decompressed ? decompressed : res;
 }
 
 shared_ptr<const ResourceFile::Resource> ResourceFile::get_resource(
-    uint32_t type, int16_t id, uint64_t decompress_flags) const {
+    uint32_t type, int16_t id, uint64_t decompress_flags, DecompressionStats* decompression_stats) const {
+  if (this->frozen_resources) {
+    ssize_t index = this->frozen_index_for_key(this->make_resource_key(type, id));
+    if (index < 0) {
+      throw out_of_range("no such resource");
+    }
+    return this->decompress_if_requested(this->frozen_resource(index), decompress_flags, decompression_stats);
+  }
   auto res = this->key_to_resource.at(this->make_resource_key(type, id));
-  return this->decompress_if_requested(res, decompress_flags);
+  return this->decompress_if_requested(res, decompress_flags, decompression_stats);
 }
 
 shared_ptr<const ResourceFile::Resource> ResourceFile::get_resource(
     uint32_t type, const char* name, uint64_t decompress_flags) const {
+  if (this->frozen_resources) {
+    auto its = this->frozen_name_index_range(name);
+    for (; its.first != its.second; its.first++) {
+      if ((*this->frozen_resources)[*its.first].type == type) {
+        return this->decompress_if_requested(this->frozen_resource(*its.first), decompress_flags);
+      }
+    }
+    throw out_of_range("no such resource");
+  }
   auto its = this->name_to_resource.equal_range(name);
   for (; its.first != its.second; its.first++) {
     auto res = its.first->second;
@@ -235,10 +429,21 @@ shared_ptr<const ResourceFile::Resource> ResourceFile::get_resource(
 }
 
 const string& ResourceFile::get_resource_name(uint32_t type, int16_t id) const {
+  if (this->frozen_resources) {
+    ssize_t index = this->frozen_index_for_key(this->make_resource_key(type, id));
+    if (index < 0) {
+      throw out_of_range("no such resource");
+    }
+    return (*this->frozen_resources)[index].name;
+  }
   return this->key_to_resource.at(this->make_resource_key(type, id))->name;
 }
 
 size_t ResourceFile::count_resources_of_type(uint32_t type) const {
+  if (this->frozen_resources) {
+    auto range = this->frozen_index_range_for_type(type);
+    return range.second - range.first;
+  }
   size_t ret = 0;
   for (auto it = this->key_to_resource.lower_bound(this->make_resource_key(type, MIN_RES_ID));
       it != this->key_to_resource.end(); it++) {
@@ -251,11 +456,22 @@ size_t ResourceFile::count_resources_of_type(uint32_t type) const {
 }
 
 size_t ResourceFile::count_resources() const {
+  if (this->frozen_resources) {
+    return this->frozen_keys.size();
+  }
   return this->key_to_resource.size();
 }
 
 vector<int16_t> ResourceFile::all_resources_of_type(uint32_t type) const {
   vector<int16_t> ret;
+  if (this->frozen_resources) {
+    auto range = this->frozen_index_range_for_type(type);
+    ret.reserve(range.second - range.first);
+    for (size_t z = range.first; z < range.second; z++) {
+      ret.emplace_back(this->id_from_resource_key(this->frozen_keys[z]));
+    }
+    return ret;
+  }
   for (auto it = this->key_to_resource.lower_bound(this->make_resource_key(type, MIN_RES_ID));
       it != this->key_to_resource.end(); it++) {
     if (this->type_from_resource_key(it->first) != type) {
@@ -268,6 +484,15 @@ vector<int16_t> ResourceFile::all_resources_of_type(uint32_t type) const {
 
 vector<uint32_t> ResourceFile::all_resource_types() const {
   vector<uint32_t> ret;
+  if (this->frozen_resources) {
+    for (uint64_t key : this->frozen_keys) {
+      uint32_t type = this->type_from_resource_key(key);
+      if (ret.empty() || ret.back() != type) {
+        ret.emplace_back(type);
+      }
+    }
+    return ret;
+  }
   for (auto it : this->key_to_resource) {
     uint32_t type = this->type_from_resource_key(it.first);
     if (ret.empty() || ret.back() != type) {
@@ -279,6 +504,13 @@ vector<uint32_t> ResourceFile::all_resource_types() const {
 
 vector<pair<uint32_t, int16_t>> ResourceFile::all_resources() const {
   vector<pair<uint32_t, int16_t>> ret;
+  if (this->frozen_resources) {
+    ret.reserve(this->frozen_keys.size());
+    for (uint64_t key : this->frozen_keys) {
+      ret.emplace_back(make_pair(this->type_from_resource_key(key), this->id_from_resource_key(key)));
+    }
+    return ret;
+  }
   for (const auto& it : this->key_to_resource) {
     ret.emplace_back(make_pair(
         this->type_from_resource_key(it.first), this->id_from_resource_key(it.first)));
@@ -337,6 +569,17 @@ ResourceFile::TemplateEntryList ResourceFile::decode_TMPL(shared_ptr<const Resou
   return ResourceFile::decode_TMPL(res->data.data(), res->data.size());
 }
 
+shared_ptr<const ResourceFile::TemplateEntryList> ResourceFile::get_decoded_TMPL(
+    shared_ptr<const Resource> res) const {
+  lock_guard g(this->resource_state_locks->template_cache_lock);
+  auto it = this->decoded_template_cache.find(res.get());
+  if (it == this->decoded_template_cache.end()) {
+    auto tmpl = make_shared<const TemplateEntryList>(this->decode_TMPL(res));
+    it = this->decoded_template_cache.emplace(res.get(), make_pair(res, std::move(tmpl))).first;
+  }
+  return it->second.second;
+}
+
 ResourceFile::TemplateEntryList ResourceFile::decode_TMPL(const void* data, size_t size) {
   StringReader r(data, size);
 
@@ -2320,7 +2563,9 @@ ResourceFile::DecodedIconImagesResource ResourceFile::decode_icns(const void* da
 
 class QuickDrawResourceDasmPort : public QuickDrawPortInterface {
 public:
-  QuickDrawResourceDasmPort(const ResourceFile* rf, size_t x, size_t y)
+  // The port only stores the rows from band_y1 (inclusive) to band_y2
+  // (exclusive); writes outside of these rows are ignored
+  QuickDrawResourceDasmPort(const ResourceFile* rf, size_t x, size_t y, size_t band_y1, size_t band_y2)
       : bounds(0, 0, y, x),
         clip_region(this->bounds),
         foreground_color(0xFFFF, 0xFFFF, 0xFFFF),
@@ -2343,7 +2588,9 @@ public:
         pen_mono_pattern(0xFFFFFFFFFFFFFFFF),
         fill_mono_pattern(0xAA55AA55AA55AA55),
         background_mono_pattern(0x0000000000000000),
-        rf(rf) {
+        rf(rf),
+        band_y1(band_y1),
+        band_y2(band_y2) {
     if (x >= 0x10000 || y >= 0x10000) {
       throw runtime_error("PICT resources cannot specify images larger than 65535x65535");
     }
@@ -2354,7 +2601,7 @@ public:
     if (this->img.empty()) {
       // PICTs are rendered into an initially white field, so we fill the canvas
       // with white in case the PICT doesn't actually write all the pixels.
-      this->img = ImageRGBA8888N(this->bounds.width(), this->bounds.height(), 0xFFFFFFFF);
+      this->img = ImageRGBA8888N(this->bounds.width(), this->band_y2 - this->band_y1, 0xFFFFFFFF);
     }
     return this->img;
   }
@@ -2370,7 +2617,12 @@ public:
     return this->bounds.height();
   }
   virtual void write(ssize_t x, ssize_t y, uint32_t color) {
-    this->image().write(x, y, color);
+    if ((y >= this->band_y1) && (y < this->band_y2)) {
+      this->image().write(x, y - this->band_y1, color);
+    }
+  }
+  virtual pair<ssize_t, ssize_t> get_drawn_rows() const {
+    return make_pair(this->band_y1, this->band_y2);
   }
   virtual void blit(
       const ImageRGB888& src,
@@ -2383,27 +2635,7 @@ public:
       shared_ptr<Region> mask = nullptr,
       ssize_t mask_origin_x = 0,
       ssize_t mask_origin_y = 0) {
-    if (mask.get()) {
-      Rect effective_mask_rect = mask->rect;
-      effective_mask_rect.x1 -= mask_origin_x;
-      effective_mask_rect.x2 -= mask_origin_x;
-      effective_mask_rect.y1 -= mask_origin_y;
-      effective_mask_rect.y2 -= mask_origin_y;
-      if (effective_mask_rect.x1 != dest_x ||
-          effective_mask_rect.y1 != dest_y ||
-          effective_mask_rect.x2 != static_cast<ssize_t>(dest_x + w) ||
-          effective_mask_rect.y2 != static_cast<ssize_t>(dest_y + h)) {
-        string mask_rect_str = mask->rect.str();
-        string effective_mask_rect_str = effective_mask_rect.str();
-        throw runtime_error(std::format(
-            "mask region rect {} with effective {} is not same as dest rect [{}, {}, {}, {}]",
-            mask_rect_str, effective_mask_rect_str,
-            dest_x, dest_y, dest_x + w, dest_y + h));
-      }
-      this->image().copy_from_with_mask_image(src, dest_x, dest_y, w, h, src_x, src_y, mask->render());
-    } else {
-      this->image().copy_from(src, dest_x, dest_y, w, h, src_x, src_y);
-    }
+    this->blit_t(src, dest_x, dest_y, w, h, src_x, src_y, mask, mask_origin_x, mask_origin_y);
   }
   virtual void blit(
       const ImageRGBA8888N& src,
@@ -2416,27 +2648,7 @@ public:
       shared_ptr<Region> mask = nullptr,
       ssize_t mask_origin_x = 0,
       ssize_t mask_origin_y = 0) {
-    if (mask.get()) {
-      Rect effective_mask_rect = mask->rect;
-      effective_mask_rect.x1 -= mask_origin_x;
-      effective_mask_rect.x2 -= mask_origin_x;
-      effective_mask_rect.y1 -= mask_origin_y;
-      effective_mask_rect.y2 -= mask_origin_y;
-      if (effective_mask_rect.x1 != dest_x ||
-          effective_mask_rect.y1 != dest_y ||
-          effective_mask_rect.x2 != static_cast<ssize_t>(dest_x + w) ||
-          effective_mask_rect.y2 != static_cast<ssize_t>(dest_y + h)) {
-        string mask_rect_str = mask->rect.str();
-        string effective_mask_rect_str = effective_mask_rect.str();
-        throw runtime_error(std::format(
-            "mask region rect {} with effective {} is not same as dest rect [{}, {}, {}, {}]",
-            mask_rect_str, effective_mask_rect_str,
-            dest_x, dest_y, dest_x + w, dest_y + h));
-      }
-      this->image().copy_from_with_mask_image(src, dest_x, dest_y, w, h, src_x, src_y, mask->render());
-    } else {
-      this->image().copy_from_with_blend(src, dest_x, dest_y, w, h, src_x, src_y);
-    }
+    this->blit_t(src, dest_x, dest_y, w, h, src_x, src_y, mask, mask_origin_x, mask_origin_y);
   }
 
   // External resource data accessors
@@ -2659,7 +2871,64 @@ public:
 
 protected:
   const ResourceFile* rf;
+  ssize_t band_y1;
+  ssize_t band_y2;
   ImageRGBA8888N img;
+
+  template <typename SrcT>
+  void blit_t(
+      const SrcT& src,
+      ssize_t dest_x,
+      ssize_t dest_y,
+      size_t w,
+      size_t h,
+      ssize_t src_x,
+      ssize_t src_y,
+      shared_ptr<Region> mask,
+      ssize_t mask_origin_x,
+      ssize_t mask_origin_y) {
+    if (mask.get()) {
+      Rect effective_mask_rect = mask->rect;
+      effective_mask_rect.x1 -= mask_origin_x;
+      effective_mask_rect.x2 -= mask_origin_x;
+      effective_mask_rect.y1 -= mask_origin_y;
+      effective_mask_rect.y2 -= mask_origin_y;
+      if (effective_mask_rect.x1 != dest_x ||
+          effective_mask_rect.y1 != dest_y ||
+          effective_mask_rect.x2 != static_cast<ssize_t>(dest_x + w) ||
+          effective_mask_rect.y2 != static_cast<ssize_t>(dest_y + h)) {
+        string mask_rect_str = mask->rect.str();
+        string effective_mask_rect_str = effective_mask_rect.str();
+        throw runtime_error(std::format(
+            "mask region rect {} with effective {} is not same as dest rect [{}, {}, {}, {}]",
+            mask_rect_str, effective_mask_rect_str,
+            dest_x, dest_y, dest_x + w, dest_y + h));
+      }
+    }
+
+    // Only the rows within the current band are drawn
+    ssize_t y1 = max<ssize_t>(dest_y, this->band_y1);
+    ssize_t y2 = min<ssize_t>(dest_y + h, this->band_y2);
+    if (y1 >= y2) {
+      return;
+    }
+
+    if (mask.get()) {
+      // Copy only the parts of src that are within the mask region, one span
+      // at a time
+      for (ssize_t y = y1; y < y2; y++) {
+        ssize_t y_offset = y - dest_y;
+        for (const auto& span : mask->spans_for_row(mask->rect.y1 + y_offset)) {
+          ssize_t x_offset = span.x1 - mask->rect.x1;
+          this->image().copy_from(src, dest_x + x_offset, y - this->band_y1, span.x2 - span.x1, 1, src_x + x_offset, src_y + y_offset);
+        }
+      }
+    } else if constexpr (std::is_same_v<SrcT, ImageRGBA8888N>) {
+      this->image().copy_from_with_blend(src, dest_x, y1 - this->band_y1, w, y2 - y1, src_x, src_y + (y1 - dest_y));
+    } else {
+      this->image().copy_from(src, dest_x, y1 - this->band_y1, w, y2 - y1, src_x, src_y + (y1 - dest_y));
+    }
+  }
 };
 
 ResourceFile::DecodedPictResource ResourceFile::decode_PICT(int16_t id, uint32_t type, bool allow_external) const {
@@ -2692,7 +2961,7 @@ ResourceFile::DecodedPictResource ResourceFile::decode_PICT_data(
     try {
       StringReader r(data, size);
       const auto& header = r.get<PictHeader>();
-      QuickDrawResourceDasmPort port(rf, header.bounds.width(), header.bounds.height());
+      QuickDrawResourceDasmPort port(rf, header.bounds.width(), header.bounds.height(), 0, header.bounds.height());
       QuickDrawEngine eng;
       eng.set_port(&port);
       eng.render_pict(data, size);
@@ -2725,6 +2994,44 @@ ResourceFile::DecodedPictResource ResourceFile::decode_PICT_data(
   }
 }
 
+void ResourceFile::decode_PICT_banded(shared_ptr<const Resource> res, size_t band_height, const PictBandWriteFn& write_band) const {
+  ResourceFile::decode_PICT_data_banded(res->data.data(), res->data.size(), this, band_height, write_band);
+}
+
+pair<size_t, size_t> ResourceFile::decode_PICT_dimensions(shared_ptr<const Resource> res) {
+  if (res->data.size() < sizeof(PictHeader)) {
+    throw runtime_error("PICT too small for header");
+  }
+  StringReader r(res->data.data(), res->data.size());
+  const auto& header = r.get<PictHeader>();
+  return make_pair(header.bounds.width(), header.bounds.height());
+}
+
+void ResourceFile::decode_PICT_data_banded(
+    const void* data, size_t size, const ResourceFile* rf, size_t band_height, const PictBandWriteFn& write_band) {
+  if (size < sizeof(PictHeader)) {
+    throw runtime_error("PICT too small for header");
+  }
+  if (band_height == 0) {
+    throw logic_error("band height must be nonzero");
+  }
+
+  StringReader r(data, size);
+  const auto& header = r.get<PictHeader>();
+  size_t width = header.bounds.width();
+  size_t height = header.bounds.height();
+
+  // Each band is rendered with a new port and engine, since rendering modifies
+  // the port's state (clip region, colors, patterns, etc.)
+  for (size_t band_y = 0; band_y < height; band_y += band_height) {
+    QuickDrawResourceDasmPort port(rf, width, height, band_y, min<size_t>(band_y + band_height, height));
+    QuickDrawEngine eng;
+    eng.set_port(&port);
+    eng.render_pict(data, size);
+    write_band(port.image(), band_y);
+  }
+}
+
 vector<Color> ResourceFile::decode_pltt(int16_t id, uint32_t type) const {
   return this->decode_pltt(this->get_resource(type, id));
 }
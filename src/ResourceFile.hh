@@ -5,7 +5,12 @@
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include <array>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <phosg/Filesystem.hh>
 #include <phosg/Image.hh>
 #include <unordered_map>
@@ -13,6 +18,7 @@
 
 #include "Emulators/M68KEmulator.hh"
 #include "ExecutableFormats/PEFFile.hh"
+#include "MappedFile.hh"
 #include "QuickDrawFormats.hh"
 #include "ResourceFormats.hh"
 #include "ResourceTypes.hh"
@@ -21,6 +27,8 @@ namespace ResourceDASM {
 
 using namespace phosg;
 
+struct DecompressionStats; // Defined in ResourceCompression.hh
+
 enum class IndexFormat {
   NONE = 0, // For ResourceFiles constructed in memory
   RESOURCE_FORK,
@@ -36,6 +44,7 @@ enum class IndexFormat {
 enum ResourceFlag {
   // The low 8 bits come from the resource itself; the high 8 bits are reserved
   // for resource_dasm
+  FLAG_DATA_NOT_LOADED = 0x0400, // data is still in the ResourceFile's MappedFile
   FLAG_DECOMPRESSED = 0x0200, // decompressor ran successfully
   FLAG_DECOMPRESSION_FAILED = 0x0100, // so we don't try to decompress again
   FLAG_LOAD_IN_SYSTEM_HEAP = 0x0040,
@@ -54,9 +63,20 @@ public:
   // contents. To parse an existing archive and get a ResourceFile object, use a
   // function defined in one of the headers in the IndexFormats directory. The
   // constructors defined in this class will only create an empty ResourceFile.
+  //
+  // All const functions (including get_resource and all decode_* functions)
+  // may be called from multiple threads at the same time. The non-const
+  // functions (add, remove, change_id, rename) must not be called while any
+  // other thread is using the ResourceFile. Lazily-loaded resources are loaded
+  // and compressed resources are decompressed only once, even if multiple
+  // threads request the same resource at the same time.
 
   ResourceFile();
   explicit ResourceFile(IndexFormat format);
+  // Creates an empty ResourceFile whose resources' data can be loaded lazily
+  // from the given file. This is used by index format parsers that support
+  // lazy loading (see add_lazy).
+  ResourceFile(IndexFormat format, std::shared_ptr<const MappedFile> data_source);
   ResourceFile(const ResourceFile&) = default;
   ResourceFile(ResourceFile&&) = default;
   ResourceFile& operator=(const ResourceFile&) = default;
@@ -70,6 +90,12 @@ public:
     std::string name;
     std::string data;
     std::shared_ptr<const Resource> decompressed_resource;
+    // If FLAG_DATA_NOT_LOADED is set, data is empty and the resource's actual
+    // data is at this location in the ResourceFile's data source. The data is
+    // copied into the data field when the resource is first returned by
+    // get_resource.
+    size_t source_offset = 0;
+    size_t source_size = 0;
 
     Resource();
     Resource(const Resource&) = default;
@@ -89,16 +115,36 @@ public:
   bool add(const Resource& res);
   bool add(Resource&& res);
   bool add(std::shared_ptr<Resource> res);
+  // Adds a resource whose data will be read from this ResourceFile's data
+  // source when it's first needed. Throws out_of_range if the data isn't
+  // entirely within the data source.
+  bool add_lazy(uint32_t type, int16_t id, uint16_t flags, std::string&& name, size_t data_offset, size_t data_size);
   bool remove(uint32_t type, int16_t id);
   bool change_id(uint32_t type, int16_t current_id, int16_t new_id);
   bool rename(uint32_t type, int16_t id, const std::string& new_name);
 
+  // Converts the index to a read-only form, in which all Resource objects are
+  // stored in one contiguous array and lookups are done by binary search over
+  // a sorted array of keys. This uses much less memory and is faster to search
+  // for files with many resources. After calling this, the functions that
+  // modify the index (add, add_lazy, remove, change_id, rename) throw
+  // logic_error. References to resources previously returned by
+  // get_resource() remain valid, but no longer refer to the resources in this
+  // ResourceFile.
+  void freeze();
+  bool is_frozen() const;
+
   IndexFormat index_format() const;
 
   bool empty() const;
   bool resource_exists(uint32_t type, int16_t id) const;
   bool resource_exists(uint32_t type, const char* name) const;
-  std::shared_ptr<const Resource> get_resource(uint32_t type, int16_t id, uint64_t decompression_flags = 0) const;
+  // If decompression_stats is not null and this call decompresses the
+  // resource, it's filled in with information about the decompression. If the
+  // resource isn't compressed or was already decompressed by an earlier call,
+  // it isn't modified.
+  std::shared_ptr<const Resource> get_resource(
+      uint32_t type, int16_t id, uint64_t decompression_flags = 0, DecompressionStats* decompression_stats = nullptr) const;
   std::shared_ptr<const Resource> get_resource(uint32_t type, const char* name, uint64_t decompression_flags = 0) const;
   const std::string& get_resource_name(uint32_t type, int16_t id) const;
   size_t count_resources_of_type(uint32_t type) const;
@@ -603,6 +649,10 @@ public:
   TemplateEntryList decode_TMPL(int16_t id, uint32_t type = RESOURCE_TYPE_TMPL) const;
   static TemplateEntryList decode_TMPL(std::shared_ptr<const Resource> res);
   static TemplateEntryList decode_TMPL(const void* data, size_t size);
+  // Like decode_TMPL, but the decoded template is cached, so each TMPL
+  // resource is only decoded once no matter how many resources are
+  // disassembled with it.
+  std::shared_ptr<const TemplateEntryList> get_decoded_TMPL(std::shared_ptr<const Resource> res) const;
 
   static std::string describe_template(const TemplateEntryList& tmpl);
   static std::string disassemble_from_template(const void* data, size_t size, const TemplateEntryList& tmpl);
@@ -721,6 +771,19 @@ public:
   DecodedPictResource decode_PICT(const void* data, size_t size, bool allow_external = true) const;
   static DecodedPictResource decode_PICT_only(std::shared_ptr<const Resource> res, bool allow_external = true);
   static DecodedPictResource decode_PICT_only(const void* data, size_t size, bool allow_external = true);
+  // Renders a PICT in horizontal bands of at most band_height rows, and calls
+  // write_band for each band in order from top to bottom. Only one band is in
+  // memory at a time, and bitmaps drawn with CopyBits opcodes are only decoded
+  // for the rows within the current band, so this can render PICTs that are
+  // too large to fit in memory all at once. (QuickTime images are still
+  // decoded entirely.) The PICT is parsed again for each band, so this is
+  // slower than decode_PICT. External renderers are never used. If the PICT
+  // contains QuickTime data that can't be decoded, this throws
+  // pict_contains_undecodable_quicktime before calling write_band.
+  using PictBandWriteFn = std::function<void(const ImageRGBA8888N& band, size_t band_y)>;
+  void decode_PICT_banded(std::shared_ptr<const Resource> res, size_t band_height, const PictBandWriteFn& write_band) const;
+  // Returns the width and height of a PICT's canvas without rendering it
+  static std::pair<size_t, size_t> decode_PICT_dimensions(std::shared_ptr<const Resource> res);
   std::vector<Color> decode_pltt(int16_t id, uint32_t type = RESOURCE_TYPE_pltt) const;
   static std::vector<Color> decode_pltt(std::shared_ptr<const Resource> res);
   static std::vector<Color> decode_pltt(const void* data, size_t size);
@@ -862,11 +925,50 @@ private:
   // all_resources to always return resources of the same type contiguously
   // ordered by their ID
   std::map<uint64_t, std::shared_ptr<Resource>> key_to_resource;
-  mutable std::map<uint64_t, std::shared_ptr<Resource>> key_to_decompressed_resource;
   std::multimap<std::string, std::shared_ptr<Resource>> name_to_resource;
-  std::unordered_map<int16_t, std::shared_ptr<Resource>> system_dcmp_cache;
+  // If the ResourceFile is frozen, key_to_resource and name_to_resource are
+  // empty, and the index is stored here instead. frozen_keys is sorted, and
+  // frozen_keys[z] is the key for (*frozen_resources)[z]. frozen_name_index
+  // contains the indexes of all resources that have names, sorted by name.
+  // Pointers to frozen resources share ownership of the entire array.
+  std::shared_ptr<std::vector<Resource>> frozen_resources;
+  std::vector<uint64_t> frozen_keys;
+  std::vector<uint32_t> frozen_name_index;
+  // Keyed by TMPL resource. Each entry holds a reference to its TMPL resource
+  // so the key can't be reused by another resource after the TMPL is removed.
+  using DecodedTemplateCacheEntry = std::pair<std::shared_ptr<const Resource>, std::shared_ptr<const TemplateEntryList>>;
+  mutable std::unordered_map<const Resource*, DecodedTemplateCacheEntry> decoded_template_cache;
+  // If not null, resources with FLAG_DATA_NOT_LOADED get their data from here
+  std::shared_ptr<const MappedFile> data_source;
+  // Protects the lazily-computed state of all resources (data for resources
+  // that are loaded lazily, decompressed_resource, and the FLAG_DATA_NOT_LOADED
+  // FLAG_DECOMPRESSED and FLAG_DECOMPRESSION_FAILED flags) and the decoded
+  // template cache. This is a shared_ptr because copies of a ResourceFile
+  // share their Resource objects, so they must also share the locks.
+  struct ResourceStateLocks {
+    // Each resource's state is protected by one of these, chosen by the
+    // Resource's address, so threads working on different resources rarely
+    // wait for each other. No stripe lock is held while a resource is being
+    // decompressed, since decompressing a resource may require getting a dcmp
+    // or ncmp resource from this file; instead, threads that need a resource
+    // that's already being decompressed wait for the result in
+    // decompressions_in_progress.
+    struct Stripe {
+      std::mutex lock;
+      // A null result means decompression failed
+      std::unordered_map<const Resource*, std::shared_future<std::shared_ptr<const Resource>>> decompressions_in_progress;
+    };
+    static constexpr size_t NUM_STRIPES = 16;
+    std::array<Stripe, NUM_STRIPES> stripes;
+    std::mutex template_cache_lock;
 
-  std::shared_ptr<const Resource> decompress_if_requested(std::shared_ptr<Resource> res, uint64_t decompress_flags) const;
+    Stripe& stripe_for_resource(const Resource* res);
+  };
+  std::shared_ptr<ResourceStateLocks> resource_state_locks;
+
+  void load_data_if_needed(std::shared_ptr<Resource> res) const;
+  std::shared_ptr<const Resource> decompress_if_requested(
+      std::shared_ptr<Resource> res, uint64_t decompress_flags, DecompressionStats* decompression_stats = nullptr) const;
 
   DecodedInstrumentResource decode_INST_recursive(
       std::shared_ptr<const Resource> res,
@@ -874,10 +976,21 @@ private:
 
   static DecodedFontResource decode_FONT_data(const void* data, size_t size, const ResourceFile* rf, int16_t res_id);
   static DecodedPictResource decode_PICT_data(const void* data, size_t size, const ResourceFile* rf, bool allow_external);
+  static void decode_PICT_data_banded(const void* data, size_t size, const ResourceFile* rf, size_t band_height, const PictBandWriteFn& write_band);
 
   void add_name_index_entry(std::shared_ptr<Resource> res);
   void delete_name_index_entry(std::shared_ptr<Resource> res);
 
+  void throw_if_frozen() const;
+  std::shared_ptr<Resource> frozen_resource(size_t index) const;
+  // Returns the index of the resource with the given key, or -1 if none
+  ssize_t frozen_index_for_key(uint64_t key) const;
+  // Returns the range of indexes of resources of the given type
+  std::pair<size_t, size_t> frozen_index_range_for_type(uint32_t type) const;
+  // Returns the range of frozen_name_index entries with the given name
+  std::pair<std::vector<uint32_t>::const_iterator, std::vector<uint32_t>::const_iterator>
+  frozen_name_index_range(const std::string& name) const;
+
   static uint64_t make_resource_key(uint32_t type, int16_t id);
   static uint32_t type_from_resource_key(uint64_t key);
   static int16_t id_from_resource_key(uint64_t key);
@@ -657,6 +657,13 @@ int main_t(phosg::Arguments& args) {
 
   args.assert_none_unused();
 
+  // If the debugger has nothing to do, unbind it so the emulator can run
+  // without calling the debug hook before every instruction (this also allows
+  // emulators that cache decoded instructions to use their caches)
+  if (debugger->state.is_idle()) {
+    debugger->unbind();
+  }
+
   emu.execute();
   return 0;
 }
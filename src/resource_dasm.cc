@@ -6,11 +6,15 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <deque>
 #include <filesystem>
 #include <functional>
+#include <future>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <phosg/Encoding.hh>
 #include <phosg/Filesystem.hh>
@@ -19,6 +23,9 @@
 #include <phosg/Platform.hh>
 #include <phosg/Process.hh>
 #include <phosg/Strings.hh>
+#include <phosg/Time.hh>
+#include <phosg/Tools.hh>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -35,6 +42,7 @@
 #include "ImageSaver.hh"
 #include "IndexFormats/Formats.hh"
 #include "Lookups.hh"
+#include "OutputSink.hh"
 #include "ResourceCompression.hh"
 #include "ResourceFile.hh"
 #include "ResourceIDs.hh"
@@ -42,6 +50,12 @@
 #include "SystemTemplates.hh"
 #include "TextCodecs.hh"
 
+#ifndef PHOSG_WINDOWS
+#include <errno.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif
+
 using namespace std;
 using namespace phosg;
 using namespace ResourceDASM;
@@ -73,35 +87,477 @@ static string disassembly_for_dcmp(
       dcmp.code.data(), dcmp.code.size(), dcmp.pc_offset, &labels);
 }
 
-class ResourceExporter {
+#ifndef PHOSG_WINDOWS
+
+// Runs an external preprocessor as a single long-lived process, instead of
+// starting a new process for each resource. See the description of
+// --external-preprocessor-server in the usage text for the protocol. Any
+// number of requests may be in flight at once; the process must send its
+// responses in the same order as it receives the requests.
+class ExternalPreprocessorServer {
+public:
+  struct Result {
+    bool succeeded;
+    string data; // Error message if !succeeded
+  };
+
+  explicit ExternalPreprocessorServer(const vector<string>& command)
+      : pid(-1),
+        stdin_fd(-1),
+        stdout_fd(-1),
+        stop_read_fd(-1),
+        stop_write_fd(-1) {
+    if (command.empty()) {
+      throw invalid_argument("external preprocessor command is empty");
+    }
+    vector<char*> argv;
+    for (const auto& arg : command) {
+      argv.emplace_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.emplace_back(nullptr);
+
+    int stdin_pipe[2];
+    int stdout_pipe[2];
+    if (pipe(stdin_pipe)) {
+      throw runtime_error("cannot create pipe for external preprocessor");
+    }
+    if (pipe(stdout_pipe)) {
+      close(stdin_pipe[0]);
+      close(stdin_pipe[1]);
+      throw runtime_error("cannot create pipe for external preprocessor");
+    }
+
+    this->pid = fork();
+    if (this->pid == 0) {
+      dup2(stdin_pipe[0], STDIN_FILENO);
+      dup2(stdout_pipe[1], STDOUT_FILENO);
+      close(stdin_pipe[0]);
+      close(stdin_pipe[1]);
+      close(stdout_pipe[0]);
+      close(stdout_pipe[1]);
+      execvp(argv[0], argv.data());
+      _exit(127);
+    }
+
+    close(stdin_pipe[0]);
+    close(stdout_pipe[1]);
+    if (this->pid < 0) {
+      close(stdin_pipe[1]);
+      close(stdout_pipe[0]);
+      throw runtime_error("cannot start external preprocessor");
+    }
+    this->stdin_fd = stdin_pipe[1];
+    this->stdout_fd = stdout_pipe[0];
+
+    int stop_pipe[2];
+    if (pipe(stop_pipe)) {
+      close(this->stdin_fd);
+      close(this->stdout_fd);
+      kill(this->pid, SIGKILL);
+      waitpid(this->pid, nullptr, 0);
+      throw runtime_error("cannot create pipe for external preprocessor");
+    }
+    this->stop_read_fd = stop_pipe[0];
+    this->stop_write_fd = stop_pipe[1];
+    this->reader_thread = thread(&ExternalPreprocessorServer::read_responses, this);
+  }
+  ExternalPreprocessorServer(const ExternalPreprocessorServer&) = delete;
+  ExternalPreprocessorServer(ExternalPreprocessorServer&&) = delete;
+  ExternalPreprocessorServer& operator=(const ExternalPreprocessorServer&) = delete;
+  ExternalPreprocessorServer& operator=(ExternalPreprocessorServer&&) = delete;
+
+  ~ExternalPreprocessorServer() {
+    // Closing the process' stdin tells it that there are no more requests, so
+    // it should exit. If it doesn't exit soon, it's terminated, then killed.
+    close(this->stdin_fd);
+    if (!this->wait_for_exit(5000000)) {
+      kill(this->pid, SIGTERM);
+      if (!this->wait_for_exit(1000000)) {
+        kill(this->pid, SIGKILL);
+        waitpid(this->pid, nullptr, 0);
+      }
+    }
+    // The process' stdout may still be open (if it started another process
+    // that inherited it), so tell the reader thread to stop when there's
+    // nothing more to read instead of waiting for the end of the stream
+    close(this->stop_write_fd);
+    this->reader_thread.join();
+    close(this->stop_read_fd);
+    close(this->stdout_fd);
+  }
+
+  // Sends a resource to the preprocessor. This doesn't wait for the response,
+  // so callers can submit several resources before waiting for any of them.
+  shared_future<Result> submit(shared_ptr<const ResourceFile::Resource> res) {
+    StringWriter w;
+    w.put_u32b(res->type);
+    w.put_u16b(res->id);
+    w.put_u16b(res->flags);
+    w.put_u32b(res->name.size());
+    w.write(res->name);
+    w.put_u32b(res->data.size());
+    w.write(res->data);
+
+    // The response promise must be queued in the same order as the request is
+    // written, so we hold write_lock for both. We don't hold pending_lock while
+    // writing, since the pipe may be full until the reader thread reads some
+    // responses.
+    lock_guard write_g(this->write_lock);
+    shared_future<Result> ret;
+    {
+      lock_guard pending_g(this->pending_lock);
+      if (!this->error.empty()) {
+        throw runtime_error(this->error);
+      }
+      ret = this->pending.emplace_back().get_future().share();
+    }
+    try {
+      writex(this->stdin_fd, w.str());
+    } catch (const exception& e) {
+      this->fail(std::format("cannot write to external preprocessor: {}", e.what()));
+    }
+    return ret;
+  }
+
 private:
-  void ensure_directories_exist(const string& filename) {
-    vector<string> tokens = split(filename, '/');
-    if (tokens.empty()) {
-      return;
+  pid_t pid;
+  int stdin_fd;
+  int stdout_fd;
+  // Closed by the destructor to stop the reader thread
+  int stop_read_fd;
+  int stop_write_fd;
+  thread reader_thread;
+  mutex write_lock;
+  mutex pending_lock;
+  deque<promise<Result>> pending;
+  string error; // If not empty, the process has failed
+
+  // Returns true if the process exited within timeout_usecs
+  bool wait_for_exit(uint64_t timeout_usecs) {
+    uint64_t end_time = now() + timeout_usecs;
+    for (;;) {
+      pid_t ret = waitpid(this->pid, nullptr, WNOHANG);
+      if ((ret == this->pid) || ((ret < 0) && (errno != EINTR))) {
+        return true;
+      }
+      if (now() >= end_time) {
+        return false;
+      }
+      usleep(10000);
     }
-    tokens.pop_back();
+  }
 
-    if (tokens.empty()) {
-      return;
+  // Reads exactly size bytes from the process' stdout. Throws if the stream
+  // ends, or if the destructor has asked the reader thread to stop and there's
+  // no data available.
+  string read_output(size_t size) {
+    string ret(size, '\0');
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+      pollfd fds[2] = {{this->stdout_fd, POLLIN, 0}, {this->stop_read_fd, POLLIN, 0}};
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw runtime_error("cannot poll external preprocessor output");
+      }
+      if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+        throw runtime_error("external preprocessor exited without closing its output");
+      }
+      ssize_t bytes = read(this->stdout_fd, ret.data() + bytes_read, size - bytes_read);
+      if (bytes < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw runtime_error("cannot read external preprocessor output");
+      }
+      if (bytes == 0) {
+        throw runtime_error("end of stream");
+      }
+      bytes_read += bytes;
     }
+    return ret;
+  }
 
-    string dir;
-    bool first_token = true;
-    for (const string& token : tokens) {
-      if (!first_token) {
-        dir.push_back('/');
-      } else {
-        first_token = false;
+  void read_responses() {
+    try {
+      for (;;) {
+        string header = this->read_output(8);
+        StringReader r(header);
+        uint32_t status = r.get_u32b();
+        uint32_t size = r.get_u32b();
+        Result result{status == 0, this->read_output(size)};
+
+        promise<Result> p;
+        {
+          lock_guard g(this->pending_lock);
+          if (this->pending.empty()) {
+            throw runtime_error("external preprocessor sent a response without a request");
+          }
+          p = std::move(this->pending.front());
+          this->pending.pop_front();
+        }
+        p.set_value(std::move(result));
       }
-      dir += token;
-      // dir can be / if filename is an absolute path; just skip it
-      if (dir != "/" && !std::filesystem::is_directory(dir)) {
-        std::filesystem::create_directories(dir);
+    } catch (const exception& e) {
+      this->fail(std::format("external preprocessor stopped responding: {}", e.what()));
+    }
+  }
+
+  // Fails all pending and future requests
+  void fail(const string& error) {
+    lock_guard g(this->pending_lock);
+    if (this->error.empty()) {
+      this->error = error;
+    }
+    for (auto& p : this->pending) {
+      p.set_exception(make_exception_ptr(runtime_error(this->error)));
+    }
+    this->pending.clear();
+  }
+};
+
+#endif
+
+// Timings and counters for each exported resource, collected when --stats is
+// given. At the end of the run, these are written to a JSON file along with a
+// summary by resource type and by decompressor, so pathological inputs and
+// slow decoders can be found. All functions may be called from multiple
+// threads at the same time.
+class ExportStats {
+public:
+  struct ResourceRecord {
+    size_t file_index = 0;
+    uint32_t type = 0;
+    int16_t id = 0;
+    size_t size = 0; // Before decompression
+    uint64_t load_usecs = 0;
+
+    bool compressed = false;
+    bool decompression_failed = false;
+    // Only meaningful if compressed is true; if the resource was decompressed
+    // before it was exported, all fields are zero
+    DecompressionStats decompression;
+    uint64_t decompress_usecs = 0;
+    size_t decompressed_size = 0;
+
+    // decode_usecs includes everything export_resource did, except for the
+    // time spent serializing images and writing complete output files, which
+    // is included in write_usecs instead. (Files written incrementally, such as
+    // banded PICTs, are counted only in decode_usecs.)
+    bool exported = false;
+    uint64_t decode_usecs = 0;
+    uint64_t write_usecs = 0;
+    size_t files_written = 0;
+    size_t bytes_written = 0;
+  };
+
+  ExportStats() = default;
+  ~ExportStats() = default;
+
+  // Returns the file index to use in the file's ResourceRecords
+  size_t add_file(const string& filename, size_t size, uint64_t index_usecs, size_t num_resources) {
+    lock_guard g(this->lock);
+    this->files.emplace_back(FileRecord{filename, size, index_usecs, num_resources});
+    return this->files.size() - 1;
+  }
+
+  void add_resource(ResourceRecord&& record) {
+    lock_guard g(this->lock);
+    this->resources.emplace_back(std::move(record));
+  }
+
+  JSON json() {
+    lock_guard g(this->lock);
+
+    auto files_list = JSON::list();
+    for (const auto& file : this->files) {
+      auto file_dict = JSON::dict();
+      file_dict.emplace("filename", file.filename);
+      file_dict.emplace("size", file.size);
+      file_dict.emplace("index_usecs", file.index_usecs);
+      file_dict.emplace("num_resources", file.num_resources);
+      files_list.emplace_back(std::move(file_dict));
+    }
+
+    struct TypeSummary {
+      size_t count = 0;
+      size_t failures = 0;
+      size_t input_bytes = 0;
+      size_t bytes_written = 0;
+      uint64_t load_usecs = 0;
+      uint64_t decompress_usecs = 0;
+      uint64_t decode_usecs = 0;
+      uint64_t write_usecs = 0;
+      uint64_t max_usecs = 0;
+      const ResourceRecord* slowest = nullptr;
+    };
+    struct DecompressorSummary {
+      size_t count = 0;
+      size_t failures = 0;
+      size_t cache_hits = 0;
+      size_t input_bytes = 0;
+      size_t output_bytes = 0;
+      uint64_t usecs = 0;
+      uint64_t max_usecs = 0;
+      uint64_t emulated_cycles = 0;
+      map<string, size_t> implementation_counts;
+      const ResourceRecord* slowest = nullptr;
+    };
+    map<uint32_t, TypeSummary> type_summaries;
+    map<int16_t, DecompressorSummary> decompressor_summaries;
+
+    auto resources_list = JSON::list();
+    for (const auto& res : this->resources) {
+      auto res_dict = JSON::dict();
+      res_dict.emplace("file", res.file_index);
+      res_dict.emplace("type", string_for_resource_type(res.type));
+      res_dict.emplace("id", res.id);
+      res_dict.emplace("size", res.size);
+      res_dict.emplace("load_usecs", res.load_usecs);
+      if (res.compressed) {
+        const auto& d = res.decompression;
+        auto decompression_dict = JSON::dict();
+        decompression_dict.emplace("dcmp_id", d.dcmp_resource_id);
+        decompression_dict.emplace("succeeded", !res.decompression_failed);
+        decompression_dict.emplace("implementation", d.implementation_name);
+        decompression_dict.emplace("emulated", d.is_emulated);
+        decompression_dict.emplace("cached", d.used_cache);
+        decompression_dict.emplace("attempts", d.num_attempts);
+        decompression_dict.emplace("emulated_cycles", d.emulated_cycles);
+        decompression_dict.emplace("usecs", res.decompress_usecs);
+        decompression_dict.emplace("decompressed_size", res.decompressed_size);
+        res_dict.emplace("decompression", std::move(decompression_dict));
+
+        auto& ds = decompressor_summaries[d.dcmp_resource_id];
+        ds.count++;
+        ds.failures += res.decompression_failed;
+        ds.cache_hits += d.used_cache;
+        ds.input_bytes += res.size;
+        ds.output_bytes += res.decompressed_size;
+        ds.usecs += res.decompress_usecs;
+        ds.emulated_cycles += d.emulated_cycles;
+        if (!d.implementation_name.empty()) {
+          ds.implementation_counts[d.implementation_name]++;
+        }
+        if (!ds.slowest || (res.decompress_usecs > ds.max_usecs)) {
+          ds.max_usecs = res.decompress_usecs;
+          ds.slowest = &res;
+        }
       }
+      res_dict.emplace("exported", res.exported);
+      res_dict.emplace("decode_usecs", res.decode_usecs);
+      res_dict.emplace("write_usecs", res.write_usecs);
+      res_dict.emplace("files_written", res.files_written);
+      res_dict.emplace("bytes_written", res.bytes_written);
+      resources_list.emplace_back(std::move(res_dict));
+
+      auto& ts = type_summaries[res.type];
+      uint64_t total_usecs = res.load_usecs + res.decompress_usecs + res.decode_usecs + res.write_usecs;
+      ts.count++;
+      ts.failures += !res.exported;
+      ts.input_bytes += res.size;
+      ts.bytes_written += res.bytes_written;
+      ts.load_usecs += res.load_usecs;
+      ts.decompress_usecs += res.decompress_usecs;
+      ts.decode_usecs += res.decode_usecs;
+      ts.write_usecs += res.write_usecs;
+      if (!ts.slowest || (total_usecs > ts.max_usecs)) {
+        ts.max_usecs = total_usecs;
+        ts.slowest = &res;
+      }
+    }
+
+    auto by_type_dict = JSON::dict();
+    for (const auto& [type, ts] : type_summaries) {
+      auto ts_dict = JSON::dict();
+      ts_dict.emplace("count", ts.count);
+      ts_dict.emplace("failures", ts.failures);
+      ts_dict.emplace("input_bytes", ts.input_bytes);
+      ts_dict.emplace("bytes_written", ts.bytes_written);
+      ts_dict.emplace("load_usecs", ts.load_usecs);
+      ts_dict.emplace("decompress_usecs", ts.decompress_usecs);
+      ts_dict.emplace("decode_usecs", ts.decode_usecs);
+      ts_dict.emplace("write_usecs", ts.write_usecs);
+      ts_dict.emplace("max_usecs", ts.max_usecs);
+      ts_dict.emplace("slowest", this->describe_resource(*ts.slowest));
+      by_type_dict.emplace(string_for_resource_type(type), std::move(ts_dict));
+    }
+
+    auto by_decompressor_dict = JSON::dict();
+    for (const auto& [dcmp_id, ds] : decompressor_summaries) {
+      auto implementations_dict = JSON::dict();
+      for (const auto& [name, count] : ds.implementation_counts) {
+        implementations_dict.emplace(name, count);
+      }
+      auto ds_dict = JSON::dict();
+      ds_dict.emplace("count", ds.count);
+      ds_dict.emplace("failures", ds.failures);
+      ds_dict.emplace("cache_hits", ds.cache_hits);
+      ds_dict.emplace("implementations", std::move(implementations_dict));
+      ds_dict.emplace("input_bytes", ds.input_bytes);
+      ds_dict.emplace("output_bytes", ds.output_bytes);
+      ds_dict.emplace("usecs", ds.usecs);
+      ds_dict.emplace("emulated_cycles", ds.emulated_cycles);
+      ds_dict.emplace("max_usecs", ds.max_usecs);
+      ds_dict.emplace("slowest", this->describe_resource(*ds.slowest));
+      by_decompressor_dict.emplace(std::format("{}", dcmp_id), std::move(ds_dict));
+    }
+
+    auto ret = JSON::dict();
+    ret.emplace("files", std::move(files_list));
+    ret.emplace("resources", std::move(resources_list));
+    ret.emplace("by_type", std::move(by_type_dict));
+    ret.emplace("by_decompressor", std::move(by_decompressor_dict));
+    return ret;
+  }
+
+private:
+  struct FileRecord {
+    string filename;
+    size_t size;
+    uint64_t index_usecs;
+    size_t num_resources;
+  };
+
+  mutex lock;
+  vector<FileRecord> files;
+  vector<ResourceRecord> resources;
+
+  string describe_resource(const ResourceRecord& res) const {
+    return std::format("{}:{}:{}", this->files.at(res.file_index).filename, string_for_resource_type(res.type), res.id);
+  }
+};
+
+class ResourceExporter {
+private:
+  // When buffer_log is true (as it is for worker exporters in --jobs mode),
+  // log output is collected in log_buffer instead of being written directly to
+  // stderr, so the output for each file can be written out contiguously and in
+  // the same order as in a serial run.
+  template <typename... ArgTs>
+  void log(std::format_string<ArgTs...> fmt, ArgTs&&... args) {
+    if (this->buffer_log) {
+      this->log_buffer += std::format(fmt, std::forward<ArgTs>(args)...);
+    } else {
+      fwrite_fmt(stderr, fmt, std::forward<ArgTs>(args)...);
     }
   }
 
+  // Called after each complete output file is written, for --stats
+  inline void count_output_file(size_t size, uint64_t usecs) {
+    this->output_files_written++;
+    this->output_bytes_written += size;
+    this->output_write_usecs += usecs;
+  }
+
+  // Closes an output file opened with output_sink->open_file and counts it for
+  // --stats; start_usecs is the time when the file was opened
+  inline void close_output_file(OutputSink::File& f, uint64_t start_usecs) {
+    size_t size = f.close();
+    this->count_output_file(size, now() - start_usecs);
+  }
+
   string output_filename(
       const string& base_filename,
       const uint32_t* res_type,
@@ -223,9 +679,10 @@ private:
       const string& after,
       const string& data) {
     string filename = this->output_filename(base_filename, res, after);
-    this->ensure_directories_exist(filename);
-    save_file(filename, data);
-    fwrite_fmt(stderr, "... {}\n", filename);
+    uint64_t start = now();
+    this->output_sink->write_file(filename, data);
+    this->count_output_file(data.size(), now() - start);
+    this->log("... {}\n", filename);
   }
 
   template <PixelFormat Format>
@@ -235,9 +692,13 @@ private:
       const string& after,
       const Image<Format>& img) {
     string filename = this->output_filename(base_filename, res, after);
-    this->ensure_directories_exist(filename);
-    filename = this->image_saver.save_image(img, filename);
-    fwrite_fmt(stderr, "... {}\n", filename);
+    filename += '.';
+    filename += this->image_saver.file_extension();
+    uint64_t start = now();
+    string data = this->image_saver.serialize_image(img);
+    this->output_sink->write_file(filename, data);
+    this->count_output_file(data.size(), now() - start);
+    this->log("... {}\n", filename);
   }
 
   void write_decoded_TMPL(const string& base_filename, shared_ptr<const ResourceFile::Resource> res) {
@@ -549,9 +1010,13 @@ private:
   }
 
   void write_icns(const string& base_filename, const shared_ptr<const ResourceFile::Resource>& icon) {
-    // Already exported? Save time and don't export it again
-    if (exported_family_icns.find(icon->id) != exported_family_icns.end()) {
-      return;
+    // Already exported (or being exported by another thread)? Save time and
+    // don't export it again
+    {
+      lock_guard g(this->file_state->lock);
+      if (!this->file_state->exported_family_icns.emplace(icon->id).second) {
+        return;
+      }
     }
 
     // Load all of the family's icons
@@ -598,8 +1063,6 @@ private:
     data.pput_u32b(4, data.size());
 
     this->write_decoded_data(base_filename, icon, ".icns", data.str());
-
-    exported_family_icns.insert(icon->id);
   }
 
   void write_decoded_ICNN(const string& base_filename, shared_ptr<const ResourceFile::Resource> res) {
@@ -767,7 +1230,65 @@ private:
     this->write_decoded_icns(base_filename, res, decoded);
   }
 
+  // Renders a PICT in bands, writing each band to the output file as soon as
+  // it's rendered, so large PICTs never have to be entirely in memory. Returns
+  // false without writing anything if the PICT should be decoded normally
+  // instead (because it's small enough, or because rendering it failed before
+  // any output was written).
+  bool write_decoded_PICT_banded(const string& base_filename, shared_ptr<const ResourceFile::Resource> res) {
+    auto [width, height] = ResourceFile::decode_PICT_dimensions(res);
+    size_t band_height = this->pict_band_height;
+    if (band_height == 0) {
+      if (width * height <= MAX_UNBANDED_PICT_PIXELS) {
+        return false;
+      }
+      band_height = max<size_t>(PICT_BAND_PIXELS / width, 1);
+    }
+    if (band_height >= height) {
+      return false;
+    }
+
+    string filename = this->output_filename(base_filename, res, "");
+    filename += '.';
+    filename += this->image_saver.file_extension();
+
+    // The output file isn't created until the first band is done, so if the
+    // PICT can't be rendered (or contains QuickTime data that has to be written
+    // as-is), nothing has been written yet and we can fall back to decode_PICT.
+    // If rendering fails after that, f is destroyed without being closed,
+    // which deletes the incomplete file.
+    optional<OutputSink::File> f;
+    optional<ImageSaver::RowWriter> row_writer;
+    // Only the time spent writing (not rendering) is counted for --stats
+    uint64_t write_usecs = 0;
+    try {
+      this->current_rf->decode_PICT_banded(res, band_height, [&](const ImageRGBA8888N& band, size_t) -> void {
+        uint64_t start = now();
+        if (!f) {
+          f.emplace(this->output_sink->open_file(filename));
+          row_writer.emplace(this->image_saver.open_row_writer(f->get(), width, height));
+        }
+        row_writer->write_rows(band);
+        write_usecs += now() - start;
+      });
+    } catch (const exception&) {
+      if (!f) {
+        return false;
+      }
+      throw;
+    }
+    uint64_t start = now();
+    row_writer->close();
+    size_t size = f->close();
+    this->count_output_file(size, write_usecs + (now() - start));
+    this->log("... {}\n", filename);
+    return true;
+  }
+
   void write_decoded_PICT_internal(const string& base_filename, shared_ptr<const ResourceFile::Resource> res) {
+    if (this->write_decoded_PICT_banded(base_filename, res)) {
+      return;
+    }
     auto decoded = this->current_rf->decode_PICT(res, false);
     if (!decoded.embedded_image_data.empty()) {
       this->write_decoded_data(base_filename, res, "." + decoded.embedded_image_format, decoded.embedded_image_data);
@@ -777,6 +1298,9 @@ private:
   }
 
   void write_decoded_PICT(const string& base_filename, shared_ptr<const ResourceFile::Resource> res) {
+    if (this->write_decoded_PICT_banded(base_filename, res)) {
+      return;
+    }
     auto decoded = this->current_rf->decode_PICT(res);
     if (!decoded.embedded_image_data.empty()) {
       this->write_decoded_data(base_filename, res, "." + decoded.embedded_image_format, decoded.embedded_image_data);
@@ -845,8 +1369,8 @@ private:
 
     {
       string description_filename = this->output_filename(base_filename, res, "_description.txt");
-      this->ensure_directories_exist(description_filename);
-      auto f = fopen_unique(description_filename, "wt");
+      uint64_t start = now();
+      auto f = this->output_sink->open_file(description_filename);
       fwrite_fmt(f.get(), "\
 # source_bit_depth = {} ({} color table)\n\
 # dynamic: {}\n\
@@ -887,8 +1411,9 @@ private:
       fwrite_fmt(f.get(), "\n# missing glyph\n");
       fwrite_fmt(f.get(), "#   bitmap offset: {}; width: {}\n", decoded.missing_glyph.bitmap_offset, decoded.missing_glyph.bitmap_width);
       fwrite_fmt(f.get(), "#   character offset: {}; width: {}\n", decoded.missing_glyph.offset, decoded.missing_glyph.width);
+      this->close_output_file(f, start);
 
-      fwrite_fmt(stderr, "... {}\n", description_filename);
+      this->log("... {}\n", description_filename);
     }
 
     this->write_decoded_image(
@@ -1325,22 +1850,24 @@ private:
   void write_decoded_pef(const string& base_filename, shared_ptr<const ResourceFile::Resource> res) {
     auto pef = this->current_rf->decode_pef(res);
     string filename = this->output_filename(base_filename, res, ".txt");
-    this->ensure_directories_exist(filename);
-    auto f = fopen_unique(filename, "wt");
+    uint64_t start = now();
+    auto f = this->output_sink->open_file(filename);
     pef.print(f.get());
-    fwrite_fmt(stderr, "... {}\n", filename);
+    this->close_output_file(f, start);
+    this->log("... {}\n", filename);
   }
 
   void write_decoded_expt_nsrd(const string& base_filename, shared_ptr<const ResourceFile::Resource> res) {
     auto decoded = (res->type == RESOURCE_TYPE_expt) ? this->current_rf->decode_expt(res) : this->current_rf->decode_nsrd(res);
     string filename = this->output_filename(base_filename, res, ".txt");
-    this->ensure_directories_exist(filename);
-    auto f = fopen_unique(filename, "wt");
+    uint64_t start = now();
+    auto f = this->output_sink->open_file(filename);
     fputs("Mixed-mode manager header:\n", f.get());
     print_data(f.get(), decoded.header);
     fputc('\n', f.get());
     decoded.pef.print(f.get());
-    fwrite_fmt(stderr, "... {}\n", filename);
+    this->close_output_file(f, start);
+    this->log("... {}\n", filename);
   }
 
   void write_decoded_inline_68k_or_pef(const string& base_filename, shared_ptr<const ResourceFile::Resource> res) {
@@ -1428,8 +1955,8 @@ private:
     auto decoded = this->current_rf->decode_DITL(res);
 
     string filename = this->output_filename(base_filename, res, ".txt");
-    this->ensure_directories_exist(filename);
-    auto f = fopen_unique(filename, "wt");
+    uint64_t start = now();
+    auto f = this->output_sink->open_file(filename);
     fwrite_fmt(f.get(), "# {} entries\n", decoded.size());
 
     for (size_t z = 0; z < decoded.size(); z++) {
@@ -1493,6 +2020,7 @@ private:
         fwrite_fmt(f.get(), "#   text: \"{}\"\n", text);
       }
     }
+    this->close_output_file(f, start);
   }
 
   JSON generate_json_for_INST(
@@ -1538,7 +2066,7 @@ private:
         snd_is_mp3 = decoded_snd.is_mp3;
 
       } catch (const exception& e) {
-        fwrite_fmt(stderr, "warning: failed to get sound metadata for instrument {} region {:X}-{:X} from snd/csnd/esnd {}: {}\n",
+        this->log("warning: failed to get sound metadata for instrument {} region {:X}-{:X} from snd/csnd/esnd {}: {}\n",
             id, rgn.key_low, rgn.key_high, rgn.snd_id, e.what());
       }
 
@@ -1627,7 +2155,7 @@ private:
           instruments.emplace_back(generate_json_for_INST(
               base_filename, it.first, this->current_rf->decode_INST(it.second), s->semitone_shift));
         } catch (const exception& e) {
-          fwrite_fmt(stderr, "warning: failed to add instrument {} from INST {}: {}\n",
+          this->log("warning: failed to add instrument {} from INST {}: {}\n",
               it.first, it.second, e.what());
         }
       }
@@ -1640,7 +2168,7 @@ private:
         instruments.emplace_back(generate_json_for_INST(
             base_filename, id, this->current_rf->decode_INST(id), s ? s->semitone_shift : 0));
       } catch (const exception& e) {
-        fwrite_fmt(stderr, "warning: failed to add instrument {}: {}\n", id, e.what());
+        this->log("warning: failed to add instrument {}: {}\n", id, e.what());
       }
     }
 
@@ -1791,6 +2319,69 @@ private:
     return false;
   }
 
+  // Gets a resource from current_rf and exports it. If --stats was given, the
+  // time taken by each step is recorded.
+  bool export_resource_from_current_file(const string& base_filename, uint32_t type, int16_t id) {
+    if (!this->stats) {
+      const auto& res = this->current_rf->get_resource(type, id, this->decompress_flags);
+      return this->export_resource(base_filename, res);
+    }
+
+    ExportStats::ResourceRecord record;
+    record.file_index = this->stats_file_index;
+    record.type = type;
+    record.id = id;
+
+    // Load the data (if the index is lazy) without decompressing it first, so
+    // loading and decompression can be timed separately
+    uint64_t start = now();
+    auto res = this->current_rf->get_resource(type, id, DecompressionFlag::DISABLED);
+    record.load_usecs = now() - start;
+    record.size = res->data.size();
+    record.compressed = (res->flags & ResourceFlag::FLAG_COMPRESSED);
+
+    if (record.compressed) {
+      start = now();
+      res = this->current_rf->get_resource(type, id, this->decompress_flags, &record.decompression);
+      record.decompress_usecs = now() - start;
+      record.decompression_failed = (res->flags & (ResourceFlag::FLAG_COMPRESSED | ResourceFlag::FLAG_DECOMPRESSION_FAILED));
+      record.decompressed_size = res->data.size();
+    }
+
+    this->output_files_written = 0;
+    this->output_bytes_written = 0;
+    this->output_write_usecs = 0;
+    start = now();
+    try {
+      record.exported = this->export_resource(base_filename, res);
+    } catch (const exception&) {
+      // Record the failure before passing it on to the caller
+      record.decode_usecs = now() - start;
+      this->stats->add_resource(std::move(record));
+      throw;
+    }
+    uint64_t export_usecs = now() - start;
+    record.write_usecs = min<uint64_t>(this->output_write_usecs, export_usecs);
+    record.decode_usecs = export_usecs - record.write_usecs;
+    record.files_written = this->output_files_written;
+    record.bytes_written = this->output_bytes_written;
+    bool exported = record.exported;
+    this->stats->add_resource(std::move(record));
+    return exported;
+  }
+
+  // Like export_resource_from_current_file, but if the resource can't be
+  // loaded or exported, logs a warning and continues with the rest of the file
+  // instead of failing the entire file
+  bool export_resource_from_current_file_or_warn(const string& base_filename, uint32_t type, int16_t id) {
+    try {
+      return this->export_resource_from_current_file(base_filename, type, id);
+    } catch (const exception& e) {
+      this->log("warning: failed to export resource {}:{}: {}\n", string_for_resource_type(type), id, e.what());
+      return false;
+    }
+  }
+
   bool disassemble_file(const string& filename) {
     string resource_fork_filename = filename;
     if (!this->use_data_fork) {
@@ -1800,13 +2391,13 @@ private:
     // On HFS+, the resource fork always exists, but might be empty. On APFS,
     // the resource fork is optional.
     if ((this->index_format == IndexFormat::DIRECTORY) && !std::filesystem::is_directory(resource_fork_filename)) {
-      fwrite_fmt(stderr, ">>> {} ({})\n", filename, "directory is missing");
+      this->log(">>> {} ({})\n", filename, "directory is missing");
       return false;
     } else if ((this->index_format != IndexFormat::DIRECTORY) && (!std::filesystem::is_regular_file(resource_fork_filename) || (std::filesystem::file_size(resource_fork_filename) == 0))) {
-      fwrite_fmt(stderr, ">>> {} ({})\n", filename, this->use_data_fork ? "file is empty" : "resource fork missing or empty");
+      this->log(">>> {} ({})\n", filename, this->use_data_fork ? "file is empty" : "resource fork missing or empty");
       return false;
     } else {
-      fwrite_fmt(stderr, ">>> {}\n", filename);
+      this->log(">>> {}\n", filename);
     }
 
     // Compute the base filename
@@ -1814,65 +2405,101 @@ private:
     string base_filename = (last_slash_pos == string::npos) ? filename : filename.substr(last_slash_pos + 1);
 
     // Get the resources from the file
+    uint64_t index_start = now();
     try {
-      switch (this->index_format) {
-        case IndexFormat::RESOURCE_FORK:
-          this->current_rf = make_unique<ResourceFile>(parse_resource_fork(load_file(resource_fork_filename)));
-          break;
-        case IndexFormat::DIRECTORY:
-          this->current_rf = make_unique<ResourceFile>(load_resource_file_from_directory(resource_fork_filename));
-          break;
-        case IndexFormat::MACBINARY:
-          this->current_rf = make_unique<ResourceFile>(parse_macbinary_resource_fork(load_file(resource_fork_filename)));
-          break;
-        case IndexFormat::APPLESINGLE_APPLEDOUBLE:
-          this->current_rf = make_unique<ResourceFile>(parse_applesingle_appledouble_resource_fork(load_file(resource_fork_filename)));
-          break;
-        case IndexFormat::MOHAWK:
-          this->current_rf = make_unique<ResourceFile>(parse_mohawk(load_file(resource_fork_filename)));
-          break;
-        case IndexFormat::HIRF:
-          this->current_rf = make_unique<ResourceFile>(parse_hirf(load_file(resource_fork_filename)));
-          break;
-        case IndexFormat::DC_DATA:
-          this->current_rf = make_unique<ResourceFile>(parse_dc_data(load_file(resource_fork_filename)));
-          break;
-        case IndexFormat::CBAG:
-          this->current_rf = make_unique<ResourceFile>(parse_cbag(load_file(resource_fork_filename)));
-          break;
-        default:
-          throw logic_error("invalid index format");
+      // For single-file formats, only the index is parsed here; resource data
+      // is read from the mapped file only for the resources that are exported
+      if (this->index_format == IndexFormat::DIRECTORY) {
+        this->current_rf = make_shared<ResourceFile>(load_resource_file_from_directory(resource_fork_filename));
+      } else {
+        this->current_rf = make_shared<ResourceFile>(parse_lazy_resource_file(
+            this->index_format, make_shared<MappedFile>(resource_fork_filename)));
       }
+      // The exporter never modifies the file, so use the compact index
+      this->current_rf->freeze();
     } catch (const cannot_open_file&) {
-      fwrite_fmt(stderr, "failed on {}: cannot open file\n", filename);
+      this->log("failed on {}: cannot open file\n", filename);
       return false;
     } catch (const io_error& e) {
-      fwrite_fmt(stderr, "failed on {}: cannot read data\n", filename);
+      this->log("failed on {}: cannot read data\n", filename);
       return false;
     } catch (const runtime_error& e) {
-      fwrite_fmt(stderr, "failed on {}: corrupt resource index ({})\n", filename, e.what());
+      this->log("failed on {}: corrupt resource index ({})\n", filename, e.what());
       return false;
     } catch (const out_of_range& e) {
-      fwrite_fmt(stderr, "failed on {}: corrupt resource index\n", filename);
+      this->log("failed on {}: corrupt resource index\n", filename);
       return false;
     }
 
     bool ret = false;
+    this->file_state = make_shared<FileState>();
     try {
       auto resources = this->current_rf->all_resources();
+      if (this->stats) {
+        size_t file_size = (this->index_format == IndexFormat::DIRECTORY)
+            ? 0
+            : std::filesystem::file_size(resource_fork_filename);
+        this->stats_file_index = this->stats->add_file(filename, file_size, now() - index_start, resources.size());
+      }
 
       bool has_INST = false;
+      vector<pair<uint32_t, int16_t>> selected_resources;
       for (const auto& it : resources) {
         if (!is_included(it.first, it.second) || is_excluded(it.first, it.second)) {
           continue;
         }
-
-        const auto& res = this->current_rf->get_resource(it.first, it.second, this->decompress_flags);
-
         if (it.first == RESOURCE_TYPE_INST) {
           has_INST = true;
         }
-        ret |= this->export_resource(base_filename, res);
+        selected_resources.emplace_back(it);
+      }
+
+      if (this->num_jobs == 1) {
+#ifndef PHOSG_WINDOWS
+        // If there's a preprocessor server, keep a few resources in flight so
+        // it doesn't have to wait for us to decode each result before it can
+        // start on the next resource. (When exporting in parallel, each worker
+        // has a resource in flight instead.) Only resources that don't need to
+        // be decompressed are submitted ahead of time, so that decompression
+        // (and any warnings it prints) happens when each resource is exported.
+        // If a resource can't be loaded here, it's skipped; the error is
+        // reported when the resource is exported. When collecting stats, there
+        // is no lookahead, since loading ahead of time would hide each
+        // resource's load time.
+        static constexpr size_t PREPROCESSOR_PIPELINE_DEPTH = 16;
+        size_t next_submit_index = 0;
+#endif
+        for (size_t z = 0; z < selected_resources.size(); z++) {
+#ifndef PHOSG_WINDOWS
+          if (this->external_preprocessor_server && !this->stats) {
+            size_t end_submit_index = min<size_t>(z + PREPROCESSOR_PIPELINE_DEPTH, selected_resources.size());
+            for (; next_submit_index < end_submit_index; next_submit_index++) {
+              const auto& submit_it = selected_resources[next_submit_index];
+              shared_ptr<const ResourceFile::Resource> submit_res;
+              try {
+                submit_res = this->current_rf->get_resource(submit_it.first, submit_it.second, DecompressionFlag::DISABLED);
+              } catch (const exception&) {
+                continue;
+              }
+              if (!(submit_res->flags & ResourceFlag::FLAG_COMPRESSED)) {
+                this->pending_preprocessor_results.emplace(
+                    submit_res.get(), this->external_preprocessor_server->submit(submit_res));
+              }
+            }
+          }
+#endif
+          const auto& it = selected_resources[z];
+          ret |= this->export_resource_from_current_file_or_warn(base_filename, it.first, it.second);
+        }
+#ifndef PHOSG_WINDOWS
+        this->pending_preprocessor_results.clear();
+#endif
+
+      } else {
+        ret = this->run_parallel(selected_resources.size(), [&](ResourceExporter& worker, size_t index) -> bool {
+          const auto& it = selected_resources[index];
+          return worker.export_resource_from_current_file_or_warn(base_filename, it.first, it.second);
+        });
       }
 
       // Special case: if we disassembled any INSTs and the save-raw behavior is
@@ -1882,26 +2509,29 @@ private:
 
         try {
           auto json = generate_json_for_SONG(base_filename, nullptr);
-          save_file(json_filename, json.serialize(JSON::SerializeOption::FORMAT));
-          fwrite_fmt(stderr, "... {}\n", json_filename);
+          this->output_sink->write_file(json_filename, json.serialize(JSON::SerializeOption::FORMAT));
+          this->log("... {}\n", json_filename);
 
         } catch (const exception& e) {
-          fwrite_fmt(stderr, "failed to write smssynth env template {}: {}\n",
+          this->log("failed to write smssynth env template {}: {}\n",
               json_filename, e.what());
         }
       }
 
     } catch (const exception& e) {
-      fwrite_fmt(stderr, "failed on {}: {}\n", filename, e.what());
+      this->log("failed on {}: {}\n", filename, e.what());
     }
 
     this->current_rf.reset();
     return ret;
   }
 
-  bool disassemble_path(const string& filename) {
+  // Calls fn for each file within filename (or for filename itself, if it's
+  // not a directory), in sorted order. this->out_dir is set appropriately for
+  // each file when fn is called.
+  void walk_path(const string& filename, const function<void(const string&)>& fn) {
     if ((this->index_format != IndexFormat::DIRECTORY) && std::filesystem::is_directory(filename)) {
-      fwrite_fmt(stderr, ">>> {} (directory)\n", filename);
+      this->log(">>> {} (directory)\n", filename);
 
       unordered_set<string> items;
       try {
@@ -1909,8 +2539,8 @@ private:
           items.emplace(item.path().filename().string());
         }
       } catch (const runtime_error& e) {
-        fwrite_fmt(stderr, "warning: can\'t list directory: {}\n", e.what());
-        return false;
+        this->log("warning: can\'t list directory: {}\n", e.what());
+        return;
       }
 
       vector<string> sorted_items;
@@ -1923,19 +2553,129 @@ private:
       string sub_out_dir = this->out_dir.empty()
           ? base_filename
           : (this->out_dir + "/" + base_filename);
-      bool ret = false;
       for (const string& item : sorted_items) {
         sub_out_dir.swap(this->out_dir);
-        ret |= this->disassemble_path(filename + "/" + item);
+        this->walk_path(filename + "/" + item, fn);
         sub_out_dir.swap(this->out_dir);
       }
-      return ret;
 
     } else {
-      return this->disassemble_file(filename);
+      fn(filename);
     }
   }
 
+  bool disassemble_path(const string& filename) {
+    bool ret = false;
+    this->walk_path(filename, [&](const string& item) -> void {
+      ret |= this->disassemble_file(item);
+    });
+    return ret;
+  }
+
+  // Calls fn(worker, index) for each index in [0, count), distributing the
+  // calls across up to num_jobs worker exporters. Each worker is a copy of this
+  // exporter (so it shares current_rf and file_state), but it does not run any
+  // further work in parallel itself. Each call's log output is buffered and
+  // then written to this exporter's log in index order, so the output is the
+  // same as if all the calls had been made serially. Returns true if fn
+  // returned true for any index.
+  bool run_parallel(size_t count, const function<bool(ResourceExporter&, size_t)>& fn) {
+    if (count == 0) {
+      return false;
+    }
+
+    size_t num_threads = this->num_jobs ? this->num_jobs : thread::hardware_concurrency();
+    num_threads = max<size_t>(min<size_t>(num_threads, count), 1);
+
+    vector<ResourceExporter> workers(num_threads, *this);
+    for (auto& worker : workers) {
+      worker.num_jobs = 1;
+      worker.buffer_log = true;
+      worker.log_buffer.clear();
+    }
+
+    struct Result {
+      bool complete = false;
+      bool ret = false;
+      string log;
+    };
+    vector<Result> results(count);
+    size_t next_result_to_print = 0;
+    mutex results_lock;
+
+    // Threads pick up the next unprocessed index as soon as they're done with
+    // their previous one, so a slow item doesn't hold up the rest of the queue
+    parallel_range<size_t>([&](size_t index, size_t thread_num) -> bool {
+      auto& worker = workers.at(thread_num);
+      bool item_ret = fn(worker, index);
+
+      // Write out the logs for all items that are done, up to the first one
+      // that isn't
+      lock_guard g(results_lock);
+      auto& result = results[index];
+      result.complete = true;
+      result.ret = item_ret;
+      result.log = std::move(worker.log_buffer);
+      worker.log_buffer.clear();
+      for (; (next_result_to_print < results.size()) && results[next_result_to_print].complete; next_result_to_print++) {
+        auto& print_result = results[next_result_to_print];
+        if (!print_result.log.empty()) {
+          this->log("{}", print_result.log);
+          print_result.log = string();
+        }
+      }
+      return false;
+    },
+        0, count, num_threads);
+
+    bool ret = false;
+    for (const auto& result : results) {
+      ret |= result.ret;
+    }
+    return ret;
+  }
+
+  bool disassemble_path_parallel(const string& filename) {
+    // Collect the list of files first (this is fast compared to the actual
+    // disassembly), then disassemble them in parallel. If there's only one
+    // file, parallelize over its resources instead.
+    // Any log output from walking the directories (the directory names and
+    // listing failures) is held until the file that follows it is processed,
+    // so the output is in the same order as in a serial run.
+    struct WalkItem {
+      string filename;
+      string out_dir;
+      string log_before;
+    };
+    vector<WalkItem> files;
+    bool prev_buffer_log = this->buffer_log;
+    string prev_log_buffer = std::move(this->log_buffer);
+    this->buffer_log = true;
+    this->log_buffer.clear();
+    this->walk_path(filename, [&](const string& item) -> void {
+      files.emplace_back(WalkItem{item, this->out_dir, std::move(this->log_buffer)});
+      this->log_buffer.clear();
+    });
+    string log_after = std::move(this->log_buffer);
+    this->buffer_log = prev_buffer_log;
+    this->log_buffer = std::move(prev_log_buffer);
+
+    bool ret;
+    if (files.size() == 1) {
+      this->log("{}", files[0].log_before);
+      this->out_dir = files[0].out_dir;
+      ret = this->disassemble_file(files[0].filename);
+    } else {
+      ret = this->run_parallel(files.size(), [&](ResourceExporter& worker, size_t index) -> bool {
+        worker.log("{}", files[index].log_before);
+        worker.out_dir = files[index].out_dir;
+        return worker.disassemble_file(files[index].filename);
+      });
+    }
+    this->log("{}", log_after);
+    return ret;
+  }
+
 public:
   enum class SaveRawBehavior {
     NEVER = 0,
@@ -1959,7 +2699,11 @@ public:
         skip_templates(false),
         export_icon_family_as_image(true),
         export_icon_family_as_icns(true),
-        image_saver() {}
+        num_jobs(1),
+        pict_band_height(0),
+        image_saver(),
+        output_sink(make_shared<DirectoryOutputSink>()),
+        file_state(make_shared<FileState>()) {}
   ~ResourceExporter() = default;
 
   IndexFormat index_format;
@@ -1974,17 +2718,49 @@ public:
   optional<ResourceIDs> skip_ids;
   unordered_set<string> skip_names;
   vector<string> external_preprocessor_command;
+#ifndef PHOSG_WINDOWS
+  shared_ptr<ExternalPreprocessorServer> external_preprocessor_server;
+#endif
   TargetCompressedBehavior target_compressed_behavior;
   bool skip_templates;
   bool export_icon_family_as_image;
   bool export_icon_family_as_icns;
+  size_t num_jobs; // 1 = serial; 0 = one thread per CPU core
+  size_t pict_band_height; // 0 = only band large PICTs
   ImageSaver image_saver;
+  shared_ptr<OutputSink> output_sink;
+  shared_ptr<ExportStats> stats; // Null unless --stats is given
 
 private:
+  // If pict_band_height is zero, PICTs with more pixels than this are rendered
+  // in bands of about PICT_BAND_PIXELS pixels each (64MB and 16MB as RGBA)
+  static constexpr size_t MAX_UNBANDED_PICT_PIXELS = 0x1000000;
+  static constexpr size_t PICT_BAND_PIXELS = 0x400000;
+
   string base_out_dir; // Fixed part of filename (e.g. <file>.out)
   string out_dir; // Recursive part of filename (dirs after <file>.out)
-  unique_ptr<ResourceFile> current_rf;
-  unordered_set<int32_t> exported_family_icns;
+  shared_ptr<ResourceFile> current_rf;
+
+  // State shared between all workers exporting resources from the same file
+  struct FileState {
+    mutex lock;
+    unordered_set<int32_t> exported_family_icns;
+  };
+  shared_ptr<FileState> file_state;
+#ifndef PHOSG_WINDOWS
+  // Results from external_preprocessor_server for resources that were
+  // submitted before export_resource was called for them (see
+  // disassemble_file)
+  unordered_map<const ResourceFile::Resource*, shared_future<ExternalPreprocessorServer::Result>> pending_preprocessor_results;
+#endif
+  bool buffer_log = false;
+  string log_buffer;
+  // Counters for the resource currently being exported (see count_output_file)
+  size_t output_files_written = 0;
+  size_t output_bytes_written = 0;
+  uint64_t output_write_usecs = 0;
+  // Index of the current file in stats
+  size_t stats_file_index = 0;
 
 public:
   void set_decoder_alias(uint32_t from_type, uint32_t to_type) {
@@ -2012,9 +2788,9 @@ public:
     if (decompression_failed || is_compressed) {
       auto type_str = string_for_resource_type(res->type);
       if (decompression_failed) {
-        fwrite_fmt(stderr, "warning: failed to decompress resource {}:{}; saving raw compressed data\n", type_str, res->id);
+        this->log("warning: failed to decompress resource {}:{}; saving raw compressed data\n", type_str, res->id);
       } else {
-        fwrite_fmt(stderr, "note: resource {}:{} is compressed; saving raw compressed data\n", type_str, res->id);
+        this->log("note: resource {}:{} is compressed; saving raw compressed data\n", type_str, res->id);
       }
     }
     if ((this->target_compressed_behavior == TargetCompressedBehavior::TARGET) &&
@@ -2036,7 +2812,7 @@ public:
     if (!is_compressed && !this->external_preprocessor_command.empty()) {
       auto result = run_process(this->external_preprocessor_command, &res->data, false);
       if (result.exit_status != 0) {
-        fwrite_fmt(stderr, "\
+        this->log("\
 warning: external preprocessor failed with exit status 0x{:X}\n\
 \n\
 stdout ({} bytes):\n\
@@ -2047,10 +2823,31 @@ stderr ({} bytes):\n\
 \n",
             result.exit_status, result.stdout_contents.size(), result.stdout_contents, result.stderr_contents.size(), result.stderr_contents);
       } else {
-        fwrite_fmt(stderr, "note: external preprocessor succeeded and returned {} bytes\n", result.stdout_contents.size());
+        this->log("note: external preprocessor succeeded and returned {} bytes\n", result.stdout_contents.size());
         res_to_decode = make_shared<ResourceFile::Resource>(
             res->type, res->id, res->flags, res->name, std::move(result.stdout_contents));
       }
+    } else if (!is_compressed && this->external_preprocessor_server) {
+      try {
+        shared_future<ExternalPreprocessorServer::Result> future_result;
+        auto pending_it = this->pending_preprocessor_results.find(res.get());
+        if (pending_it != this->pending_preprocessor_results.end()) {
+          future_result = std::move(pending_it->second);
+          this->pending_preprocessor_results.erase(pending_it);
+        } else {
+          future_result = this->external_preprocessor_server->submit(res);
+        }
+        const auto& result = future_result.get();
+        if (!result.succeeded) {
+          this->log("warning: external preprocessor failed: {}\n", result.data);
+        } else {
+          this->log("note: external preprocessor succeeded and returned {} bytes\n", result.data.size());
+          res_to_decode = make_shared<ResourceFile::Resource>(
+              res->type, res->id, res->flags, res->name, result.data);
+        }
+      } catch (const exception& e) {
+        this->log("warning: {}\n", e.what());
+      }
     }
 #else
     if (!is_compressed && !this->external_preprocessor_command.empty()) {
@@ -2085,9 +2882,9 @@ stderr ({} bytes):\n\
         auto type_str = string_for_resource_type(res->type);
         if (remapped_type != res->type) {
           auto remapped_type_str = string_for_resource_type(remapped_type);
-          fwrite_fmt(stderr, "warning: failed to decode resource {}:{} (remapped to {}): {}\n", type_str, res->id, remapped_type_str, e.what());
+          this->log("warning: failed to decode resource {}:{} (remapped to {}): {}\n", type_str, res->id, remapped_type_str, e.what());
         } else {
-          fwrite_fmt(stderr, "warning: failed to decode resource {}:{}: {}\n", type_str, res->id, e.what());
+          this->log("warning: failed to decode resource {}:{}: {}\n", type_str, res->id, e.what());
         }
       }
     }
@@ -2109,16 +2906,16 @@ stderr ({} bytes):\n\
         try {
           string result = std::format("# (decoded with TMPL {})\n", tmpl_res->id);
           result += this->current_rf->disassemble_from_template(
-              res->data.data(), res->data.size(), this->current_rf->decode_TMPL(tmpl_res));
+              res->data.data(), res->data.size(), *this->current_rf->get_decoded_TMPL(tmpl_res));
           this->write_decoded_data(base_filename, res_to_decode, ".txt", result);
           decoded = true;
         } catch (const exception& e) {
           auto type_str = string_for_resource_type(res->type);
           if (remapped_type != res->type) {
             auto remapped_type_str = string_for_resource_type(remapped_type);
-            fwrite_fmt(stderr, "warning: failed to decode resource {}:{} (remapped to {}) with template {}: {}\n", type_str, res->id, remapped_type_str, tmpl_res->id, e.what());
+            this->log("warning: failed to decode resource {}:{} (remapped to {}) with template {}: {}\n", type_str, res->id, remapped_type_str, tmpl_res->id, e.what());
           } else {
-            fwrite_fmt(stderr, "warning: failed to decode resource {}:{} with template {}: {}\n", type_str, res->id, tmpl_res->id, e.what());
+            this->log("warning: failed to decode resource {}:{} with template {}: {}\n", type_str, res->id, tmpl_res->id, e.what());
           }
         }
       }
@@ -2137,9 +2934,9 @@ stderr ({} bytes):\n\
           auto type_str = string_for_resource_type(res->type);
           if (remapped_type != res->type) {
             auto remapped_type_str = string_for_resource_type(remapped_type);
-            fwrite_fmt(stderr, "warning: failed to decode resource {}:{} (remapped to {}) with system template: {}\n", type_str, res->id, remapped_type_str, e.what());
+            this->log("warning: failed to decode resource {}:{} (remapped to {}) with system template: {}\n", type_str, res->id, remapped_type_str, e.what());
           } else {
-            fwrite_fmt(stderr, "warning: failed to decode resource {}:{} with system template: {}\n", type_str, res->id, e.what());
+            this->log("warning: failed to decode resource {}:{} with system template: {}\n", type_str, res->id, e.what());
           }
         }
       }
@@ -2158,22 +2955,25 @@ stderr ({} bytes):\n\
 
       string out_filename_after = std::format(".{}", out_ext);
       string out_filename = this->output_filename(base_filename, res_to_decode, out_filename_after);
-      this->ensure_directories_exist(out_filename);
 
       try {
         // Hack: PICT resources, when saved to disk, should be prepended with a
         // 512-byte unused header
         if (res_to_decode->type == RESOURCE_TYPE_PICT) {
           static const string pict_header(0x200, 0);
-          auto f = fopen_unique(out_filename, "wb");
+          uint64_t start = now();
+          auto f = this->output_sink->open_file(out_filename);
           fwritex(f.get(), pict_header);
           fwritex(f.get(), res_to_decode->data);
+          this->close_output_file(f, start);
         } else {
-          save_file(out_filename, res_to_decode->data);
+          uint64_t start = now();
+          this->output_sink->write_file(out_filename, res_to_decode->data);
+          this->count_output_file(res_to_decode->data.size(), now() - start);
         }
-        fwrite_fmt(stderr, "... {}\n", out_filename);
+        this->log("... {}\n", out_filename);
       } catch (const exception& e) {
-        fwrite_fmt(stderr, "warning: failed to save raw data: {}\n", e.what());
+        this->log("warning: failed to save raw data: {}\n", e.what());
       }
     }
     return decoded || write_raw;
@@ -2181,7 +2981,118 @@ stderr ({} bytes):\n\
 
   bool disassemble(const string& filename, const string& base_out_dir) {
     this->base_out_dir = base_out_dir;
-    return this->disassemble_path(filename);
+    if (this->num_jobs == 1) {
+      return this->disassemble_path(filename);
+    } else {
+      return this->disassemble_path_parallel(filename);
+    }
+  }
+
+  // Decompresses every compressed resource in the given file (or in all files
+  // in the given directory) with every available decompressor implementation,
+  // and prints any results that don't match the emulated decompressors' output
+  // and a summary of each implementation's throughput. Returns false if there
+  // were any mismatches.
+  bool compare_decompressors(const string& filename) {
+    struct ImplementationStats {
+      size_t num_succeeded = 0;
+      size_t num_failed = 0;
+      size_t num_mismatched = 0;
+      size_t input_bytes = 0;
+      size_t output_bytes = 0;
+      uint64_t duration_usecs = 0;
+    };
+    map<string, ImplementationStats> stats;
+    size_t num_resources = 0;
+    size_t num_mismatches = 0;
+
+    this->walk_path(filename, [&](const string& item) -> void {
+      string resource_fork_filename = this->use_data_fork ? item : (item + RESOURCE_FORK_FILENAME_SUFFIX);
+      shared_ptr<ResourceFile> rf;
+      try {
+        if (this->index_format == IndexFormat::DIRECTORY) {
+          rf = make_shared<ResourceFile>(load_resource_file_from_directory(resource_fork_filename));
+        } else {
+          rf = make_shared<ResourceFile>(parse_lazy_resource_file(
+              this->index_format, make_shared<MappedFile>(resource_fork_filename)));
+        }
+      } catch (const exception& e) {
+        this->log("failed on {}: {}\n", item, e.what());
+        return;
+      }
+
+      for (const auto& [type, id] : rf->all_resources()) {
+        string type_str = string_for_resource_type(type);
+        shared_ptr<const ResourceFile::Resource> res;
+        try {
+          res = rf->get_resource(type, id, DecompressionFlag::DISABLED);
+        } catch (const exception& e) {
+          this->log("{}:{}:{}: cannot read resource: {}\n", item, type_str, id, e.what());
+          continue;
+        }
+        if (!(res->flags & ResourceFlag::FLAG_COMPRESSED)) {
+          continue;
+        }
+
+        vector<DecompressionImplementationResult> results;
+        try {
+          results = decompress_resource_with_all_implementations(res, this->decompress_flags, rf.get());
+        } catch (const exception& e) {
+          this->log("{}:{}:{}: cannot decompress: {}\n", item, type_str, id, e.what());
+          continue;
+        }
+        num_resources++;
+
+        // The reference output is the first emulated implementation that
+        // succeeded, or the first implementation that succeeded if none of the
+        // emulated ones did
+        const DecompressionImplementationResult* reference = nullptr;
+        for (const auto& result : results) {
+          if (result.succeeded && (!reference || (result.is_emulated && !reference->is_emulated))) {
+            reference = &result;
+          }
+        }
+
+        for (const auto& result : results) {
+          auto& impl_stats = stats[result.implementation_name];
+          if (!result.succeeded) {
+            impl_stats.num_failed++;
+            this->log("{}:{}:{}: {} failed: {}\n", item, type_str, id, result.implementation_name, result.data);
+            continue;
+          }
+          impl_stats.num_succeeded++;
+          impl_stats.input_bytes += res->data.size();
+          impl_stats.output_bytes += result.data.size();
+          impl_stats.duration_usecs += result.duration_usecs;
+
+          if (result.data != reference->data) {
+            size_t offset = 0;
+            while ((offset < result.data.size()) && (offset < reference->data.size()) &&
+                (result.data[offset] == reference->data[offset])) {
+              offset++;
+            }
+            impl_stats.num_mismatched++;
+            num_mismatches++;
+            this->log("{}:{}:{}: {} output differs from {} output at offset {:X}\n",
+                item, type_str, id, result.implementation_name, reference->implementation_name, offset);
+          }
+        }
+      }
+    });
+
+    fwrite_fmt(stdout, "{} compressed resources; {} mismatched results\n", num_resources, num_mismatches);
+    fwrite_fmt(stdout, "IMPLEMENTATION  SUCCEEDED  FAILED  MISMATCHED  INPUT BYTES  OUTPUT BYTES   SECONDS  OUTPUT MB/SEC\n");
+    for (const auto& [name, impl_stats] : stats) {
+      double seconds = static_cast<double>(impl_stats.duration_usecs) / 1000000.0;
+      double mb_per_sec = (impl_stats.duration_usecs == 0)
+          ? 0.0
+          : (static_cast<double>(impl_stats.output_bytes) / static_cast<double>(impl_stats.duration_usecs));
+      fwrite_fmt(stdout, "{:<14}  {:>9}  {:>6}  {:>10}  {:>11}  {:>12}  {:>8.3f}  {:>13.2f}\n",
+          name, impl_stats.num_succeeded, impl_stats.num_failed, impl_stats.num_mismatched,
+          impl_stats.input_bytes, impl_stats.output_bytes, seconds, mb_per_sec);
+    }
+
+    return (num_mismatches == 0);
   }
 };
 
@@ -2380,6 +3291,13 @@ Resource disassembly input options:\n\
         dc-data: DC Data file\n\
         cbag: CBag archive\n\
       If the index format is not resource-fork, --data-fork is implied.\n\
+  --jobs=N\n\
+      Use up to N threads. If input_filename is a directory, multiple files are\n\
+      disassembled at the same time; if it\'s a single file, multiple resources\n\
+      from it are decoded at the same time. If N is 0, use one thread per CPU\n\
+      core. The log output for each file or resource is still written\n\
+      contiguously and in the same order as when N is 1 (the default), but it\n\
+      may be delayed until earlier files or resources are done.\n\
   --target=TYPE[:ID]\n\
       Only extract resources of this type and optionally IDs (can be given\n\
       multiple times). To specify characters with special meanings or\n\
@@ -2450,6 +3368,11 @@ Resource decompression options:\n\
       Don\'t attempt to use the default 68K decompressors.\n\
   --skip-system-ncmp\n\
       Don\'t attempt to use the default PEF decompressors.\n\
+  --decompression-cache=DIR\n\
+      Save the results of emulated decompressors in DIR, and use previously-\n\
+      saved results instead of running the decompressors again when the same\n\
+      compressed data is seen later, in this run or any later run. The cache\n\
+      is not used with --trace-decompression or --debug-decompression.\n\
   --verbose-decompression\n\
       Show log output when running resource decompressors.\n\
   --strict-decompression\n\
@@ -2475,6 +3398,13 @@ Resource decompression options:\n\
       are ignored (no operation is done on any resource file). These options\n\
       are generally only useful for finding bugs in the emulators or native\n\
       decompressor implementations.\n\
+  --compare-decompressors\n\
+      Decompress every compressed resource in the input file (or in all files\n\
+      in the input directory) with every available decompressor, and report\n\
+      any outputs that differ from the emulated decompressors\' outputs, as\n\
+      well as the throughput of each implementation. No files are written.\n\
+      The --skip-*-dcmp and --skip-*-ncmp options can be used to exclude some\n\
+      implementations from the comparison.\n\
   --describe-system-template=TYPE\n\
       Describe the included system template for resource type TYPE and print\n\
       the result to stdout. If this option is given, all other options are\n\
@@ -2491,6 +3421,17 @@ Resource decoding options:\n\
       command via stdin, and the command\'s output on stdout will be treated as\n\
       the resource data to decode. This can be used to transparently decompress\n\
       some custom compression formats.\n\
+  --external-preprocessor-server=COMMAND\n\
+      Like --external-preprocessor, but start the command only once and send\n\
+      it all the resources over its stdin. This is much faster than starting\n\
+      a new process for each resource. Each request consists of the resource\n\
+      type (4 bytes), ID (2 bytes), flags (2 bytes), name size (4 bytes),\n\
+      name, data size (4 bytes), and data. For each request, the command must\n\
+      write a response to its stdout, consisting of a status (4 bytes; 0 means\n\
+      success), the size of the following data (4 bytes), and the preprocessed\n\
+      data (or an error message if the status isn\'t zero). All integers are\n\
+      big-endian. Several requests may be sent before any responses are read,\n\
+      and the responses must be in the same order as the requests.\n\
   --skip-decode\n\
       Don\'t use any decoders to convert resources to modern formats. This\n\
       option implies --skip-templates as well.\n\
@@ -2541,6 +3482,18 @@ Resource disassembly output options:\n\
       files from SONG resources will not play with smssynth unless you manually put\n\
       the required sound and MIDI resources in the same directory as the SONG JSON\n\
       after decoding.\n\
+  --output-archive=FILE\n\
+      Instead of creating a separate file for each output, write all outputs\n\
+      into a single tar archive named FILE. The files in the archive have the\n\
+      same names as they would have on disk. This is much faster than creating\n\
+      many small files on some filesystems.\n\
+  --stats=FILE\n\
+      Record how long each resource took to load, decompress, decode, and\n\
+      write, along with its input and output sizes and how it was decompressed\n\
+      (including the number of instructions executed by emulated decompressors)\n\
+      and write them to FILE as JSON at the end of the run, followed by totals\n\
+      for each resource type and each decompressor. Useful for finding the\n\
+      resources that make a run slow.\n\
 \n" IMAGE_SAVER_HELP
         "Resource-type specific options:\n\
   --icon-family-format=image,icns\n\
@@ -2549,6 +3502,12 @@ Resource disassembly output options:\n\
         image:  Save each icon of the family as a separate image file (the format\n\
                 can be set with " IMAGE_SAVER_OPTION ")\n\
         icns:   Save all icons of the family together in a single .icns file\n\
+  --pict-band-height=N\n\
+      Render PICT resources N rows at a time, writing each band of rows to the\n\
+      output file as soon as it\'s rendered. This limits the memory used for\n\
+      very large PICTs, but is slower, since the PICT is parsed again for each\n\
+      band. By default, only PICTs with more than 16 million pixels are\n\
+      rendered this way.\n\
 \n\
 Resource file modification options:\n\
   --create\n\
@@ -2601,6 +3560,8 @@ int main(int argc, char* argv[]) {
     ResourceExporter exporter;
     string filename;
     string out_dir;
+    string output_archive_filename;
+    string stats_filename;
     vector<ModificationOperation> modifications;
     ResourceFile::Resource single_resource;
     bool decode_pict_file = false;
@@ -2611,6 +3572,7 @@ int main(int argc, char* argv[]) {
     int32_t disassemble_system_dcmp_id = 0x7FFFFFFF;
     int32_t disassemble_system_ncmp_id = 0x7FFFFFFF;
     uint32_t describe_system_template_type = 0;
+    bool compare_decompressors = false;
     for (int x = 1; x < argc; x++) {
       if (argv[x][0] == '-') {
         if (!strncmp(argv[x], "--disassemble-system-dcmp=", 26)) {
@@ -2619,6 +3581,8 @@ int main(int argc, char* argv[]) {
           disassemble_system_ncmp_id = strtol(&argv[x][26], nullptr, 0);
         } else if (!strncmp(argv[x], "--describe-system-template=", 27)) {
           describe_system_template_type = parse_cli_type(&argv[x][27]);
+        } else if (!strcmp(argv[x], "--compare-decompressors")) {
+          compare_decompressors = true;
 
         } else if (!strcmp(argv[x], "--index-format=resource-fork")) {
           exporter.index_format = IndexFormat::RESOURCE_FORK;
@@ -2644,6 +3608,9 @@ int main(int argc, char* argv[]) {
           exporter.index_format = IndexFormat::CBAG;
           exporter.use_data_fork = true;
 
+        } else if (!strncmp(argv[x], "--jobs=", 7)) {
+          exporter.num_jobs = strtoull(&argv[x][7], nullptr, 0);
+
         } else if (!strcmp(argv[x], "--decode-pict-file")) {
           decode_pict_file = true;
           single_resource.type = RESOURCE_TYPE_PICT;
@@ -2747,6 +3714,13 @@ int main(int argc, char* argv[]) {
         } else if (!strncmp(argv[x], "--external-preprocessor=", 24)) {
           exporter.external_preprocessor_command = split(&argv[x][24], ' ');
 
+        } else if (!strncmp(argv[x], "--external-preprocessor-server=", 31)) {
+#ifndef PHOSG_WINDOWS
+          exporter.external_preprocessor_server = make_shared<ExternalPreprocessorServer>(split(&argv[x][31], ' '));
+#else
+          throw std::runtime_error("External preprocessors are not supported on Windows");
+#endif
+
         } else if (!strncmp(argv[x], "--target-type=", 14)) {
           exporter.target_types_ids.emplace(parse_cli_type(&argv[x][14]), ResourceIDs(ResourceIDs::Init::ALL));
         } else if (!strncmp(argv[x], "--skip-type=", 12)) {
@@ -2799,6 +3773,10 @@ int main(int argc, char* argv[]) {
           exporter.filename_format = FILENAME_FORMAT_TYPE_FIRST_DIRS;
         } else if (!strncmp(argv[x], "--filename-format=", 18)) {
           exporter.filename_format = &argv[x][18];
+        } else if (!strncmp(argv[x], "--output-archive=", 17)) {
+          output_archive_filename = &argv[x][17];
+        } else if (!strncmp(argv[x], "--stats=", 8)) {
+          stats_filename = &argv[x][8];
 
         } else if (!strncmp(argv[x], "--icon-family-format=", 21)) {
           auto formats = split(&argv[x][21], ',');
@@ -2817,6 +3795,9 @@ int main(int argc, char* argv[]) {
             }
           }
 
+        } else if (!strncmp(argv[x], "--pict-band-height=", 19)) {
+          exporter.pict_band_height = strtoull(&argv[x][19], nullptr, 0);
+
         } else if (!strcmp(argv[x], "--data-fork")) {
           exporter.use_data_fork = true;
         } else if (!strcmp(argv[x], "--output-data-fork")) {
@@ -2850,6 +3831,8 @@ int main(int argc, char* argv[]) {
           exporter.decompress_flags |= DecompressionFlag::SKIP_SYSTEM_DCMP;
         } else if (!strcmp(argv[x], "--skip-system-ncmp")) {
           exporter.decompress_flags |= DecompressionFlag::SKIP_SYSTEM_NCMP;
+        } else if (!strncmp(argv[x], "--decompression-cache=", 22)) {
+          set_decompression_cache_directory(&argv[x][22]);
 
         } else if (!exporter.image_saver.process_cli_arg(argv[x])) {
           fwrite_fmt(stderr, "invalid option: {}\n", argv[x]);
@@ -2891,6 +3874,18 @@ int main(int argc, char* argv[]) {
       }
     }
 
+    if (compare_decompressors) {
+      if (filename.empty()) {
+        print_usage();
+        return 2;
+      }
+      return exporter.compare_decompressors(filename) ? 0 : 3;
+    }
+
+    if ((exporter.num_jobs != 1) && (exporter.decompress_flags & DecompressionFlag::DEBUG_EXECUTION)) {
+      throw invalid_argument("--debug-decompression cannot be used with --jobs");
+    }
+
     if (modify_resource_map && modifications.empty() && !create_resource_map) {
       throw runtime_error("multiple incompatible modes were specified");
     }
@@ -2901,6 +3896,10 @@ int main(int argc, char* argv[]) {
         return 2;
       }
 
+      if (!output_archive_filename.empty()) {
+        exporter.output_sink = make_shared<TarOutputSink>(output_archive_filename);
+      }
+
       if (single_resource.type) {
         exporter.save_raw = ResourceExporter::SaveRawBehavior::NEVER;
         exporter.target_types_ids.clear();
@@ -2929,18 +3928,26 @@ int main(int argc, char* argv[]) {
         string base_filename = (last_slash_pos == string::npos) ? filename : filename.substr(last_slash_pos + 1);
 
         const auto& res = rf.get_resource(type, id, exporter.decompress_flags);
-        return exporter.export_resource(filename, res) ? 0 : 3;
+        bool ret = exporter.export_resource(filename, res);
+        exporter.output_sink->finish();
+        return ret ? 0 : 3;
 
       } else {
         if (out_dir.empty()) {
           out_dir = filename + ".out";
         }
-        std::filesystem::create_directories(out_dir);
-        if (!exporter.disassemble(filename, out_dir)) {
-          return 3;
-        } else {
-          return 0;
+        if (output_archive_filename.empty()) {
+          std::filesystem::create_directories(out_dir);
+        }
+        if (!stats_filename.empty()) {
+          exporter.stats = make_shared<ExportStats>();
+        }
+        bool ret = exporter.disassemble(filename, out_dir);
+        exporter.output_sink->finish();
+        if (exporter.stats) {
+          save_file(stats_filename, exporter.stats->json().serialize(JSON::SerializeOption::FORMAT) + "\n");
         }
+        return ret ? 0 : 3;
       }
 
     } else { // modify_resource_map == true
@@ -0,0 +1,658 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <phosg/Filesystem.hh>
+#include <phosg/JSON.hh>
+#include <phosg/Platform.hh>
+#include <phosg/Strings.hh>
+#include <phosg/Time.hh>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Cli.hh"
+#include "Emulators/MemoryContext.hh"
+#include "ImageSaver.hh"
+#include "IndexFormats/Formats.hh"
+#include "MappedFile.hh"
+#include "ResourceCompression.hh"
+#include "ResourceDecompressors/System.hh"
+#include "ResourceFile.hh"
+#include "ResourceIDs.hh"
+#include "TextCodecs.hh"
+
+#ifndef PHOSG_WINDOWS
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace phosg;
+using namespace ResourceDASM;
+
+static const string RESOURCE_FORK_FILENAME_SUFFIX = "/..namedfork/rsrc";
+
+// Timing results for one stage (e.g. "decode:PICT"). Each call to the stage's
+// function is one sample; input_bytes is the total size of the data the stage
+// consumed, and output_bytes is the total size of the data it produced (if it
+// produces anything with a meaningful size).
+struct StageStats {
+  size_t failures = 0;
+  uint64_t input_bytes = 0;
+  uint64_t output_bytes = 0;
+  vector<uint64_t> latencies_usecs;
+
+  static uint64_t percentile(const vector<uint64_t>& sorted_values, size_t pct) {
+    if (sorted_values.empty()) {
+      return 0;
+    }
+    // Nearest-rank method; this always returns one of the actual samples
+    size_t rank = (sorted_values.size() * pct + 99) / 100;
+    return sorted_values[(rank > 0) ? (rank - 1) : 0];
+  }
+
+  JSON json() const {
+    vector<uint64_t> sorted_latencies = this->latencies_usecs;
+    sort(sorted_latencies.begin(), sorted_latencies.end());
+    uint64_t total_usecs = 0;
+    for (uint64_t usecs : sorted_latencies) {
+      total_usecs += usecs;
+    }
+    double total_secs = static_cast<double>(total_usecs) / 1000000.0;
+
+    auto ret = JSON::dict();
+    ret.emplace("count", sorted_latencies.size());
+    ret.emplace("failures", this->failures);
+    ret.emplace("input_bytes", this->input_bytes);
+    ret.emplace("output_bytes", this->output_bytes);
+    ret.emplace("total_usecs", total_usecs);
+    ret.emplace("p50_usecs", StageStats::percentile(sorted_latencies, 50));
+    ret.emplace("p99_usecs", StageStats::percentile(sorted_latencies, 99));
+    ret.emplace("max_usecs", sorted_latencies.empty() ? 0 : sorted_latencies.back());
+    if (total_secs > 0.0) {
+      ret.emplace("input_mb_per_sec", static_cast<double>(this->input_bytes) / (1048576.0 * total_secs));
+      ret.emplace("output_mb_per_sec", static_cast<double>(this->output_bytes) / (1048576.0 * total_secs));
+      ret.emplace("resources_per_sec", static_cast<double>(sorted_latencies.size()) / total_secs);
+    } else {
+      ret.emplace("input_mb_per_sec", nullptr);
+      ret.emplace("output_mb_per_sec", nullptr);
+      ret.emplace("resources_per_sec", nullptr);
+    }
+    return ret;
+  }
+};
+
+class Benchmark {
+public:
+  Benchmark()
+      : index_format(IndexFormat::RESOURCE_FORK),
+        use_data_fork(false),
+        num_iterations(1),
+        verbose(false),
+        compare_block_cache(false),
+        memory_access(false),
+        num_files(0),
+        decoded_audio_bytes(0) {}
+  ~Benchmark() = default;
+
+  IndexFormat index_format;
+  bool use_data_fork;
+  size_t num_iterations;
+  bool verbose;
+  // If true, compressed resources are also decompressed with only emulated
+  // decompressors, both with and without the emulators' block caches
+  bool compare_block_cache;
+  // If true, emulated memory accesses (MemoryContext reads and writes) are
+  // also timed, using synthetic data instead of the input files
+  bool memory_access;
+  ImageSaver image_saver;
+  // If not empty, only these types (and IDs) are decompressed and decoded
+  unordered_map<uint32_t, ResourceIDs> target_types_ids;
+
+  void run_path(const string& path) {
+    if (std::filesystem::is_directory(path)) {
+      // Sort the filenames so runs over the same corpus visit files in the same
+      // order, which makes results easier to compare
+      vector<string> filenames;
+      for (const auto& item : std::filesystem::recursive_directory_iterator(path)) {
+        if (item.is_regular_file()) {
+          filenames.emplace_back(item.path().string());
+        }
+      }
+      sort(filenames.begin(), filenames.end());
+      for (const auto& filename : filenames) {
+        this->run_file(filename);
+      }
+    } else {
+      this->run_file(path);
+    }
+  }
+
+  void run_memory_access() {
+    // The blocks are allocated separately, so that accesses alternating
+    // between them don't hit the cache of the last accessed block in strict
+    // mode (and may not hit the cache of the last accessed arena)
+    static constexpr size_t NUM_BLOCKS = 16;
+    static constexpr size_t BLOCK_SIZE = 0x10000;
+    static constexpr size_t TOTAL_BYTES = NUM_BLOCKS * BLOCK_SIZE;
+    MemoryContext mem;
+    vector<uint32_t> block_addrs;
+    for (size_t z = 0; z < NUM_BLOCKS; z++) {
+      block_addrs.emplace_back(mem.allocate(BLOCK_SIZE));
+    }
+
+    // The sum is written here so the compiler can't discard the reads
+    volatile uint32_t sum = 0;
+    auto read_sequential = [&]() -> size_t {
+      uint32_t s = 0;
+      for (uint32_t block_addr : block_addrs) {
+        for (uint32_t offset = 0; offset < BLOCK_SIZE; offset += 4) {
+          s += mem.read_u32b(block_addr + offset);
+        }
+      }
+      sum = s;
+      return 0;
+    };
+    auto read_alternating = [&]() -> size_t {
+      uint32_t s = 0;
+      for (uint32_t offset = 0; offset < BLOCK_SIZE; offset += 4) {
+        for (uint32_t block_addr : block_addrs) {
+          s += mem.read_u32b(block_addr + offset);
+        }
+      }
+      sum = s;
+      return 0;
+    };
+    auto write_sequential = [&]() -> size_t {
+      for (uint32_t block_addr : block_addrs) {
+        for (uint32_t offset = 0; offset < BLOCK_SIZE; offset += 4) {
+          mem.write_u32b(block_addr + offset, offset);
+        }
+      }
+      return 0;
+    };
+
+    for (bool strict : {false, true}) {
+      mem.set_strict(strict);
+      const char* suffix = strict ? "-strict" : "";
+      for (size_t z = 0; z < this->num_iterations; z++) {
+        this->time_stage(std::format("memory:write-sequential{}", suffix), TOTAL_BYTES, write_sequential);
+        this->time_stage(std::format("memory:read-sequential{}", suffix), TOTAL_BYTES, read_sequential);
+        this->time_stage(std::format("memory:read-alternating{}", suffix), TOTAL_BYTES, read_alternating);
+      }
+    }
+  }
+
+  JSON json(uint64_t wall_usecs) const {
+    auto stages_dict = JSON::dict();
+    for (const auto& [name, stats] : this->stages) {
+      stages_dict.emplace(name, stats.json());
+    }
+    int64_t peak_rss = Benchmark::peak_rss_bytes();
+
+    auto ret = JSON::dict();
+    ret.emplace("files", this->num_files);
+    ret.emplace("iterations", this->num_iterations);
+    ret.emplace("wall_usecs", wall_usecs);
+    if (peak_rss >= 0) {
+      ret.emplace("peak_rss_bytes", peak_rss);
+    } else {
+      ret.emplace("peak_rss_bytes", nullptr);
+    }
+    ret.emplace("stages", std::move(stages_dict));
+    return ret;
+  }
+
+private:
+  using DecodeFn = function<void(Benchmark&, const ResourceFile&, shared_ptr<const ResourceFile::Resource>)>;
+  static const unordered_map<uint32_t, DecodeFn> type_to_decode_fn;
+
+  map<string, StageStats> stages;
+  size_t num_files;
+  // Images produced by the most recent decode call; these are serialized (and
+  // timed separately) after the decode stage's timer stops
+  vector<function<size_t()>> pending_serializations;
+  // Size of the audio file produced by the most recent decode call, if any
+  size_t decoded_audio_bytes;
+
+  static int64_t peak_rss_bytes() {
+#ifndef PHOSG_WINDOWS
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
+      return -1;
+    }
+#ifdef PHOSG_MACOS
+    return usage.ru_maxrss; // Already in bytes on macOS
+#else
+    return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return -1;
+#endif
+  }
+
+  static const char* name_for_index_format(IndexFormat format) {
+    switch (format) {
+      case IndexFormat::RESOURCE_FORK:
+        return "resource-fork";
+      case IndexFormat::APPLESINGLE_APPLEDOUBLE:
+        return "as/ad";
+      case IndexFormat::MACBINARY:
+        return "macbinary";
+      case IndexFormat::MOHAWK:
+        return "mohawk";
+      case IndexFormat::HIRF:
+        return "hirf";
+      case IndexFormat::DC_DATA:
+        return "dc-data";
+      case IndexFormat::CBAG:
+        return "cbag";
+      default:
+        return "unknown";
+    }
+  }
+
+  // Calls fn once and records its latency in the given stage. fn returns the
+  // number of output bytes it produced; if it throws, the failure is counted
+  // but its latency is not recorded.
+  template <typename FnT>
+  bool time_stage(const string& stage_name, size_t input_bytes, FnT&& fn) {
+    auto& stats = this->stages[stage_name];
+    uint64_t start = now();
+    try {
+      size_t output_bytes = fn();
+      stats.latencies_usecs.emplace_back(now() - start);
+      stats.input_bytes += input_bytes;
+      stats.output_bytes += output_bytes;
+      return true;
+    } catch (const exception& e) {
+      stats.failures++;
+      if (this->verbose) {
+        fwrite_fmt(stderr, "warning: {} failed: {}\n", stage_name, e.what());
+      }
+      return false;
+    }
+  }
+
+  template <PixelFormat Format>
+  void add_image(Image<Format>&& img) {
+    if (img.get_width() == 0 || img.get_height() == 0) {
+      return;
+    }
+    auto shared_img = make_shared<Image<Format>>(std::move(img));
+    this->pending_serializations.emplace_back([this, shared_img]() -> size_t {
+      return this->image_saver.serialize_image(*shared_img).size();
+    });
+  }
+
+  bool should_process(uint32_t type, int16_t id) const {
+    if (this->target_types_ids.empty()) {
+      return true;
+    }
+    auto it = this->target_types_ids.find(type);
+    return (it != this->target_types_ids.end()) && it->second[id];
+  }
+
+  void run_file(const string& filename) {
+    string input_filename = filename;
+    if (!this->use_data_fork && std::filesystem::is_regular_file(filename + RESOURCE_FORK_FILENAME_SUFFIX)) {
+      input_filename = filename + RESOURCE_FORK_FILENAME_SUFFIX;
+    }
+
+    shared_ptr<const MappedFile> mapped_file;
+    try {
+      mapped_file = make_shared<MappedFile>(input_filename);
+    } catch (const exception& e) {
+      if (this->verbose) {
+        fwrite_fmt(stderr, "warning: cannot open {}: {}\n", input_filename, e.what());
+      }
+      return;
+    }
+    if (mapped_file->size() == 0) {
+      return;
+    }
+
+    // Parse the index num_iterations times, but only keep the last result
+    string index_stage_name = std::format("index:{}", Benchmark::name_for_index_format(this->index_format));
+    optional<ResourceFile> rf;
+    for (size_t z = 0; z < this->num_iterations; z++) {
+      rf.reset();
+      bool success = this->time_stage(index_stage_name, mapped_file->size(), [&]() -> size_t {
+        rf.emplace(parse_lazy_resource_file(this->index_format, mapped_file));
+        return 0;
+      });
+      if (!success) {
+        return;
+      }
+    }
+    this->num_files++;
+
+    for (const auto& [type, id] : rf->all_resources()) {
+      if (!this->should_process(type, id)) {
+        continue;
+      }
+
+      shared_ptr<const ResourceFile::Resource> res;
+      try {
+        res = rf->get_resource(type, id, DecompressionFlag::DISABLED);
+      } catch (const exception& e) {
+        if (this->verbose) {
+          fwrite_fmt(stderr, "warning: cannot load {}:{} from {}: {}\n",
+              string_for_resource_type(type), id, filename, e.what());
+        }
+        continue;
+      }
+
+      if (res->flags & ResourceFlag::FLAG_COMPRESSED) {
+        this->run_decompression(*rf, res);
+      }
+
+      auto fn_it = Benchmark::type_to_decode_fn.find(type);
+      if (fn_it != Benchmark::type_to_decode_fn.end()) {
+        this->run_decode(*rf, type, id, fn_it->second);
+      }
+    }
+  }
+
+  void run_decompression(const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+    string stage_name = "decompress:unknown";
+    if (res->data.size() >= sizeof(CompressedResourceHeader)) {
+      const auto& header = *reinterpret_cast<const CompressedResourceHeader*>(res->data.data());
+      if (header.header_version == 9) {
+        stage_name = std::format("decompress:dcmp{}", static_cast<int16_t>(header.version.v9.dcmp_resource_id));
+      } else if (header.header_version == 8) {
+        stage_name = std::format("decompress:dcmp{}", static_cast<int16_t>(header.version.v8.dcmp_resource_id));
+      }
+    }
+
+    for (size_t z = 0; z < this->num_iterations; z++) {
+      this->time_stage(stage_name, res->data.size(), [&]() -> size_t {
+        return decompress_resource(res, 0, &rf)->data.size();
+      });
+    }
+
+    if (this->compare_block_cache) {
+      string suffix = stage_name.substr(stage_name.find(':'));
+      string emulated_stage_name = "decompress-emulated" + suffix;
+      string uncached_stage_name = "decompress-emulated-no-block-cache" + suffix;
+      for (size_t z = 0; z < this->num_iterations; z++) {
+        this->time_stage(emulated_stage_name, res->data.size(), [&]() -> size_t {
+          return decompress_resource(res, DecompressionFlag::SKIP_NATIVE, &rf)->data.size();
+        });
+        this->time_stage(uncached_stage_name, res->data.size(), [&]() -> size_t {
+          return decompress_resource(res, DecompressionFlag::SKIP_NATIVE | DecompressionFlag::DISABLE_BLOCK_CACHE, &rf)->data.size();
+        });
+      }
+    }
+  }
+
+  void run_decode(const ResourceFile& rf, uint32_t type, int16_t id, const DecodeFn& fn) {
+    // The resource is decompressed here (if needed) so that decompression time
+    // isn't counted as part of the decode stage
+    shared_ptr<const ResourceFile::Resource> res;
+    try {
+      res = rf.get_resource(type, id);
+    } catch (const exception&) {
+      return;
+    }
+
+    string decode_stage_name = "decode:" + string_for_resource_type(type);
+    string serialize_stage_name = "serialize:" + this->image_saver.file_extension();
+    for (size_t z = 0; z < this->num_iterations; z++) {
+      this->pending_serializations.clear();
+      this->decoded_audio_bytes = 0;
+      this->time_stage(decode_stage_name, res->data.size(), [&]() -> size_t {
+        fn(*this, rf, res);
+        return this->decoded_audio_bytes;
+      });
+      for (const auto& serialize_fn : this->pending_serializations) {
+        this->time_stage(serialize_stage_name, 0, serialize_fn);
+      }
+    }
+    this->pending_serializations.clear();
+  }
+
+  // The sound decoders produce a complete WAV or MP3 file, so for sounds,
+  // serialization is included in the decode stage, and the file's size is
+  // recorded as the decode stage's output
+  void add_sound(const ResourceFile::DecodedSoundResource& snd) {
+    this->decoded_audio_bytes += snd.data.size();
+  }
+};
+
+const unordered_map<uint32_t, Benchmark::DecodeFn> Benchmark::type_to_decode_fn = {
+    {RESOURCE_TYPE_cicn, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       auto decoded = ResourceFile::decode_cicn(res);
+       b.add_image(std::move(decoded.image));
+       b.add_image(std::move(decoded.bitmap));
+     }},
+    {RESOURCE_TYPE_CURS, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(ResourceFile::decode_CURS(res).bitmap);
+     }},
+    {RESOURCE_TYPE_crsr, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       auto decoded = ResourceFile::decode_crsr(res);
+       b.add_image(std::move(decoded.image));
+       b.add_image(std::move(decoded.bitmap));
+     }},
+    {RESOURCE_TYPE_ppat, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       auto decoded = ResourceFile::decode_ppat(res);
+       b.add_image(std::move(decoded.pattern));
+       b.add_image(std::move(decoded.monochrome_pattern));
+     }},
+    {RESOURCE_TYPE_PAT, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(ResourceFile::decode_PAT(res));
+     }},
+    {RESOURCE_TYPE_SICN, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       for (auto& img : ResourceFile::decode_SICN(res)) {
+         b.add_image(std::move(img));
+       }
+     }},
+    {RESOURCE_TYPE_ICNN, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(ResourceFile::decode_ICNN(res).composite);
+     }},
+    {RESOURCE_TYPE_ICON, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(ResourceFile::decode_ICON(res));
+     }},
+    {RESOURCE_TYPE_icl8, [](Benchmark& b, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(rf.decode_icl8(res));
+     }},
+    {RESOURCE_TYPE_ics8, [](Benchmark& b, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(rf.decode_ics8(res));
+     }},
+    {RESOURCE_TYPE_icl4, [](Benchmark& b, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(rf.decode_icl4(res));
+     }},
+    {RESOURCE_TYPE_ics4, [](Benchmark& b, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(rf.decode_ics4(res));
+     }},
+    {RESOURCE_TYPE_icns, [](Benchmark& b, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       auto decoded = ResourceFile::decode_icns(res);
+       for (auto& [_, img] : decoded.type_to_image) {
+         b.add_image(std::move(img));
+       }
+     }},
+    {RESOURCE_TYPE_PICT, [](Benchmark& b, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_image(rf.decode_PICT(res, false).image);
+     }},
+    {RESOURCE_TYPE_snd, [](Benchmark& b, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_sound(rf.decode_snd(res));
+     }},
+    {RESOURCE_TYPE_csnd, [](Benchmark& b, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_sound(rf.decode_csnd(res));
+     }},
+    {RESOURCE_TYPE_esnd, [](Benchmark& b, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       b.add_sound(rf.decode_esnd(res));
+     }},
+    {RESOURCE_TYPE_FONT, [](Benchmark&, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       rf.decode_FONT(res);
+     }},
+    {RESOURCE_TYPE_NFNT, [](Benchmark&, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       rf.decode_NFNT(res);
+     }},
+    {RESOURCE_TYPE_INST, [](Benchmark&, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       rf.decode_INST(res);
+     }},
+    {RESOURCE_TYPE_SONG, [](Benchmark&, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       rf.decode_SONG(res);
+     }},
+    {RESOURCE_TYPE_STR, [](Benchmark&, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       ResourceFile::decode_STR(res);
+     }},
+    {RESOURCE_TYPE_STRN, [](Benchmark&, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       ResourceFile::decode_STRN(res);
+     }},
+    {RESOURCE_TYPE_TEXT, [](Benchmark&, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       ResourceFile::decode_TEXT(res);
+     }},
+    {RESOURCE_TYPE_styl, [](Benchmark&, const ResourceFile& rf, shared_ptr<const ResourceFile::Resource> res) {
+       rf.decode_styl(res);
+     }},
+    {RESOURCE_TYPE_DITL, [](Benchmark&, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       ResourceFile::decode_DITL(res);
+     }},
+    {RESOURCE_TYPE_MENU, [](Benchmark&, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       ResourceFile::decode_MENU(res);
+     }},
+    {RESOURCE_TYPE_SIZE, [](Benchmark&, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       ResourceFile::decode_SIZE(res);
+     }},
+    {RESOURCE_TYPE_vers, [](Benchmark&, const ResourceFile&, shared_ptr<const ResourceFile::Resource> res) {
+       ResourceFile::decode_vers(res);
+     }},
+};
+
+static void print_usage() {
+  fputs("\
+Usage: resource_dasm_bench [options] input-path [input-path...]\n\
+\n\
+Loads every file in the given paths (directories are searched recursively)\n\
+and times each stage of resource_dasm's pipeline separately: parsing the\n\
+resource index, decompressing compressed resources (grouped by decompressor\n\
+ID), decoding each supported resource type, and serializing the decoded\n\
+images. (Sound decoders produce complete WAV files, so their timings include\n\
+serialization.) The results are written as JSON, including throughput, median and\n\
+99th-percentile latency for each stage, and the peak memory usage of the\n\
+process. No output files are written.\n\
+\n\
+Input options:\n\
+  --data-fork\n\
+      Read resources from the input files' data forks instead of their\n\
+      resource forks. If a file has no resource fork, its data fork is used\n\
+      even if this option isn't given.\n\
+  --index-format=FORMAT\n\
+      Parse the input files as this type of archive. FORMAT may be\n\
+      resource-fork (the default), as/ad, macbinary, mohawk, hirf, dc-data,\n\
+      or cbag. All formats except resource-fork imply --data-fork.\n\
+  --target=TYPE[:IDS]\n\
+      Only decompress and decode resources of this type (and optionally only\n\
+      these IDs; see resource_dasm's usage information for the format). May\n\
+      be given multiple times. All resources are still indexed.\n\
+\n\
+Benchmark options:\n\
+  --iterations=N\n\
+      Run each stage N times on each input (default 1). Every run is recorded\n\
+      as a separate sample.\n\
+  --compare-block-cache\n\
+      Also decompress each compressed resource using only the emulated\n\
+      decompressors, once with the emulators' decoded block caches enabled\n\
+      (recorded in decompress-emulated:* stages) and once with them disabled\n\
+      (recorded in decompress-emulated-no-block-cache:* stages).\n\
+  --memory-access\n\
+      Also time reads and writes of emulated memory, using synthetic data in\n\
+      16 separately-allocated blocks. Accesses are sequential within each\n\
+      block, or alternate between the blocks; each pattern is run with and\n\
+      without strict memory checking (recorded in memory:* stages). When this\n\
+      option is given, no input paths are required.\n\
+  --image-format=FORMAT\n\
+      Serialize decoded images in this format (bmp, ppm, or png; default\n\
+      bmp).\n\
+  --output=FILENAME\n\
+      Write the results to this file instead of to stdout.\n\
+  --verbose\n\
+      Log each failed stage to stderr.\n\
+\n",
+      stderr);
+}
+
+int main(int argc, char** argv) {
+  Benchmark bench;
+  vector<string> input_paths;
+  string output_filename;
+  for (int x = 1; x < argc; x++) {
+    if (argv[x][0] == '-' && argv[x][1] != '\0') {
+      if (!strcmp(argv[x], "--data-fork")) {
+        bench.use_data_fork = true;
+      } else if (!strcmp(argv[x], "--index-format=resource-fork")) {
+        bench.index_format = IndexFormat::RESOURCE_FORK;
+      } else if (!strcmp(argv[x], "--index-format=as/ad")) {
+        bench.index_format = IndexFormat::APPLESINGLE_APPLEDOUBLE;
+        bench.use_data_fork = true;
+      } else if (!strcmp(argv[x], "--index-format=macbinary")) {
+        bench.index_format = IndexFormat::MACBINARY;
+        bench.use_data_fork = true;
+      } else if (!strcmp(argv[x], "--index-format=mohawk")) {
+        bench.index_format = IndexFormat::MOHAWK;
+        bench.use_data_fork = true;
+      } else if (!strcmp(argv[x], "--index-format=hirf")) {
+        bench.index_format = IndexFormat::HIRF;
+        bench.use_data_fork = true;
+      } else if (!strcmp(argv[x], "--index-format=dc-data")) {
+        bench.index_format = IndexFormat::DC_DATA;
+        bench.use_data_fork = true;
+      } else if (!strcmp(argv[x], "--index-format=cbag")) {
+        bench.index_format = IndexFormat::CBAG;
+        bench.use_data_fork = true;
+      } else if (!strncmp(argv[x], "--target=", 9)) {
+        ResourceIDs ids(ResourceIDs::Init::NONE);
+        bench.target_types_ids.emplace(parse_cli_type_ids(&argv[x][9], &ids), ids);
+      } else if (!strncmp(argv[x], "--iterations=", 13)) {
+        bench.num_iterations = strtoull(&argv[x][13], nullptr, 0);
+        if (bench.num_iterations == 0) {
+          fwrite_fmt(stderr, "--iterations must be at least 1\n");
+          return 2;
+        }
+      } else if (!strncmp(argv[x], "--output=", 9)) {
+        output_filename = &argv[x][9];
+      } else if (!strcmp(argv[x], "--verbose")) {
+        bench.verbose = true;
+      } else if (!strcmp(argv[x], "--compare-block-cache")) {
+        bench.compare_block_cache = true;
+      } else if (!strcmp(argv[x], "--memory-access")) {
+        bench.memory_access = true;
+      } else if (!bench.image_saver.process_cli_arg(argv[x])) {
+        fwrite_fmt(stderr, "unknown option: {}\n", argv[x]);
+        print_usage();
+        return 2;
+      }
+    } else {
+      input_paths.emplace_back(argv[x]);
+    }
+  }
+
+  if (input_paths.empty() && !bench.memory_access) {
+    print_usage();
+    return 2;
+  }
+
+  uint64_t start = now();
+  if (bench.memory_access) {
+    bench.run_memory_access();
+  }
+  for (const auto& path : input_paths) {
+    bench.run_path(path);
+  }
+  string result = bench.json(now() - start).serialize(JSON::SerializeOption::FORMAT) + "\n";
+
+  if (output_filename.empty()) {
+    fwritex(stdout, result);
+  } else {
+    save_file(output_filename, result);
+  }
+  return 0;
+}